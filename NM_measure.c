@@ -16,6 +16,14 @@
 // This function returns the qubit wavefunction e0(t) in the single-excitation sector
 // subject to e0(0)=0 and an exponential wavepacket
 double complex e0(int j, grid * simulation)
+{
+    return e0_photon(j, simulation->k, simulation->alpha, simulation);
+}
+
+
+// the same for the exponential wavepacket of wavenumber k and width alpha, which need not
+// be those of the grid (two different photons)
+double complex e0_photon(int j, double k, double alpha, grid * simulation)
 {
     if(j<=0) return 0;
 
@@ -23,8 +31,7 @@ double complex e0(int j, grid * simulation)
     double td        = simulation->nx*simulation->Delta;
     double w0        = simulation->w0;
     double Gamma     = simulation->Gamma;
-    double alpha     = simulation->alpha;
-    double complex K = I*simulation->k + 0.5*alpha*Gamma;
+    double complex K = I*k + 0.5*alpha*Gamma;
     double complex W = I*w0 + 0.5*Gamma;
     double complex p = -I*(K - W);
 
@@ -33,7 +40,7 @@ double complex e0(int j, grid * simulation)
 
     for(int n=1; n<=(j/simulation->nx); n++)
     {
-        double complex temp = ( cexp( n*log(t-n*td) - W*(t-n*td) - lgamma(n+1) ) \
+        double complex temp = ( cexp( n*log(t-n*td) - W*(t-n*td) - log_gamma(n+1) ) \
                        - (I*K+w0) * incomplete_gamma_e(n+1, -I*p*(t-n*td), n*clog(I) - (n+1)*clog(p) - K*(t-n*td) ) );
 
         temp *= pow(0.5*Gamma, n-0.5);
@@ -47,14 +54,14 @@ double complex e0(int j, grid * simulation)
 	   sum += temp;
     }
     e_t -= I*sqrt(alpha*Gamma)*sum;
-    e_t *= cexp(-0.5*I*(simulation->k)*td); //TODO: this phase factor can be eliminated by absorbing into the wavepacket
+    e_t *= cexp(-0.5*I*k*td); //TODO: this phase factor can be eliminated by absorbing into the wavepacket
 
     if(!isnan(cabs(e_t)))
        return e_t;
     else
     {
        fprintf(stderr, "%s: NaN is produced (at j=%i). Abort!\n", __func__, j);
-       exit(EXIT_FAILURE);
+       return NAN;
     }
 }
 
@@ -75,7 +82,7 @@ double complex e1(int j, grid * simulation)
     double complex sum = 0;
     for(int n=1; n<=(j/simulation->nx); n++)
     {
-        double complex temp = exp(-lgamma(n+1)) * cpow(0.5*Gamma*cexp(W*td)*(t-n*td), n);
+        double complex temp = exp(-log_gamma(n+1)) * cpow(0.5*Gamma*cexp(W*td)*(t-n*td), n);
 
 	// based on my observation, the wavefunction should converge very fast, 
 	// so one can just cut the summation off if the precision is reached.
@@ -92,7 +99,7 @@ double complex e1(int j, grid * simulation)
     else
     {
        fprintf(stderr, "%s: NaN is produced (at j=%i). Abort!\n", __func__, j);
-       exit(EXIT_FAILURE);
+       return NAN;
     }
 }
 
@@ -100,12 +107,14 @@ double complex e1(int j, grid * simulation)
 //compute the photon wavefunction phi(x,t) in the single-excitation sector
 double complex phi(int j, int i, grid * simulation)
 {
-   //cannot go beyond "the box"
+#ifdef FDTD_CHECKED
+   //cannot go beyond "the box"; mu checks its row once in the other builds
    if(j<0 || j>=simulation->Ny || i<0 || i>simulation->Ntotal)
    {
       fprintf(stderr, "%s: argument is outside the simulation region (j=%i, i=%i). Abort!\n", __func__, j, i);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
+#endif
 
    double complex Phi = one_photon_exponential(i-simulation->origin_index-j, simulation->k, simulation->alpha, simulation);
 
@@ -128,7 +137,7 @@ double lambda(int j, grid * simulation)
    if(j<0)
    {
       fprintf(stderr, "%s: argument j is negative (j=%i). Abort!\n", __func__, j);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
 
    if(j==0) return 1.0;
@@ -144,15 +153,21 @@ double complex mu(int j, grid * simulation)
    if(j<0)
    {
       fprintf(stderr, "%s: argument j is negative (j=%i). Abort!\n", __func__, j);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
 
    if(j==0) return 1.0;
 
+   int xmax = j + simulation->plus_a_index;
+   if(j>=simulation->Ny || xmax>simulation->Ntotal-1) //phi and psi are read at the columns [minus_a_index, xmax] of row j
+   {
+      fprintf(stderr, "%s: row j=%i reaches outside the simulation region. Abort!\n", __func__, j);
+      return NAN;
+   }
+
    double complex Mu = exp(- simulation->alpha * simulation->Gamma * j * simulation->Delta) * simulation->e1[j];
    double complex sum = 0;
 
-   int xmax = j + simulation->plus_a_index;
    //trapezoidal rule
    sum += 0.5 * conj( phi(j, simulation->minus_a_index, simulation) ) * simulation->psi[j][simulation->minus_a_index];
    for(int i = simulation->minus_a_index+1; i<xmax; i++)
@@ -165,7 +180,7 @@ double complex mu(int j, grid * simulation)
 }
 
 
-void save_e0(grid * simulation, const char * filename, double (*part)(double complex))
+int save_e0(grid * simulation, const char * filename, double (*part)(double complex))
 {
     char * str = strdup(filename);
     str = realloc(str, (strlen(filename)+14)*sizeof(char) );
@@ -183,16 +198,23 @@ void save_e0(grid * simulation, const char * filename, double (*part)(double com
     }
 
     FILE * f = fopen(str, "w");
+    if(!f)
+    {
+        fprintf(stderr, "%s: file cannot be created!\n", __func__);
+        free(str);
+        return FDTD_ERROR_FILE;
+    }
 
     for(int j=0; j<simulation->Ny; j++)
        fprintf( f, "%.10g\n", part(simulation->e0[j]) );
 
-    fclose(f);
+    close_output_file(f, simulation);
     free(str);
+    return FDTD_SUCCESS;
 }
 
 
-void save_e1(grid * simulation, const char * filename, double (*part)(double complex))
+int save_e1(grid * simulation, const char * filename, double (*part)(double complex))
 {
     char * str = strdup(filename);
     str = realloc(str, (strlen(filename)+14)*sizeof(char) );
@@ -210,16 +232,23 @@ void save_e1(grid * simulation, const char * filename, double (*part)(double com
     }
 
     FILE * f = fopen(str, "w");
+    if(!f)
+    {
+        fprintf(stderr, "%s: file cannot be created!\n", __func__);
+        free(str);
+        return FDTD_ERROR_FILE;
+    }
 
     for(int j=0; j<simulation->Ny; j++)
        fprintf( f, "%.10g\n", part(simulation->e1[j]) );
 
-    fclose(f);
+    close_output_file(f, simulation);
     free(str);
+    return FDTD_SUCCESS;
 }
 
 
-void save_mu(grid * simulation, const char * filename, double (*part)(double complex))
+int save_mu(grid * simulation, const char * filename, double (*part)(double complex))
 {
     char * str = strdup(filename);
     str = realloc(str, (strlen(filename)+14)*sizeof(char) );
@@ -238,16 +267,23 @@ void save_mu(grid * simulation, const char * filename, double (*part)(double com
 
     int Tmax = (simulation->Ny-1 < simulation->Nx - simulation->nx/2 ? simulation->Ny-1 : simulation->Nx - simulation->nx/2);
     FILE * f = fopen(str, "w");
+    if(!f)
+    {
+        fprintf(stderr, "%s: file cannot be created!\n", __func__);
+        free(str);
+        return FDTD_ERROR_FILE;
+    }
 
     for(int j=0; j<Tmax; j++)
        fprintf( f, "%.10g\n", part(simulation->mu[j]) );
 
-    fclose(f);
+    close_output_file(f, simulation);
     free(str);
+    return FDTD_SUCCESS;
 }
 
 
-void save_lambda(grid * simulation, const char * filename)
+int save_lambda(grid * simulation, const char * filename)
 {
     char * str = strdup(filename);
     str = realloc(str, (strlen(filename)+14)*sizeof(char) );
@@ -255,39 +291,53 @@ void save_lambda(grid * simulation, const char * filename)
 
     int Tmax = (simulation->Ny-1 < simulation->Nx - simulation->nx/2 ? simulation->Ny-1 : simulation->Nx - simulation->nx/2);
     FILE * f = fopen(str, "w");
+    if(!f)
+    {
+        fprintf(stderr, "%s: file cannot be created!\n", __func__);
+        free(str);
+        return FDTD_ERROR_FILE;
+    }
 
     for(int j=0; j<Tmax; j++)
        fprintf( f, "%.10g\n", simulation->lambda[j] );
 
-    fclose(f);
+    close_output_file(f, simulation);
     free(str);
+    return FDTD_SUCCESS;
 }
 
 
 //calculate and save lambda(t) and mu(t)
-void calculate_NM_measure(grid * simulation, const char * filename)
+int calculate_NM_measure(grid * simulation, const char * filename)
 {
     int Tmax = (simulation->Ny-1 < simulation->Nx - simulation->nx/2 ? simulation->Ny-1 : simulation->Nx - simulation->nx/2);
 
     //their memory is not allocated until this function is called
     simulation->lambda = calloc(Tmax, sizeof(*simulation->lambda));
     simulation->mu     = calloc(Tmax, sizeof(*simulation->mu));
+    int status = FDTD_SUCCESS;
     if(!simulation->lambda || !simulation->mu)
     {
        fprintf(stderr, "%s: memory allocation failed. Abort!\n", __func__);
-       exit(EXIT_FAILURE);
+       status = FDTD_ERROR_MEMORY;
     }
 
-    for(int j=0; j<Tmax; j++)
+    for(int j=0; j<Tmax && !status; j++)
     {
        simulation->lambda[j] = lambda(j, simulation);
        simulation->mu[j]     = mu(j, simulation);
+       if(isnan(simulation->lambda[j]) || isnan(cabs(simulation->mu[j])))
+          status = FDTD_ERROR_NUMERIC;
     }
 
-    save_lambda(simulation, filename);
-    save_mu(simulation, filename, creal);
-    save_mu(simulation, filename, cimag);
+    if(!status) status = save_lambda(simulation, filename);
+    if(!status) status = save_mu(simulation, filename, creal);
+    if(!status) status = save_mu(simulation, filename, cimag);
 
     free(simulation->lambda);
     free(simulation->mu);
+    simulation->lambda = NULL;
+    simulation->mu = NULL;
+
+    return status;
 }
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+
+static const char cache_magic[8] = "FDTDTAB";
+
+//set once by the job server before any grid is created
+static const char * default_dir = NULL;
+
+//the parameters a table depends on (the unused ones are 0)
+struct table_key
+{
+   char kind[8];
+   int nx;
+   double Delta, w0, Gamma, k, alpha;
+};
+
+struct table_header
+{
+   char magic[8];
+   struct table_key key;
+   int rows;
+};
+
+
+//the key is hashed and compared byte by byte, so the padding must be cleared
+static void make_key(const grid * simulation, const char * kind, double k, double alpha, struct table_key * key)
+{
+   memset(key, 0, sizeof(*key));
+   strncpy(key->kind, kind, sizeof(key->kind)-1);
+   key->nx = simulation->nx;
+   key->Delta = simulation->Delta;
+   key->w0 = simulation->w0;
+   key->Gamma = simulation->Gamma;
+   key->k = k;
+   key->alpha = alpha;
+}
+
+
+//64-bit FNV-1a
+static uint64_t fnv1a(const void * data, size_t size)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   for(size_t n=0; n<size; n++)
+   {
+      hash ^= ((const unsigned char *)data)[n];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+
+//cache_dir/kind-hash.bin (malloc'd), or NULL if no cache is used
+static char * table_path(const grid * simulation, const struct table_key * key)
+{
+   if(!simulation->cache_dir || simulation->coarser)
+      return NULL;
+
+   char * path = malloc(strlen(simulation->cache_dir)+40);
+   if(path)
+      sprintf(path, "%s/%s-%016llx.bin", simulation->cache_dir, key->kind, (unsigned long long)fnv1a(key, sizeof(*key)));
+   return path;
+}
+
+
+int cache_load_table(grid * simulation, const char * kind, double k, double alpha, double complex * table)
+{
+   struct table_key key;
+   make_key(simulation, kind, k, alpha, &key);
+   char * path = table_path(simulation, &key);
+   if(!path)
+      return 0;
+
+   int fd = open(path, O_RDONLY);
+   free(path);
+   if(fd < 0)
+      return 0; //not cached yet
+
+   int rows = 0;
+   struct stat file;
+   if(fstat(fd, &file) == 0 && (size_t)file.st_size >= sizeof(struct table_header))
+   {
+      void * map = mmap(NULL, file.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(map != MAP_FAILED)
+      {
+         const struct table_header * h = map;
+         if(memcmp(h->magic, cache_magic, sizeof(cache_magic)) == 0 && memcmp(&h->key, &key, sizeof(key)) == 0
+            && h->rows > 0 && (size_t)file.st_size >= sizeof(*h) + h->rows*sizeof(*table))
+         {
+            rows = (h->rows < simulation->Ny ? h->rows : simulation->Ny);
+            memcpy(table, (const char *)map + sizeof(*h), rows*sizeof(*table));
+         }
+         else
+            fprintf(stderr, "%s: Warning: the cached %s table does not match the parameters, and is recomputed.\n", __func__, kind);
+         munmap(map, file.st_size);
+      }
+   }
+   close(fd);
+   return rows;
+}
+
+
+void cache_store_table(grid * simulation, const char * kind, double k, double alpha, const double complex * table, int cached)
+{
+   if(cached >= simulation->Ny)
+      return;
+
+   struct table_key key;
+   make_key(simulation, kind, k, alpha, &key);
+   char * path = table_path(simulation, &key);
+   if(!path)
+      return;
+
+   //a failure here only costs the time to compute the table in the next run
+   if(mkdir(simulation->cache_dir, 0777) != 0 && errno != EEXIST)
+   {
+      fprintf(stderr, "%s: Warning: cannot create %s, the %s table is not cached.\n", __func__, simulation->cache_dir, kind);
+      free(path);
+      return;
+   }
+   char * temporary = malloc(strlen(path)+32);
+   if(!temporary)
+   {
+      free(path);
+      return;
+   }
+   sprintf(temporary, "%s.%ld.tmp", path, (long)getpid());
+
+   struct table_header h;
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, cache_magic, sizeof(h.magic));
+   h.key = key;
+   h.rows = simulation->Ny;
+
+   FILE * f = fopen(temporary, "wb");
+   int ok = (f && fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(table, sizeof(*table), simulation->Ny, f) == (size_t)simulation->Ny);
+   if(f && fclose(f) != 0)
+      ok = 0;
+   if(!ok || rename(temporary, path) != 0)
+   {
+      fprintf(stderr, "%s: Warning: cannot write %s, the %s table is not cached.\n", __func__, temporary, kind);
+      remove(temporary);
+   }
+   free(temporary);
+   free(path);
+}
+
+
+void cache_set_default_dir(const char * dir)
+{
+   default_dir = dir;
+}
+
+
+const char * cache_default_dir(void)
+{
+   return default_dir;
+}
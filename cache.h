@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "grid.h"
+
+/*
+   Cache of the qubit tables (set cache_dir=... in the input file).
+
+   The tables computed from the closed forms with the incomplete_gamma_e
+   series only depend on a few parameters, and not on Ny except through their
+   length:
+
+      e0: nx, Delta, w0, gamma, k, alpha (also e0 of each photon, init_cond=3)
+      e1: nx, Delta, w0, gamma
+      pw: nx, Delta, w0, gamma, k (the qubit factor of the plane-wave boundary
+          strip, init_cond=1; the strip is this factor times a phase)
+
+   Each table is stored in cache_dir (created if needed) under a name that
+   holds the 64-bit FNV-1a hash of these parameters, e.g. e1-0123456789abcdef.bin,
+   with the parameters repeated in the header to rule out collisions. When a
+   grid is set up, the stored rows are mapped with mmap and copied into the
+   table, only the rows beyond them are computed, and a longer table replaces
+   the stored one (written to a temporary file and renamed, so concurrent jobs
+   never see a partial table). The values are bit-for-bit those computed
+   without the cache. A missing or unusable cache only costs the time to
+   compute the tables, with a warning; it is not used by the refined grids of
+   richardson, whose tables come from the coarser grid.
+
+   The job server (see server.h) sets a default cache_dir for all the jobs of
+   the process; an input file can still choose its own, or none with
+   cache_dir=none.
+*/
+
+//the number of leading rows of the table (at most Ny) found in the cache and copied into table
+int cache_load_table(grid * simulation, const char * kind, double k, double alpha, double complex * table);
+
+//store the Ny rows of table unless the cache already held them (cached = cache_load_table's result)
+void cache_store_table(grid * simulation, const char * kind, double k, double alpha, const double complex * table, int cached);
+
+//the cache_dir of the grids whose input file does not give one (default: NULL, no cache)
+void cache_set_default_dir(const char * dir);
+const char * cache_default_dir(void);
+
+#endif
@@ -17,6 +17,10 @@
 //a collection of inline functions 
 double complex square_average(int j, int i, grid * simulation);
 double complex bar_average(int j, int i, grid * simulation);
+double complex two_photon_input_mode(int init_cond, int identical_photons, double x1, double x2, grid * simulation);
 double complex two_photon_input(double x1, double x2, grid * simulation);
 double complex one_photon_exponential(double x, double k, double alpha, grid * simulation);
+double complex tabulated_wavepacket(double x, grid * simulation);
+double tabulated_norm(double t, grid * simulation);
 double psi_square_integral(int j, grid * simulation);
+double complex carrier(double j, double i, grid * simulation);
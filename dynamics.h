@@ -26,23 +26,31 @@
  *   https://stackoverflow.com/questions/6312597/
  *   https://gustedt.wordpress.com/2010/11/29/myth-and-reality-about-inline-in-c99/
  *   http://www.drdobbs.com/the-new-c-inline-functions/184401540
+ *
+ * None of these functions terminates the program: on invalid arguments they print
+ * a message and return NaN, which the march detects at the end of the row. The bounds
+ * of square_average and bar_average are only checked in the checked build (make debug,
+ * which defines FDTD_CHECKED); otherwise the callers keep them in the grid, as the
+ * march does by verifying its stencil plan once when the grid is set up (see stencil.h).
  */
 
 // this function computes the average of 4 points that form a square
 // j and i are the array indices psi[j][i] of the upper right corner
 inline double complex square_average(int j, int i, grid * simulation)
 {
+#ifdef FDTD_CHECKED
    if(i<1) //beyond the boundary x=-(Nx+nx+1)*Delta
    {
       fprintf(stderr, "Error in %s: beyond left boundary. Abort!\n", __func__);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
 
    if(i>simulation->Ntotal-1) //beyond the boundary x=Nx*Delta
    {
       fprintf(stderr, "Error in %s: beyond right boundary. Abort!\n", __func__);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
+#endif
 
    if(j<1) //everything is zero below t=0
       return 0;
@@ -64,17 +72,19 @@ inline double complex square_average(int j, int i, grid * simulation)
 // j and i are the array indices psi[j][i] of the right end
 inline double complex bar_average(int j, int i, grid * simulation)
 {
+#ifdef FDTD_CHECKED
    if(i<1) //beyond the boundary x=-(Nx+nx+1)*Delta
    {
       fprintf(stderr, "Error in %s: beyond left boundary. Abort!\n", __func__);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
 
    if(i>simulation->Ntotal-1) //beyond the boundary x=Nx*Delta
    {
       fprintf(stderr, "Error in %s: beyond right boundary. Abort!\n", __func__);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
+#endif
 
    if(j<0) //everything is zero below t=0
       return 0;
@@ -96,19 +106,49 @@ inline double complex one_photon_exponential(double x, double k, double alpha, g
 }
 
 
-//this function computes chi(x1, x2, 0)
+// this function interpolates linearly the tabulated wavepacket (init_cond=4 and 5), which is sampled at
+// x = -a - n*wavepacket_dx (n=0, 1, ...) and is zero outside the table; x is in units of Delta as above
+inline double complex tabulated_wavepacket(double x, grid * simulation)
+{
+   double n = (-0.5*simulation->nx - x)/simulation->wavepacket_dx;
+   if(n<0 || n>simulation->wavepacket_size-1)
+      return 0;
+
+   int m = (int)n;
+   if(m == simulation->wavepacket_size-1)
+      return simulation->wavepacket[m];
+   return (m+1-n)*simulation->wavepacket[m] + (n-m)*simulation->wavepacket[m+1];
+}
+
+
+// this function returns \int_{-\infty}^{-a-t} dx |phi(x)|^2 for the tabulated wavepacket (t in units of Delta)
+inline double tabulated_norm(double t, grid * simulation)
+{
+   double n = t/simulation->wavepacket_dx;
+   if(n>simulation->wavepacket_size-1)
+      return 0;
+
+   int m = (int)n;
+   if(m == simulation->wavepacket_size-1)
+      return simulation->wavepacket_norm[m];
+   return (m+1-n)*simulation->wavepacket_norm[m] + (n-m)*simulation->wavepacket_norm[m+1];
+}
+
+
+//this function computes chi(x1, x2, 0) for the given init_cond and identical_photons, which kernels
+//instantiated for one of them pass as constants so that the switch is folded (see solver.c)
 //update: arguments x1 & x2 now refer to the "unit-less" coordinates, so "true x1" = x1 * Delta and so on
-inline double complex two_photon_input(double x1, double x2, grid * simulation)
+inline double complex two_photon_input_mode(int init_cond, int identical_photons, double x1, double x2, grid * simulation)
 {
    double complex chi = 0;
-   switch(simulation->init_cond)
+   switch(init_cond)
    {
       //two-photon plane waves
       case 1: { chi = cexp( I * simulation->k * (x1+x2) * simulation->Delta); } break;
 
       //two-photon exponentail wavepacket (init_cond=3)
       case 3: {
-         if(simulation->identical_photons)
+         if(identical_photons)
             chi = one_photon_exponential(x1, simulation->k, simulation->alpha, simulation) \
                   * one_photon_exponential(x2, simulation->k, simulation->alpha, simulation);
          else
@@ -121,22 +161,32 @@ inline double complex two_photon_input(double x1, double x2, grid * simulation)
          }
       } break;
 
+      //two identical photons in the tabulated wavepacket (init_cond=5)
+      case 5: { chi = tabulated_wavepacket(x1, simulation) * tabulated_wavepacket(x2, simulation); } break;
+
       //TODO: add other different inputs here
       
-      default: { exit(EXIT_FAILURE); }
+      default: { chi = NAN; }
    }
 
    return chi;
 }
 
 
+//this function computes chi(x1, x2, 0)
+inline double complex two_photon_input(double x1, double x2, grid * simulation)
+{
+   return two_photon_input_mode(simulation->init_cond, simulation->identical_photons, x1, x2, simulation);
+}
+
+
 //this function calculates \int dx |\psi(x,t)|^2
 inline double psi_square_integral(int j, grid * simulation)
 {
    if(j<0)
    {
       fprintf(stderr, "%s: argument j is negative (j=%i). Abort!\n", __func__, j);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
 
    double sum = 0;
@@ -172,9 +222,23 @@ inline double psi_square_integral(int j, grid * simulation)
 	    }
 	 }
 	 break;
+      case 4: {// the same as init_cond=2 with exp(-alpha*Gamma*t) replaced by the norm of the tabulated wavepacket in x<-a-t
+            if(j==0) return tabulated_norm(0, simulation);
+
+            Lambda += tabulated_norm(j, simulation);
+            Lambda *= pow(cabs(simulation->e1[j]), 2.0);
+	 }
+	 break;
+      case 5: {// the same as init_cond=3 with two identical photons
+            if(j==0) return 0.0;
+
+            Lambda += tabulated_norm(j, simulation);
+            Lambda *= 2.0 * pow(cabs(simulation->e0[j]), 2.0);
+	 }
+	 break;
       default: { //bad input
             fprintf(stderr, "%s: invalid option. Abort!\n", __func__);
-            exit(EXIT_FAILURE);
+            return NAN;
          } 
    }
 
@@ -190,4 +254,13 @@ inline double psi_square_integral(int j, grid * simulation)
 }
 
 
+// this function returns the carrier exp(i*k0*(x-2t)) that is factored out of psi[j][i]
+// in envelope mode; the two excitations make psi oscillate as exp(-2i*k0*t) in time, so
+// the envelope varies on the scale of 1/Gamma and 1/|k-k0| only. j and i may be half
+// integers (e.g. the center of a square)
+inline double complex carrier(double j, double i, grid * simulation)
+{
+   return cexp( I * simulation->k0 * ((i-simulation->origin_index) - 2.*j) * simulation->Delta );
+}
+
 #endif
@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "fdtd.h"
+#include "solver.h"
+#include "dynamics.h"
+#include "NM_measure.h"
+#include "profiler.h"
+#include "stats.h"
+#include "pipeline.h"
+#include "g2.h"
+
+
+void fdtd_default_parameters(fdtd_parameters * parameters)
+{
+   //the same defaults as initialize_grid; nx, Delta, w0, gamma and Nx, Ny (or the output window) must be set by the caller
+   *parameters = (fdtd_parameters){0};
+   parameters->identical_photons = 1;
+}
+
+
+int fdtd_create_from_file(const char * filename, grid ** simulation)
+{
+   return initialize_grid(filename, simulation);
+}
+
+
+//the grid keeps its own copy of parameters, so the caller still owns (and frees) it
+int fdtd_create_from_kv(kvarray_t * parameters, grid ** simulation)
+{
+   *simulation = NULL;
+
+   kvarray_t * copy = copyKVs(parameters);
+   if(!copy)
+      return FDTD_ERROR_MEMORY;
+
+   return initialize_grid_from_kv(copy, "libfdtd", simulation);
+}
+
+
+int fdtd_create(const fdtd_parameters * parameters, grid ** simulation)
+{
+   *simulation = NULL;
+
+   kvarray_t * kv = createKVs();
+   if(!kv)
+      return FDTD_ERROR_MEMORY;
+
+   //print doubles with enough digits to be read back exactly
+   char value[32];
+   int status = 0;
+#define ADD_INT(key)    do { snprintf(value, sizeof(value), "%d", parameters->key); status |= addKV(kv, #key, value); } while(0)
+#define ADD_DOUBLE(key) do { snprintf(value, sizeof(value), "%.17g", parameters->key); status |= addKV(kv, #key, value); } while(0)
+   ADD_INT(nx); ADD_INT(Nx); ADD_INT(Ny);
+   ADD_DOUBLE(Delta); ADD_DOUBLE(w0); ADD_DOUBLE(gamma);
+   ADD_INT(init_cond); ADD_INT(identical_photons);
+   ADD_DOUBLE(k); ADD_DOUBLE(alpha);
+   ADD_DOUBLE(k1); ADD_DOUBLE(alpha1); ADD_DOUBLE(k2); ADD_DOUBLE(alpha2);
+   if(parameters->wavepacket_file)
+      status |= addKV(kv, "wavepacket_file", parameters->wavepacket_file);
+   ADD_DOUBLE(wavepacket_dx);
+   ADD_INT(Tstep);
+   ADD_INT(save_chi); ADD_INT(save_psi); ADD_INT(save_psi_square_integral); ADD_INT(save_psi_binary); ADD_INT(save_g2); ADD_INT(measure_NM);
+   ADD_INT(envelope);
+   if(parameters->k0 != 0)
+      ADD_DOUBLE(k0);
+   if(parameters->scheme != 0)
+      ADD_INT(scheme);
+   ADD_INT(richardson); ADD_DOUBLE(richardson_tol);
+   ADD_INT(green);
+   ADD_DOUBLE(steady_state_tol);
+   ADD_DOUBLE(t_max); ADD_DOUBLE(tau_max); ADD_DOUBLE(x_max); ADD_INT(strict_grid);
+   if(parameters->cache_dir)
+      status |= addKV(kv, "cache_dir", parameters->cache_dir);
+#undef ADD_INT
+#undef ADD_DOUBLE
+   if(status)
+   {
+      freeKVs(kv);
+      return FDTD_ERROR_MEMORY;
+   }
+
+   return initialize_grid_from_kv(kv, "libfdtd", simulation);
+}
+
+
+//the parameters of the incident wavepacket, which may take a different value in
+//each lane, e.g. lane_k=3.0,3.1,3.2,3.3 (a single value is used by all lanes)
+static const char * lane_parameters[] = {"k", "alpha", "k1", "alpha1", "k2", "alpha2", "wavepacket_file"};
+
+
+//the n-th item of a comma-separated list (the first one if the list is shorter)
+static void list_item(const char * list, int n, char * item, size_t size)
+{
+   const char * p = list;
+   for(int m=0; m<n && strchr(p, ','); m++)
+      p = strchr(p, ',')+1;
+   size_t length = strcspn(p, ",");
+   if(length >= size)
+      length = size-1;
+   memcpy(item, p, length);
+   item[length] = '\0';
+}
+
+
+//one grid per lane; without lane_* parameters this is fdtd_create_from_file with *nlanes=1
+int fdtd_create_lanes_from_file(const char * filename, grid ** lanes, int * nlanes)
+{
+   *nlanes = 0;
+
+   kvarray_t * parameters = readKVs(filename);
+   if(!parameters)
+   {
+      fprintf(stderr, "%s: cannot read the input file %s. Abort!\n", __func__, filename);
+      return FDTD_ERROR_FILE;
+   }
+
+   //all lists must have the same length, or a single value
+   int n = 1;
+   char key[32];
+   for(size_t m=0; m<sizeof(lane_parameters)/sizeof(*lane_parameters); m++)
+   {
+      snprintf(key, sizeof(key), "lane_%s", lane_parameters[m]);
+      const char * list = givenValue(parameters, key);
+      if(!list)
+         continue;
+      int length = 1;
+      for(const char * p=list; (p=strchr(p, ',')); p++)
+         length++;
+      if(length > 1 && n > 1 && length != n)
+      {
+         fprintf(stderr, "%s: all lane_* lists must have the same length. Abort!\n", __func__);
+         freeKVs(parameters);
+         return FDTD_ERROR_INPUT;
+      }
+      if(length > n)
+         n = length;
+   }
+   if(n > FDTD_MAX_LANES)
+   {
+      fprintf(stderr, "%s: at most %d lanes are supported. Abort!\n", __func__, FDTD_MAX_LANES);
+      freeKVs(parameters);
+      return FDTD_ERROR_INPUT;
+   }
+   if(n > 1 && givenValue(parameters, "richardson") && atoi(givenValue(parameters, "richardson")))
+   {
+      fprintf(stderr, "%s: richardson cannot be combined with lanes. Abort!\n", __func__);
+      freeKVs(parameters);
+      return FDTD_ERROR_INPUT;
+   }
+   if(n > 1 && givenValue(parameters, "green") && atoi(givenValue(parameters, "green")))
+   {
+      fprintf(stderr, "%s: green cannot be combined with lanes. Abort!\n", __func__);
+      freeKVs(parameters);
+      return FDTD_ERROR_INPUT;
+   }
+
+   int status = FDTD_SUCCESS;
+   for(int l=0; l<n && !status; l++)
+   {
+      kvarray_t * lane = copyKVs(parameters);
+      if(!lane)
+      {
+         status = FDTD_ERROR_MEMORY;
+         break;
+      }
+
+      char value[256];
+      for(size_t m=0; m<sizeof(lane_parameters)/sizeof(*lane_parameters); m++)
+      {
+         snprintf(key, sizeof(key), "lane_%s", lane_parameters[m]);
+         const char * list = givenValue(parameters, key);
+         if(list)
+         {
+            list_item(list, l, value, sizeof(value));
+            status |= addKV(lane, lane_parameters[m], value);
+         }
+      }
+      //only the first lane profiles
+      if(l > 0)
+         status |= addKV(lane, "profile", "0");
+      if(status)
+      {
+         freeKVs(lane);
+         status = FDTD_ERROR_MEMORY;
+         break;
+      }
+
+      //each lane publishes its own stats, under the name of its outputs (see main.c)
+      char name[4096];
+      if(n > 1)
+         snprintf(name, sizeof(name), "%s.lane%d", filename, l);
+      else
+         snprintf(name, sizeof(name), "%s", filename);
+      status = initialize_grid_from_kv(lane, name, &lanes[l]);
+      if(!status)
+         (*nlanes)++;
+   }
+   freeKVs(parameters);
+
+   if(status)
+   {
+      for(int l=0; l<*nlanes; l++)
+         free_grid(lanes[l]);
+      *nlanes = 0;
+   }
+   return status;
+}
+
+
+//march at most nrows further rows; returns FDTD_SUCCESS also when the grid is
+//complete or an observer stopped the march (check fdtd_rows_done), in which
+//case the next call resumes from the following row
+int fdtd_step(grid * simulation, int nrows)
+{
+   if(!simulation || nrows < 0)
+      return FDTD_ERROR_STATE;
+
+   if(simulation->rows_done == 1 && nrows > 0)
+      stats_set_phase(simulation->stats, STATS_PHASE_MARCH, simulation->Ny);
+
+   simulation->stopped = 0;
+   int end = (nrows < simulation->Ny - simulation->rows_done ? simulation->rows_done + nrows : simulation->Ny);
+   for(int j=simulation->rows_done; j<end && !simulation->stopped; )
+   {
+      //the tiled march computes several rows per call; the observers still see them one by one
+      int rows = (march_batch(simulation) < end-j ? march_batch(simulation) : end-j);
+      int status = pipeline_wait(simulation, j+rows); //pipeline>0: the strip of these rows (see pipeline.h)
+      if(!status)
+         status = march_rows(simulation, j, rows);
+      if(status)
+         return status;
+      for(int r=j; r<j+rows && !simulation->stopped; r++)
+      {
+         simulation->rows_done = r+1;
+         stats_update(simulation->stats, r);
+
+         for(int n=0; n<simulation->n_observers; n++)
+            if(simulation->observers[n](simulation, r, simulation->observer_data[n]))
+               simulation->stopped = 1;
+      }
+      j += rows;
+   }
+
+   //in envelope mode the rows hold the envelope until the last row is computed
+   if(simulation->rows_done == simulation->Ny)
+   {
+      int status = finish_pipeline(simulation);
+      if(status)
+         return status;
+      restore_carrier(simulation);
+   }
+
+   return FDTD_SUCCESS;
+}
+
+
+//the same for the lanes of fdtd_create_lanes_from_file, which are marched
+//through the nrows rows one after another; with stats=1 each lane publishes its
+//own progress, so --watch shows the lanes still to come
+int fdtd_step_lanes(grid ** lanes, int nlanes, int nrows)
+{
+   if(!lanes || nlanes < 1)
+      return FDTD_ERROR_STATE;
+
+   for(int l=0; l<nlanes; l++)
+   {
+      int status = fdtd_step(lanes[l], nrows);
+      if(status)
+         return status;
+   }
+   return FDTD_SUCCESS;
+}
+
+
+int fdtd_rows_done(const grid * simulation)
+{
+   return simulation->rows_done;
+}
+
+
+int fdtd_rows_total(const grid * simulation)
+{
+   return simulation->Ny;
+}
+
+
+int fdtd_register_observer(grid * simulation, fdtd_observer observer, void * data)
+{
+   if(simulation->n_observers >= FDTD_MAX_OBSERVERS)
+   {
+      fprintf(stderr, "%s: at most %d observers can be registered. Abort!\n", __func__, FDTD_MAX_OBSERVERS);
+      return FDTD_ERROR_STATE;
+   }
+
+   simulation->observers[simulation->n_observers] = observer;
+   simulation->observer_data[simulation->n_observers] = data;
+   simulation->n_observers++;
+   return FDTD_SUCCESS;
+}
+
+
+//write all outputs requested in the parameters to filename.*
+int fdtd_save(grid * simulation, const char * filename)
+{
+   //pipeline>0: the qubit tables may still be in preparation if the march was stopped
+   int status = finish_pipeline(simulation);
+   if(status)
+      return status;
+
+   stats_set_phase(simulation->stats, STATS_PHASE_OUTPUT, 0);
+//   print_initial_condition(simulation);
+//   print_boundary_condition(simulation);
+//   printf("******************************************\n");
+//   print_psi(simulation);
+//   print_grid(simulation);
+   if(simulation->save_psi)
+   {
+      if(!status) status = save_psi(simulation, filename, creal);
+      if(!status) status = save_psi(simulation, filename, cimag);
+      //save_psi(simulation, filename, cabs);
+   }
+   if(simulation->save_psi_square_integral && !status) //for testing init_cond=3
+      status = save_psi_square_integral(simulation, filename);
+   if(simulation->save_psi_binary && !status)
+      status = save_psi_binary(simulation, filename);
+   if(simulation->save_chi && !status)
+      status = save_chi(simulation, filename, cabs);
+   if(simulation->save_g2 && !status) //completes the file of stream_g2, if any
+      status = save_g2(simulation, filename);
+   if(simulation->measure_NM && !status)
+   {
+      printf("FDTD: calculating lambda and mu for NM measures...\n"); fflush(stdout);
+      status = calculate_NM_measure(simulation, filename);
+      if(!status) status = save_e0(simulation, filename, creal);
+      if(!status) status = save_e0(simulation, filename, cimag);
+      if(!status) status = save_e1(simulation, filename, creal);
+      if(!status) status = save_e1(simulation, filename, cimag);
+   }
+
+   return status;
+}
+
+
+void fdtd_destroy(grid * simulation)
+{
+   free_grid(simulation);
+}
+
+
+const char * fdtd_strerror(int status)
+{
+   switch(status)
+   {
+      case FDTD_SUCCESS:       return "success";
+      case FDTD_ERROR_INPUT:   return "invalid input parameters";
+      case FDTD_ERROR_MEMORY:  return "out of memory";
+      case FDTD_ERROR_FILE:    return "file cannot be read or written";
+      case FDTD_ERROR_NUMERIC: return "NaN is produced";
+      case FDTD_ERROR_STATE:   return "invalid request for the current state";
+      default:                 return "unknown error";
+   }
+}
+
+
+void fdtd_get_layout(const grid * simulation, fdtd_layout * layout)
+{
+   layout->nx            = simulation->nx;
+   layout->Nx            = simulation->Nx;
+   layout->Ny            = simulation->Ny;
+   layout->Ntotal        = simulation->Ntotal;
+   layout->minus_a_index = simulation->minus_a_index;
+   layout->origin_index  = simulation->origin_index;
+   layout->plus_a_index  = simulation->plus_a_index;
+   layout->chi_length    = simulation->Nx - simulation->nx/2 + 1;
+   layout->Delta         = simulation->Delta;
+}
+
+
+//row j of psi (Ntotal points), or NULL if j is out of range; rows >= fdtd_rows_done are not computed yet
+double complex * fdtd_psi_row(grid * simulation, int j)
+{
+   if(j < 0 || j >= simulation->psi_y_size)
+      return NULL;
+   return simulation->psi[j];
+}
+
+
+//e0 (photon=0), or e0 for photon 1 or 2 when the two photons differ; Ny points, NULL if not used
+double complex * fdtd_e0(grid * simulation, int photon)
+{
+   if(finish_pipeline(simulation))
+      return NULL;
+   switch(photon)
+   {
+      case 0:  return simulation->e0;
+      case 1:  return simulation->e0_1;
+      case 2:  return simulation->e0_2;
+      default: return NULL;
+   }
+}
+
+
+//e1 (Ny points), NULL if not used
+double complex * fdtd_e1(grid * simulation)
+{
+   if(finish_pipeline(simulation))
+      return NULL;
+   return simulation->e1;
+}
+
+
+//fill chi (layout.chi_length points) with the row t=j*Delta of the two-photon wavefunction
+int fdtd_chi_row(grid * simulation, int j, double complex * chi)
+{
+   if(j < 0 || j > simulation->rows_done)
+   {
+      fprintf(stderr, "%s: chi at j=%i needs %i rows of psi, but only %i are computed. Abort!\n",
+              __func__, j, j, simulation->rows_done);
+      return FDTD_ERROR_STATE;
+   }
+
+   compute_chi(j, simulation, chi);
+   return FDTD_SUCCESS;
+}
+
+
+//the norm used by save_psi_square_integral at t=j*Delta (NaN if row j is not computed yet)
+double fdtd_psi_square_integral(grid * simulation, int j)
+{
+   if(j >= simulation->rows_done || j > simulation->Nx - simulation->nx/2)
+      return NAN;
+   return psi_square_integral(j, simulation);
+}
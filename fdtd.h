@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __FDTD_H__
+#define __FDTD_H__
+
+#include "grid.h"
+#include "kv.h"
+
+/*
+   The public interface of libfdtd (libfdtd.a / libfdtd.so).
+
+   A simulation is a grid created from an input file, from a key-value array
+   or from an fdtd_parameters struct; the parameters have the same names and
+   meanings as in the input file (see README.md). The march is advanced with
+   fdtd_step, which may be called repeatedly to compute the rows of psi in
+   chunks, and observers registered with fdtd_register_observer are called
+   after each row. The rows of psi, the qubit tables e0/e1 and the on-the-fly
+   observables (chi and the norm) can be read in memory between steps. All
+   functions return an enum fdtd_status code and never terminate the program;
+   nothing is shared between grids, so any number of simulations can live in
+   one process.
+
+   Typical use:
+
+      grid * simulation;
+      if(fdtd_create_from_file("input", &simulation) == FDTD_SUCCESS)
+      {
+         fdtd_step(simulation, fdtd_rows_total(simulation));
+         fdtd_save(simulation, "input");
+         fdtd_destroy(simulation);
+      }
+*/
+
+//the parameters of the input file as a plain struct (see fdtd_default_parameters)
+struct _fdtd_parameters
+{
+   int nx, Nx, Ny; //Nx or Ny may be 0 if the output window fixes them
+   double Delta, w0, gamma;
+   int init_cond, identical_photons;
+   double k, alpha, k1, alpha1, k2, alpha2;
+   const char * wavepacket_file; //only used if init_cond=4 or 5; NULL means not given
+   double wavepacket_dx;
+   int Tstep;
+   int save_chi, save_psi, save_psi_square_integral, save_psi_binary, save_g2, measure_NM;
+   int envelope;
+   double k0; //only used if envelope=1; 0 means w0
+   int scheme; //2 (box scheme) or 4; 0 means 2
+   int richardson; //see richardson.h; only used by richardson_extrapolate
+   double richardson_tol;
+   int green; //see green.h; only used by green_solve
+   double steady_state_tol; //only used if init_cond=1; 0 means off
+   double t_max, tau_max, x_max; //the output window; 0 means not given
+   int strict_grid;
+   const char * cache_dir; //see cache.h; NULL means no cache
+};
+typedef struct _fdtd_parameters fdtd_parameters;
+
+//the dimensions of the grid and the positions of -a, 0 and a in a row of psi
+struct _fdtd_layout
+{
+   int nx, Nx, Ny, Ntotal;
+   int minus_a_index, origin_index, plus_a_index;
+   int chi_length; //number of points in a row of chi (tau = 0, Delta, ..., (Nx-nx/2)*Delta)
+   double Delta;
+};
+typedef struct _fdtd_layout fdtd_layout;
+
+void fdtd_default_parameters(fdtd_parameters * parameters);
+int fdtd_create_from_file(const char * filename, grid ** simulation);
+int fdtd_create_from_kv(kvarray_t * parameters, grid ** simulation);
+int fdtd_create(const fdtd_parameters * parameters, grid ** simulation);
+int fdtd_step(grid * simulation, int nrows);
+
+//sweeps: lanes that differ only in the incident wavepacket (lane_k=...,
+//lane_alpha=..., etc. in the input file) are created from one input file and
+//marched one after another
+#define FDTD_MAX_LANES 8
+int fdtd_create_lanes_from_file(const char * filename, grid ** lanes, int * nlanes);
+int fdtd_step_lanes(grid ** lanes, int nlanes, int nrows);
+
+int fdtd_rows_done(const grid * simulation);
+int fdtd_rows_total(const grid * simulation);
+int fdtd_register_observer(grid * simulation, fdtd_observer observer, void * data);
+int fdtd_save(grid * simulation, const char * filename);
+
+//zero-copy access to the state for in-memory analysis (e.g. utilities/fdtd.py);
+//the pointers are owned by the grid and valid until fdtd_destroy; in envelope
+//mode the rows of psi hold the envelope until the last row is computed; with
+//pipeline>0, fdtd_e0 and fdtd_e1 first wait for the set-up to complete
+void fdtd_get_layout(const grid * simulation, fdtd_layout * layout);
+double complex * fdtd_psi_row(grid * simulation, int j);
+double complex * fdtd_e0(grid * simulation, int photon);
+double complex * fdtd_e1(grid * simulation);
+int fdtd_chi_row(grid * simulation, int j, double complex * chi);
+double fdtd_psi_square_integral(grid * simulation, int j);
+void fdtd_destroy(grid * simulation);
+const char * fdtd_strerror(int status);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <string.h>
+#include "g2.h"
+#include "fdtd.h"
+#include "dynamics.h"
+
+static const char g2_magic[8] = "FDTDG2";
+
+struct _g2
+{
+   FILE * f;
+   char * name;
+   int next;               //the next row of psi whose g2 is written
+   int status;             //of the writes from the observer
+   double complex * chi;
+   float * row;
+   struct g2_header header;
+};
+
+
+//g2 of the rows next, next+Tstep+1, ... up to last (chi of row j needs the rows of psi below j)
+static int write_rows(grid * simulation, struct _g2 * g2, int last)
+{
+   int nx = simulation->nx;
+   for(; g2->next <= last && !g2->status; g2->next += simulation->Tstep+1)
+   {
+      int j = g2->next;
+      compute_chi(j, simulation, g2->chi);
+      for(int i=0; i<g2->header.ntau; i++)
+      {
+         //the same points as the input term of chi
+         double complex in = two_photon_input(nx/2+1-j, nx/2+1+i-j, simulation);
+         double norm = creal(in)*creal(in) + cimag(in)*cimag(in);
+         double chi2 = creal(g2->chi[i])*creal(g2->chi[i]) + cimag(g2->chi[i])*cimag(g2->chi[i]);
+         g2->row[i] = (norm > 0 ? chi2/norm : NAN);
+      }
+      if(fwrite(g2->row, sizeof(*g2->row), g2->header.ntau, g2->f) != (size_t)g2->header.ntau)
+      {
+         fprintf(stderr, "%s: cannot write to %s. Abort!\n", __func__, g2->name);
+         g2->status = FDTD_ERROR_FILE;
+      }
+      g2->header.nrows++;
+   }
+   return g2->status;
+}
+
+
+//the observer stays registered after save_g2, which closes the file, so it looks the file up
+static int g2_observer(grid * simulation, int j, void * data)
+{
+   if(simulation->g2)
+      write_rows(simulation, simulation->g2, j+1);
+   return 0; //a failed write is reported by save_g2, the march goes on
+}
+
+
+static int open_g2(grid * simulation, const char * filename)
+{
+   struct _g2 * g2 = calloc(1, sizeof(*g2));
+   if(!g2)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+   simulation->g2 = g2;
+
+   memcpy(g2->header.magic, g2_magic, sizeof(g2->header.magic));
+   g2->header.nx = simulation->nx;
+   g2->header.Nx = simulation->Nx;
+   g2->header.Ny = simulation->Ny;
+   g2->header.Tstep = simulation->Tstep;
+   g2->header.init_cond = simulation->init_cond;
+   g2->header.ntau = simulation->Nx-simulation->nx/2+1;
+   g2->header.nrows = -1;
+   g2->header.Delta = simulation->Delta;
+   g2->header.w0 = simulation->w0;
+   g2->header.Gamma = simulation->Gamma;
+
+   g2->name = malloc(strlen(filename)+8);
+   g2->chi = malloc(g2->header.ntau*sizeof(*g2->chi));
+   g2->row = malloc(g2->header.ntau*sizeof(*g2->row));
+   if(!g2->name || !g2->chi || !g2->row)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+   sprintf(g2->name, "%s.g2.bin", filename);
+
+   g2->f = fopen(g2->name, "wb");
+   if(!g2->f)
+   {
+      fprintf(stderr, "%s: cannot create %s. Abort!\n", __func__, g2->name);
+      return FDTD_ERROR_FILE;
+   }
+   if(fwrite(&g2->header, sizeof(g2->header), 1, g2->f) != 1)
+   {
+      fprintf(stderr, "%s: cannot write to %s. Abort!\n", __func__, g2->name);
+      return FDTD_ERROR_FILE;
+   }
+   g2->header.nrows = 0;
+   return FDTD_SUCCESS;
+}
+
+
+int stream_g2(grid * simulation, const char * filename)
+{
+   int status = open_g2(simulation, filename);
+   if(!status)
+      status = write_rows(simulation, simulation->g2, fdtd_rows_done(simulation));
+   if(!status)
+      status = fdtd_register_observer(simulation, g2_observer, NULL);
+   return status;
+}
+
+
+int save_g2(grid * simulation, const char * filename)
+{
+   int status = (simulation->g2 ? FDTD_SUCCESS : open_g2(simulation, filename));
+   struct _g2 * g2 = simulation->g2;
+   if(!status)
+      status = write_rows(simulation, g2, fdtd_rows_done(simulation));
+
+   //the header is complete once the rows are
+   if(!status)
+   {
+      g2->header.steady_state_row = simulation->steady_state_row;
+      if(fseek(g2->f, 0, SEEK_SET) || fwrite(&g2->header, sizeof(g2->header), 1, g2->f) != 1 || fseek(g2->f, 0, SEEK_END))
+      {
+         fprintf(stderr, "%s: cannot write to %s. Abort!\n", __func__, g2->name);
+         status = FDTD_ERROR_FILE;
+      }
+   }
+   if(!status)
+   {
+      close_output_file(g2->f, simulation);
+      g2->f = NULL;
+   }
+   free_g2(simulation);
+   return status;
+}
+
+
+void free_g2(grid * simulation)
+{
+   struct _g2 * g2 = simulation->g2;
+   if(!g2)
+      return;
+
+   if(g2->f)
+      fclose(g2->f);
+   free(g2->name);
+   free(g2->chi);
+   free(g2->row);
+   free(g2);
+   simulation->g2 = NULL;
+}
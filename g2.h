@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __G2_H__
+#define __G2_H__
+
+#include "grid.h"
+
+/*
+   Second-order correlation of the outgoing photons (save_g2=1, for the
+   two-photon inputs init_cond=1, 3 and 5).
+
+   Two detectors at x1=a+Delta and x2=a+Delta+tau see the two-photon
+   wavefunction chi(x1, x2, t) of save_chi (see compute_chi), which is
+   normalized by the input state of two_photon_input (dynamics.h) propagated
+   freely to the same points:
+
+      g2(tau, t) = |chi(x1, x2, t)|^2 / |chi_in(x1-t, x2-t)|^2.
+
+   For the plane wave |chi_in|=1, so this is the |chi|^2 of the figures in the
+   documentation, without exporting chi; for a wavepacket it is NaN where the
+   input has not arrived (or has decayed below the range of a double).
+
+   g2 is written to input_filename.g2.bin, as a g2_header followed by one row
+   of ntau=Nx-nx/2+1 floats (tau = 0, Delta, ...) per row t = 0, Tstep+1,
+   2(Tstep+1), ... up to Ny, as save_chi, in the byte order of the machine;
+   with numpy, for instance,
+
+      numpy.fromfile(name, numpy.float32, offset=64).reshape(-1, ntau).
+
+   The rows are appended as the march completes them: stream_g2 registers
+   an observer that forms the row of t=j*Delta as soon as the rows of psi
+   below it are done, so the file can be read while the run goes on. nrows
+   and steady_state_row are filled in when save_g2 closes the file (nrows
+   is -1 until then); save_g2 also writes the rows at once if they were not
+   streamed, e.g. with richardson, which replaces psi after the march.
+*/
+
+struct g2_header
+{
+   char magic[8];         //"FDTDG2"
+   int nx, Nx, Ny, Tstep;
+   int init_cond;
+   int ntau;              //floats per row
+   int nrows;             //rows written; -1 while the file is open
+   int steady_state_row;  //the rows of psi from here on are extrapolated (0: none, see solver.c)
+   double Delta, w0, Gamma;
+};
+
+//open filename.g2.bin, write the rows already possible, and append the others as they are marched
+int stream_g2(grid * simulation, const char * filename);
+
+//write the remaining rows (all of them if not streamed) and close the file
+int save_g2(grid * simulation, const char * filename);
+
+//close the file of stream_g2 without completing it (free_grid)
+void free_g2(grid * simulation);
+
+#endif
@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "green.h"
+#include "solver.h"
+#include "stats.h"
+
+
+//the stored columns and the sizes of the responses
+struct green_header
+{
+   char magic[8];
+   int nx, Nx, Ny;
+   int K; //number of stored columns (4 per tau)
+   int N; //FFT length of the strip responses
+   double Delta, w0, Gamma;
+};
+
+static const char green_magic[8] = "FDTDGRN";
+
+
+//parse green_tau (default: 0) into the stored columns; returns the number of taus or -1
+static int parse_tau(grid * simulation, int ** tau, int ** column)
+{
+   const char * list = givenValue(simulation->parameters_key_value_pair, "green_tau");
+   if(!list)
+      list = "0";
+
+   int T = 1;
+   for(const char * c=list; *c; c++)
+      if(*c == ',')
+         T++;
+
+   *tau = malloc(T*sizeof(**tau));
+   *column = malloc(4*T*sizeof(**column));
+   if(!*tau || !*column)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return -1;
+   }
+
+   const char * c = list;
+   for(int t=0; t<T; t++)
+   {
+      char * end;
+      long value = strtol(c, &end, 10);
+      if(end == c || (*end != ',' && *end != '\0') || value < 0 || value > simulation->Nx-simulation->nx/2)
+      {
+         fprintf(stderr, "%s: green_tau has to be a list of integers between 0 and Nx-nx/2. Abort!\n", __func__);
+         return -1;
+      }
+      (*tau)[t] = value;
+      (*column)[4*t]   = simulation->minus_a_index-value;
+      (*column)[4*t+1] = simulation->plus_a_index-value;
+      (*column)[4*t+2] = simulation->minus_a_index+value;
+      (*column)[4*t+3] = simulation->plus_a_index+value;
+      c = end+1;
+   }
+   return T;
+}
+
+
+//in-place radix-2 FFT of length n (a power of 2); sign=-1 forward, +1 inverse (unnormalized)
+static void fft(double complex * a, int n, int sign)
+{
+   for(int i=1, j=0; i<n; i++)
+   {
+      int bit = n >> 1;
+      for(; j & bit; bit >>= 1)
+         j ^= bit;
+      j ^= bit;
+      if(i < j)
+      {
+         double complex temp = a[i];
+         a[i] = a[j];
+         a[j] = temp;
+      }
+   }
+
+   for(int length=2; length<=n; length<<=1)
+   {
+      double complex w_length = cexp(sign*2.*M_PI*I/length);
+      for(int i=0; i<n; i+=length)
+      {
+         //restart the twiddle factor in each block to avoid accumulating rounding errors
+         double complex w = 1;
+         for(int k=0; k<length/2; k++)
+         {
+            if(k%64 == 0)
+               w = cexp(sign*2.*M_PI*I*k/length);
+            double complex u = a[i+k], v = a[i+k+length/2]*w;
+            a[i+k] = u+v;
+            a[i+k+length/2] = u-v;
+            w *= w_length;
+         }
+      }
+   }
+}
+
+
+//march the grid with a unit value at (j0, i) and nothing else, and store rows 1..Ny-1 of the K columns in response
+static int unit_response(grid * simulation, int j0, int i, int K, const int * column, double complex * response)
+{
+   for(int j=0; j<simulation->Ny; j++)
+      memset(simulation->psi[j], 0, simulation->psi_x_size*sizeof(*simulation->psi[j]));
+   simulation->psi[j0][i] = 1;
+
+   int status = march_rows(simulation, 1, simulation->Ny-1);
+   if(status)
+      return status;
+   for(int j=1; j<simulation->Ny; j++)
+      for(int k=0; k<K; k++)
+         response[k*(simulation->Ny-1)+j-1] = simulation->psi[j][column[k]];
+   return FDTD_SUCCESS;
+}
+
+
+//compute Q and the Fourier transforms of the strip responses R (see green.h); psi is used as workspace
+static int compute_responses(grid * simulation, const struct green_header * h, const int * column,
+                             double complex * Q, double complex * R)
+{
+   int Ny = simulation->Ny;
+   int total = simulation->minus_a_index+1 + simulation->nx+1;
+   double complex * response = malloc((size_t)h->K*(Ny-1)*sizeof(*response));
+   if(!response)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+
+   stats_set_phase(simulation->stats, STATS_PHASE_MARCH, total);
+   int status = FDTD_SUCCESS, progress = 0;
+   for(int n=0; n<total && !status; n++)
+   {
+      if(n <= simulation->minus_a_index)
+         status = unit_response(simulation, 0, n, h->K, column, Q+(size_t)n*h->K*(Ny-1));
+      else
+      {
+         //response holds r(m) = R(m+1) for m=0..Ny-2, so that the strip enters as (r * b)(j-1) with b(n) = psi(n+1, i0)
+         int i0 = n-simulation->minus_a_index-1;
+         status = unit_response(simulation, 1, i0, h->K, column, response);
+         for(int k=0; k<h->K && !status; k++)
+         {
+            double complex * r = R+((size_t)i0*h->K+k)*h->N;
+            memset(r, 0, h->N*sizeof(*r));
+            memcpy(r, response+(size_t)k*(Ny-1), (Ny-1)*sizeof(*r));
+            fft(r, h->N, -1);
+         }
+      }
+      stats_update(simulation->stats, n);
+
+      if(total >= 10 && n%(total/10)==0)
+      {
+         printf("%s: %i%% prepared...\r", __func__, progress*10); fflush(stdout);
+         progress++;
+      }
+   }
+
+   //wash out the status report
+   printf("                                                                           \r"); fflush(stdout);
+
+   free(response);
+   return status;
+}
+
+
+//read the responses from filename if it was written for the same header and columns; returns 1 if so
+static int load_responses(const char * filename, const struct green_header * h, const int * column,
+                          double complex * Q, size_t Q_size, double complex * R, size_t R_size)
+{
+   FILE * f = fopen(filename, "rb");
+   if(!f)
+      return 0;
+
+   struct green_header stored;
+   int match = (fread(&stored, sizeof(stored), 1, f) == 1 && memcmp(&stored, h, sizeof(stored)) == 0);
+   for(int k=0; k<h->K && match; k++)
+   {
+      int c;
+      match = (fread(&c, sizeof(c), 1, f) == 1 && c == column[k]);
+   }
+   match = match && fread(Q, sizeof(*Q), Q_size, f) == Q_size && fread(R, sizeof(*R), R_size, f) == R_size;
+
+   fclose(f);
+   return match;
+}
+
+
+static int save_responses(const char * filename, const struct green_header * h, const int * column,
+                          const double complex * Q, size_t Q_size, const double complex * R, size_t R_size)
+{
+   FILE * f = fopen(filename, "wb");
+   if(!f)
+   {
+      fprintf(stderr, "%s: cannot create %s. Abort!\n", __func__, filename);
+      return FDTD_ERROR_FILE;
+   }
+
+   int ok = (fwrite(h, sizeof(*h), 1, f) == 1 && fwrite(column, sizeof(*column), h->K, f) == (size_t)h->K
+             && fwrite(Q, sizeof(*Q), Q_size, f) == Q_size && fwrite(R, sizeof(*R), R_size, f) == R_size);
+   if(fclose(f) || !ok)
+   {
+      fprintf(stderr, "%s: cannot write %s. Abort!\n", __func__, filename);
+      return FDTD_ERROR_FILE;
+   }
+   return FDTD_SUCCESS;
+}
+
+
+//psi on the stored columns, rows 0..Ny-1, from the initial row and the strip (see green.h)
+static int evaluate(grid * simulation, const struct green_header * h, const int * column,
+                    const double complex * row0, const double complex * strip, const double complex * window0,
+                    const double complex * Q, const double complex * R, double complex * window)
+{
+   int Ny = simulation->Ny, K = h->K, N = h->N;
+   double complex * B = malloc((size_t)(simulation->nx+1)*N*sizeof(*B));
+   double complex * sum = malloc(N*sizeof(*sum));
+   if(!B || !sum)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      free(B);
+      free(sum);
+      return FDTD_ERROR_MEMORY;
+   }
+
+   //the initial row
+   for(int k=0; k<K; k++)
+   {
+      window[(size_t)k*Ny] = window0[k];
+      memset(window+(size_t)k*Ny+1, 0, (Ny-1)*sizeof(*window));
+   }
+   for(int i1=0; i1<=simulation->minus_a_index; i1++)
+   {
+      if(row0[i1] == 0)
+         continue;
+      for(int k=0; k<K; k++)
+      {
+         const double complex * q = Q+((size_t)i1*K+k)*(Ny-1);
+         double complex * w = window+(size_t)k*Ny+1;
+         for(int j=0; j<Ny-1; j++)
+            w[j] += q[j]*row0[i1];
+      }
+   }
+
+   //the strip
+   for(int i0=0; i0<=simulation->nx; i0++)
+   {
+      double complex * b = B+(size_t)i0*N;
+      memset(b, 0, N*sizeof(*b));
+      memcpy(b, strip+(size_t)i0*(Ny-1), (Ny-1)*sizeof(*b));
+      fft(b, N, -1);
+   }
+   for(int k=0; k<K; k++)
+   {
+      memset(sum, 0, N*sizeof(*sum));
+      for(int i0=0; i0<=simulation->nx; i0++)
+      {
+         const double complex * r = R+((size_t)i0*K+k)*N;
+         const double complex * b = B+(size_t)i0*N;
+         for(int f=0; f<N; f++)
+            sum[f] += r[f]*b[f];
+      }
+      fft(sum, N, 1);
+      for(int j=1; j<Ny; j++)
+         window[(size_t)k*Ny+j] += sum[j-1]/N;
+
+      //the points the march keeps at zero (see march_row)
+      for(int j=0; j<Ny; j++)
+         if( ((j < simulation->nx) && (column[k]==j+simulation->minus_a_index+1))
+             || (column[k]==j+simulation->plus_a_index+1) )
+            window[(size_t)k*Ny+j] = 0;
+   }
+
+   free(B);
+   free(sum);
+   return FDTD_SUCCESS;
+}
+
+
+//write |chi| for each tau as in save_chi, with psi taken from the stored columns
+static int save_green_chi(grid * simulation, const char * filename, int T, const int * tau, const double complex * window)
+{
+   char * str = malloc(strlen(filename)+25);
+   if(!str)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+   sprintf(str, "%s.green.abs_chi.out", filename);
+
+   FILE * f = fopen(str, "w");
+   if(!f)
+   {
+      fprintf(stderr, "%s: cannot create %s. Abort!\n", __func__, str);
+      free(str);
+      return FDTD_ERROR_FILE;
+   }
+
+   int Ny = simulation->Ny, nx = simulation->nx;
+   for(int j=0; j<=Ny; j+=(simulation->Tstep+1))
+   {
+      for(int t=0; t<T; t++)
+      {
+         //the four terms of compute_chi
+         const double complex * w = window+(size_t)4*t*Ny;
+         double complex temp = 0;
+         if( j>=(nx+tau[t]+1) )
+            temp += w[j-(nx+tau[t]+1)];
+         if( j>=(tau[t]+1) )
+            temp -= w[Ny+j-(tau[t]+1)];
+         if( j>=(nx+1) )
+            temp += w[2*Ny+j-(nx+1)];
+         if( j>=1 )
+            temp -= w[3*Ny+j-1];
+         fprintf( f, "%.5g ", cabs(-sqrt(simulation->Gamma)/2.0 * temp) );
+      }
+      fprintf( f, "\n");
+   }
+
+   close_output_file(f, simulation);
+   free(str);
+   return FDTD_SUCCESS;
+}
+
+
+int green_solve(grid * simulation, const char * filename)
+{
+   if(simulation->rows_done != 1)
+   {
+      fprintf(stderr, "%s: the grid has already been marched. Abort!\n", __func__);
+      return FDTD_ERROR_STATE;
+   }
+
+   int * tau = NULL, * column = NULL;
+   int T = parse_tau(simulation, &tau, &column);
+   if(T < 0)
+   {
+      free(tau);
+      free(column);
+      return FDTD_ERROR_INPUT;
+   }
+
+   int Ny = simulation->Ny, nx = simulation->nx, minus_a = simulation->minus_a_index;
+   struct green_header h;
+   memset(&h, 0, sizeof(h)); //the header is compared byte by byte, padding included
+   memcpy(h.magic, green_magic, sizeof(h.magic));
+   h.nx = nx; h.Nx = simulation->Nx; h.Ny = Ny;
+   h.K = 4*T;
+   for(h.N=1; h.N<2*(Ny-1); h.N<<=1);
+   h.Delta = simulation->Delta; h.w0 = simulation->w0; h.Gamma = simulation->Gamma;
+
+   size_t Q_size = (size_t)(minus_a+1)*h.K*(Ny-1), R_size = (size_t)(nx+1)*h.K*h.N;
+   double complex * Q = malloc(Q_size*sizeof(*Q));
+   double complex * R = malloc(R_size*sizeof(*R));
+   double complex * row0 = malloc((minus_a+1)*sizeof(*row0));
+   double complex * strip = malloc((size_t)(nx+1)*(Ny-1)*sizeof(*strip));
+   double complex * window0 = malloc(h.K*sizeof(*window0));
+   double complex * window = malloc((size_t)h.K*Ny*sizeof(*window));
+   char * cache = NULL;
+   int status = FDTD_SUCCESS;
+   if(!Q || !R || !row0 || !strip || !window0 || !window)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      status = FDTD_ERROR_MEMORY;
+      goto cleanup;
+   }
+
+   //the data, copied before psi is used as workspace; the wavepacket must not have reached x=-a
+   for(int i=0; i<simulation->Ntotal; i++)
+   {
+      if(i > minus_a && simulation->psi[0][i] != 0)
+      {
+         fprintf(stderr, "%s: the initial condition has to vanish for x>-a. Abort!\n", __func__);
+         status = FDTD_ERROR_INPUT;
+         goto cleanup;
+      }
+      if(i <= minus_a)
+         row0[i] = simulation->psi[0][i];
+   }
+   for(int i0=0; i0<=nx; i0++)
+      for(int j=1; j<Ny; j++)
+         strip[(size_t)i0*(Ny-1)+j-1] = simulation->psi[j][i0];
+   for(int k=0; k<h.K; k++)
+      window0[k] = simulation->psi[0][column[k]];
+
+   const char * name = givenValue(simulation->parameters_key_value_pair, "green_file");
+   cache = malloc((name ? strlen(name) : strlen(filename)+10) + 1);
+   if(!cache)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      status = FDTD_ERROR_MEMORY;
+      goto cleanup;
+   }
+   if(name)
+      strcpy(cache, name);
+   else
+      sprintf(cache, "%s.green.bin", filename);
+
+   if(load_responses(cache, &h, column, Q, Q_size, R, R_size))
+      printf("FDTD: impulse responses read from %s\n", cache);
+   else
+   {
+      printf("FDTD: computing the impulse responses (%d marches)...\n", minus_a+nx+2);
+      status = compute_responses(simulation, &h, column, Q, R);
+      if(!status)
+         status = save_responses(cache, &h, column, Q, Q_size, R, R_size);
+   }
+
+   if(!status)
+      status = evaluate(simulation, &h, column, row0, strip, window0, Q, R, window);
+   if(!status)
+   {
+      stats_set_phase(simulation->stats, STATS_PHASE_OUTPUT, 0);
+      status = save_green_chi(simulation, filename, T, tau, window);
+   }
+
+cleanup:
+   free(Q);
+   free(R);
+   free(row0);
+   free(strip);
+   free(window0);
+   free(window);
+   free(cache);
+   free(tau);
+   free(column);
+   return status;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __GREEN_H__
+#define __GREEN_H__
+
+#include "grid.h"
+
+/*
+   Green's-function mode (set green=1 in the input file).
+
+   The box scheme is linear, so for a single photon (init_cond=2 or 4) every
+   row of psi is a linear function of the data it is given: the initial row
+   psi(x,0), which vanishes for x>-a, and the boundary strip x<=-L (columns
+   0..nx) on the rows j>=1. chi(a+Delta, a+Delta+tau, t) only needs psi on four
+   columns per tau (x = -a-tau, a-tau, -a+tau, a+tau), so only the responses on
+   these columns are stored:
+
+      Q[i1](j, c): response to a unit value at (0, i1), i1 = 0..minus_a_index;
+      R[i0](j, c): response to a unit value at (1, i0), i0 = 0..nx.
+
+   Q is needed for every i1 because the delay term switches on at t=2a and
+   the light cones are halved on the nodes where they start, so the march is
+   not invariant under shifts in x. It is invariant under shifts in t for
+   data entering through the strip on the rows j>=1, so there a single
+   response per column suffices and the strip enters through a convolution
+   in t, which is done with FFTs:
+
+      psi(j, c) = sum_i1 Q[i1](j, c) psi(0, i1)
+                + sum_i0 sum_{j0>=1} R[i0](j-j0+1, c) psi(j0, i0).
+
+   The responses are computed once by marching the grid of the simulation
+   with unit data (minus_a_index+nx+2 marches) and stored in green_file
+   (default: input_filename.green.bin), which is reused as long as nx, Nx, Ny,
+   Delta, w0, gamma and green_tau are unchanged; a sweep over wavepackets thus
+   costs one dot product and nx+1 FFTs per stored column instead of a march.
+   green_tau is a comma-separated list of tau/Delta (default: 0), and
+   |chi| is written for each of them to input_filename.green.abs_chi.out, one
+   line per row t = 0, Tstep+1, 2(Tstep+1), ... as in save_chi. When the
+   responses are computed, psi is used as workspace and no longer holds the
+   initial and boundary conditions, so the grid cannot be marched afterwards.
+*/
+
+int green_solve(grid * simulation, const char * filename);
+
+#endif
@@ -15,6 +15,13 @@
 #include "dynamics.h"
 #include <string.h>
 #include "NM_measure.h"
+#include "profiler.h"
+#include "stats.h"
+#include "cache.h"
+#include "stencil.h"
+#include "numa.h"
+#include "pipeline.h"
+#include "g2.h"
 
 
 //This function returns the normalization constant A for the two-photon initial state used for init_cond=3
@@ -35,10 +42,10 @@ void calculate_normalization_const(grid * simulation)
 }
 
 
-// This function returns the solution psi[j][i] in x<-a subject to two-photon plane wave
-double complex plane_wave_BC(int j, int i, grid * simulation)
+// This function returns the qubit factor e(t) of the solution in x<-a subject to two-photon plane
+// wave (see plane_wave_BC), which is the same for all x and is therefore computed once per row
+double complex plane_wave_e(int j, grid * simulation)
 {
-    double x = (i-simulation->origin_index)*simulation->Delta; //check!!!
     double t = j*simulation->Delta;
     double td = simulation->nx*simulation->Delta;
     double w0 = simulation->w0;
@@ -52,7 +59,7 @@ double complex plane_wave_BC(int j, int i, grid * simulation)
 
     for(int n=1; n<=(j/simulation->nx); n++)
     {
-        double complex temp = ( cexp( n*log(t-n*td) - W*(t-n*td) - lgamma(n+1) ) \
+        double complex temp = ( cexp( n*log(t-n*td) - W*(t-n*td) - log_gamma(n+1) ) \
                        - (I*K+w0) * incomplete_gamma_e(n+1, -I*p*(t-n*td), n*clog(I) - (n+1)*clog(p) - K*(t-n*td) ) );
 
         temp *= cpow(0.5*Gamma, n-0.5);
@@ -66,6 +73,19 @@ double complex plane_wave_BC(int j, int i, grid * simulation)
 	   sum += temp;
     }
     e_t -= sum;    
+    return e_t;
+}
+
+
+// This function returns the solution psi[j][i] in x<-a subject to two-photon plane wave, given
+// e_t = plane_wave_e(j, simulation)
+double complex plane_wave_BC_from_e(double complex e_t, int j, int i, grid * simulation)
+{
+    double x = (i-simulation->origin_index)*simulation->Delta; //check!!!
+    double t = j*simulation->Delta;
+    double td = simulation->nx*simulation->Delta;
+    double complex K = I*simulation->k;
+
     e_t *= sqrt(2.)*cexp(K*(x-t)); // psi(x,t) = sqrt(2)e^{ik(x-t)}*e(t)
     e_t *= cexp(-0.5*K*td);        //TODO: this phase factor can be eliminated by absorbing into the wavepacket
 
@@ -74,11 +94,18 @@ double complex plane_wave_BC(int j, int i, grid * simulation)
     else
     {
        fprintf(stderr, "%s: NaN is produced (at j=%i and i=%i). Abort!\n", __func__, j, i);
-       exit(EXIT_FAILURE);
+       return NAN;
     }
 }
 
 
+// This function returns the solution psi[j][i] in x<-a subject to two-photon plane wave
+double complex plane_wave_BC(int j, int i, grid * simulation)
+{
+    return plane_wave_BC_from_e(plane_wave_e(j, simulation), j, i, simulation);
+}
+
+
 // This function returns the solution psi[j][i] in x<-a subject to single-photon exponential wavepacket 
 double complex exponential_BC(int j, int i, grid * simulation)
 {
@@ -96,48 +123,174 @@ double complex two_exponential_BC(int j, int i, grid * simulation)
 	     * one_photon_exponential(i-simulation->origin_index-j, simulation->k, simulation->alpha, simulation);
    else	 
    {
-      static double complex varphi_1, varphi_2; //TODO: make sure both are static
-      varphi_1 = one_photon_exponential(i-simulation->origin_index-j, simulation->k1, simulation->alpha1, simulation);
-      varphi_2 = one_photon_exponential(i-simulation->origin_index-j, simulation->k2, simulation->alpha2, simulation);
+      double complex varphi_1 = one_photon_exponential(i-simulation->origin_index-j, simulation->k1, simulation->alpha1, simulation);
+      double complex varphi_2 = one_photon_exponential(i-simulation->origin_index-j, simulation->k2, simulation->alpha2, simulation);
       return (simulation->e0_1[j] * varphi_2 + simulation->e0_2[j] * varphi_1) * simulation->A / sqrt(2.); 
    }
 }
 
 
+// This function returns the solution psi[j][i] in x<-a subject to the tabulated wavepacket (init_cond=4 and 5)
+double complex tabulated_BC(int j, int i, grid * simulation)
+{
+   // psi(x,t) = psi(x-t, 0) * e1(t) for a single photon (as in exponential_BC),
+   //          = varphi(x-t) * e0(t) for two identical photons (as in two_exponential_BC)
+   double complex e_t = (simulation->init_cond == 4 ? simulation->e1[j] : simulation->e0[j]);
+   return e_t * tabulated_wavepacket(i-simulation->origin_index-j, simulation);
+}
+
+
+//read the tabulated wavepacket of init_cond=4 and 5 from wavepacket_file: the binary file holds
+//the complex samples phi(-a-n*wavepacket_dx), n=0,1,..., as written by e.g. numpy.complex128.tofile()
+int read_wavepacket(grid * simulation)
+{
+    const char * filename = lookupValue(simulation->parameters_key_value_pair, "wavepacket_file");
+    FILE * f = fopen(filename, "rb");
+    if(!f)
+    {
+        fprintf(stderr, "%s: cannot open %s. Abort!\n", __func__, filename);
+        return FDTD_ERROR_FILE;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long bytes = ftell(f);
+    rewind(f);
+    if(bytes <= 0 || bytes % sizeof(*simulation->wavepacket))
+    {
+        fprintf(stderr, "%s: %s does not contain complex samples. Abort!\n", __func__, filename);
+        fclose(f);
+        return FDTD_ERROR_INPUT;
+    }
+    simulation->wavepacket_size = bytes/sizeof(*simulation->wavepacket);
+
+    simulation->wavepacket = malloc(simulation->wavepacket_size*sizeof(*simulation->wavepacket));
+    simulation->wavepacket_norm = malloc(simulation->wavepacket_size*sizeof(*simulation->wavepacket_norm));
+    if(!simulation->wavepacket || !simulation->wavepacket_norm)
+    { 
+        fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+        fclose(f);
+        return FDTD_ERROR_MEMORY;
+    }
+    size_t read = fread(simulation->wavepacket, sizeof(*simulation->wavepacket), simulation->wavepacket_size, f);
+    fclose(f);
+    if(read != (size_t)simulation->wavepacket_size)
+    {
+        fprintf(stderr, "%s: cannot read %s. Abort!\n", __func__, filename);
+        return FDTD_ERROR_FILE;
+    }
+
+    //the norm beyond each sample by the trapezoidal rule, from the tail of the wavepacket
+    double dx = simulation->wavepacket_dx * simulation->Delta;
+    int n = simulation->wavepacket_size-1;
+    simulation->wavepacket_norm[n] = 0.5 * dx * pow(cabs(simulation->wavepacket[n]), 2.0);
+    for(n--; n>=0; n--)
+        simulation->wavepacket_norm[n] = simulation->wavepacket_norm[n+1] \
+             + 0.5 * dx * (pow(cabs(simulation->wavepacket[n]), 2.0) + pow(cabs(simulation->wavepacket[n+1]), 2.0));
+
+    return FDTD_SUCCESS;
+}
+
+
 //TODO: this should be generalized to acommadate different I.C.
-void prepare_qubit_wavefunction(grid * simulation)
+int prepare_qubit_wavefunction(grid * simulation)
 {
-    //do this only if the exponential wavepacket is used
-    if(simulation->init_cond == 2 || simulation->init_cond == 3)
+    int status = FDTD_SUCCESS;
+
+    //the tabulated wavepacket drives the qubit, so it is read first
+    if(simulation->init_cond == 4 || simulation->init_cond == 5)
+        status = read_wavepacket(simulation);
+
+    //do this only if a wavepacket is used (e0 is not needed for a tabulated single photon)
+    if(!status && simulation->init_cond >= 2)
     {
-        initialize_e0(simulation);
-        initialize_e1(simulation);
+        if(simulation->init_cond != 4)
+           status = initialize_e0(simulation);
+        if(!status)
+           status = initialize_e1(simulation);
     }
+
+    return status;
 }
 
 
-void initialize_e0(grid * simulation)
+//e0 for the tabulated wavepacket (init_cond=5), obtained in O(Ny) by integrating the delay ODE
+//   de/dt = -W e(t) + Gamma/2 e(t-2a)theta(t-2a) + sqrt(Gamma/2)[phi(-a-t) - phi(a-t)theta(t-2a)],  e(0)=0,
+//of which e0() is the exact solution for the exponential wavepacket. The decay exp(-W*Delta) is
+//integrated exactly and the rest with the trapezoidal rule; as phi has a sharp wavefront at x=-a,
+//phi(a-t)theta(t-2a) jumps at t=2a and enters each step with its one-sided limit
+static int integrate_e0(grid * simulation)
 {
+    simulation->e0 = calloc(simulation->Ny, sizeof(*simulation->e0));
+    if(!simulation->e0)
+    { 
+        fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+        return FDTD_ERROR_MEMORY;
+    }
+
+    double complex W = I*simulation->w0 + 0.5*simulation->Gamma;
+    double complex decay = cexp(-W*simulation->Delta);
+    double coupling = sqrt(0.5*simulation->Gamma);
+    int nx = simulation->nx;
+
+    //the right-hand side without -W e(t) at the start (S_start) and the end (S_end) of the step to t=j*Delta
+    double complex S_start = coupling * tabulated_wavepacket(-nx/2, simulation);
+    for(int j=1; j<simulation->Ny; j++)
+    {
+        double complex S_end = coupling * tabulated_wavepacket(-nx/2-j, simulation);
+        if(j > nx)
+        {
+           S_end -= coupling * tabulated_wavepacket(nx/2-j, simulation);
+           S_end += 0.5 * simulation->Gamma * simulation->e0[j-nx];
+        }
+
+        simulation->e0[j] = decay * simulation->e0[j-1] + 0.5 * simulation->Delta * (decay * S_start + S_end);
+        if(isnan(cabs(simulation->e0[j])))
+        {
+           fprintf(stderr, "%s: NaN is produced (at j=%i). Abort!\n", __func__, j);
+           return FDTD_ERROR_NUMERIC;
+        }
+        stats_update(simulation->stats, j);
+
+        //the same at the start of the next step, where theta(t-2a) is already 1 for j=nx
+        S_start = S_end;
+        if(j == nx)
+           S_start -= coupling * tabulated_wavepacket(nx/2-j, simulation);
+    }
+
+    return FDTD_SUCCESS;
+}
+
+
+int initialize_e0(grid * simulation)
+{
+    if(simulation->init_cond == 5) //no closed form for a tabulated wavepacket
+        return integrate_e0(simulation);
+
     if(simulation->identical_photons) //one wavepacket or two identical exponential wavepackets
     {
         simulation->e0 = calloc(simulation->Ny, sizeof(*simulation->e0));
         if(!simulation->e0)
         { 
             fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
-            exit(EXIT_FAILURE);
+            return FDTD_ERROR_MEMORY;
         }
 
         int progress = 0;
-        for(int j=0; j<simulation->Ny; j++)
+        int cached = cache_load_table(simulation, "e0", simulation->k, simulation->alpha, simulation->e0);
+        for(int j=cached; j<simulation->Ny; j++)
         {
-            simulation->e0[j] = e0(j, simulation);
+            simulation->e0[j] = (simulation->coarser && j%2 == 0 ? simulation->coarser->e0[j/2] : e0(j, simulation));
+            if(isnan(cabs(simulation->e0[j])))
+               return FDTD_ERROR_NUMERIC;
+            stats_update(simulation->stats, j);
 
-            if(j%(simulation->Ny/10)==0)
+            if(simulation->Ny >= 10 && j%(simulation->Ny/10)==0)
             {
                 printf("%s: %i%% prepared...\r", __func__, progress*10); fflush(stdout);
                 progress++;
             }
         }
+        cache_store_table(simulation, "e0", simulation->k, simulation->alpha, simulation->e0, cached);
     }
     else //two different exponential wavepackets
     {
@@ -146,63 +299,82 @@ void initialize_e0(grid * simulation)
         if(!simulation->e0_1 || !simulation->e0_2)
         { 
             fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
-            exit(EXIT_FAILURE);
+            return FDTD_ERROR_MEMORY;
         }
 
+        int status = FDTD_SUCCESS;
         int progress = 0;
-        for(int j=0; j<simulation->Ny; j++)
+        int cached_1 = cache_load_table(simulation, "e0", simulation->k1, simulation->alpha1, simulation->e0_1);
+        int cached_2 = cache_load_table(simulation, "e0", simulation->k2, simulation->alpha2, simulation->e0_2);
+        for(int j=(cached_1 < cached_2 ? cached_1 : cached_2); j<simulation->Ny && !status; j++)
         {
-	    simulation->k = simulation->k1; simulation->alpha = simulation->alpha1;
-            simulation->e0_1[j] = e0(j, simulation);
-	    simulation->k = simulation->k2; simulation->alpha = simulation->alpha2;
-            simulation->e0_2[j] = e0(j, simulation);
-
-            if(j%(simulation->Ny/10)==0)
+            simulation->e0_1[j] = (simulation->coarser && j%2 == 0 ? simulation->coarser->e0_1[j/2] \
+                                   : e0_photon(j, simulation->k1, simulation->alpha1, simulation));
+            simulation->e0_2[j] = (simulation->coarser && j%2 == 0 ? simulation->coarser->e0_2[j/2] \
+                                   : e0_photon(j, simulation->k2, simulation->alpha2, simulation));
+            if(isnan(cabs(simulation->e0_1[j])) || isnan(cabs(simulation->e0_2[j])))
+               status = FDTD_ERROR_NUMERIC;
+            stats_update(simulation->stats, j);
+
+            if(simulation->Ny >= 10 && j%(simulation->Ny/10)==0)
             {
                 printf("%s: %i%% prepared...\r", __func__, progress*10); fflush(stdout);
                 progress++;
             }
         }
+        if(status)
+           return status;
+        cache_store_table(simulation, "e0", simulation->k1, simulation->alpha1, simulation->e0_1, cached_1);
+        cache_store_table(simulation, "e0", simulation->k2, simulation->alpha2, simulation->e0_2, cached_2);
     }
     //TODO: add other I.C. here
 
     //wash out the status report
     //printf("                                                                           \r"); fflush(stdout);
+    return FDTD_SUCCESS;
 }
 
 
 //e1 is the solution of spontaneous emission and is independent of incident wavepackets
-void initialize_e1(grid * simulation)
+int initialize_e1(grid * simulation)
 {
     simulation->e1 = calloc(simulation->Ny, sizeof(*simulation->e1));
     if(!simulation->e1)
     { 
         fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
-        exit(EXIT_FAILURE);
+        return FDTD_ERROR_MEMORY;
     }
 
+    stats_set_phase(simulation->stats, STATS_PHASE_QUBIT, simulation->Ny);
     int progress = 0;
-    for(int j=0; j<simulation->Ny; j++)
+    int cached = cache_load_table(simulation, "e1", 0, 0, simulation->e1);
+    for(int j=cached; j<simulation->Ny; j++)
     {
-        simulation->e1[j] = e1(j, simulation);
+        simulation->e1[j] = (simulation->coarser && j%2 == 0 ? simulation->coarser->e1[j/2] : e1(j, simulation));
+        if(isnan(cabs(simulation->e1[j])))
+           return FDTD_ERROR_NUMERIC;
+        stats_update(simulation->stats, j);
 
-        if(j%(simulation->Ny/10)==0)
+        if(simulation->Ny >= 10 && j%(simulation->Ny/10)==0)
         {
             printf("%s: %i%% prepared...\r", __func__, progress*10); fflush(stdout);
             progress++;
         }
     }
+    cache_store_table(simulation, "e1", 0, 0, simulation->e1, cached);
+
+    return FDTD_SUCCESS;
 }
 
 
-void initial_condition(grid * simulation)
+int initial_condition(grid * simulation)
 {// the initial condition is given in-between x/Delta = [-Nx, Nx] for simplicity
 
     simulation->psit0 = calloc(2*simulation->Nx+1, sizeof(*simulation->psit0));
     if(!simulation->psit0)
     { 
         perror("initial_condition: cannot allocate memory. Abort!\n");
-        exit(EXIT_FAILURE);
+        return FDTD_ERROR_MEMORY;
     }
     simulation->psit0_size = 2*simulation->Nx+1;
 
@@ -212,11 +384,18 @@ void initial_condition(grid * simulation)
        for(int i=0; i<simulation->psit0_size; i++)
            simulation->psit0[i] = one_photon_exponential(i-simulation->Nx, simulation->k, simulation->alpha, simulation);
     }
+    else if(simulation->init_cond == 4) //single-photon tabulated wavepacket
+    {
+       for(int i=0; i<simulation->psit0_size; i++)
+           simulation->psit0[i] = tabulated_wavepacket(i-simulation->Nx, simulation);
+    }
     //TODO: add other I.C. here
+
+    return FDTD_SUCCESS;
 }
 
 
-void boundary_condition(grid * simulation)
+int boundary_condition(grid * simulation)
 {// the boundary conditions is given for first nx+1 columns with 
  // x/Delta=[-(Nx+nx+1),-(Nx+1)] due to the delay term
 
@@ -224,7 +403,7 @@ void boundary_condition(grid * simulation)
     if(!simulation->psix0)
     { 
         perror("boundary_condition: cannot allocate memory. Abort!\n");
-        exit(EXIT_FAILURE);
+        return FDTD_ERROR_MEMORY;
     }
     simulation->psix0_x_size = simulation->nx+1;
     simulation->psix0_y_size = 0;
@@ -236,18 +415,39 @@ void boundary_condition(grid * simulation)
         if(!simulation->psix0[j])
         { 
             fprintf(stderr, "%s: cannot allocate memory at t=%d*Delta. Abort!\n", __func__, j);
-            exit(EXIT_FAILURE);
+            return FDTD_ERROR_MEMORY;
         }
         simulation->psix0_y_size++;
     }
 
-    for(int j=0; j<simulation->psix0_y_size; j++)
+    //the plane wave enters through its qubit factor, which is kept in the cache (see cache.h)
+    double complex * plane_wave = NULL;
+    int cached = 0;
+    if(simulation->init_cond == 1)
+    {
+        plane_wave = malloc(simulation->Ny*sizeof(*plane_wave));
+        if(!plane_wave)
+        { 
+            fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+            return FDTD_ERROR_MEMORY;
+        }
+        cached = cache_load_table(simulation, "pw", simulation->k, 0, plane_wave);
+    }
+
+    int status = FDTD_SUCCESS;
+    for(int j=0; j<simulation->psix0_y_size && !status; j++)
     {
         switch(simulation->init_cond)
 	{
 	   case 1: { //two-photon plane wave
-                 for(int i=0; i<simulation->psix0_x_size; i++)
-                     simulation->psix0[j][i] = plane_wave_BC(j, i, simulation);
+                 if(j >= cached)
+                     plane_wave[j] = plane_wave_e(j, simulation);
+                 for(int i=0; i<simulation->psix0_x_size && !status; i++)
+                 {
+                     simulation->psix0[j][i] = plane_wave_BC_from_e(plane_wave[j], j, i, simulation);
+                     if(isnan(cabs(simulation->psix0[j][i])))
+                        status = FDTD_ERROR_NUMERIC;
+                 }
 	      }
 	      break;
 	   case 2: { //single-photon exponential wavepacket
@@ -260,87 +460,301 @@ void boundary_condition(grid * simulation)
                      simulation->psix0[j][i] = two_exponential_BC(j, i, simulation);
 	      }
 	      break;
+	   case 4: //single-photon tabulated wavepacket
+	   case 5: { //two-photon tabulated wavepacket
+                 for(int i=0; i<simulation->psix0_x_size; i++)
+                     simulation->psix0[j][i] = tabulated_BC(j, i, simulation);
+	      }
+	      break;
 	   default: { //bad input
               fprintf(stderr, "%s: invalid option. Abort!\n", __func__);
-              exit(EXIT_FAILURE);
+              status = FDTD_ERROR_INPUT;
 	      } 
         }
+        stats_update(simulation->stats, j);
 
-        if(j%(simulation->Ny/10)==0)
+        if(simulation->Ny >= 10 && j%(simulation->Ny/10)==0)
         {
             printf("%s: %i%% prepared...\r", __func__, progress*10); fflush(stdout);
             progress++;
         }
     }
+    if(plane_wave && !status)
+        cache_store_table(simulation, "pw", simulation->k, 0, plane_wave, cached);
+    free(plane_wave);
 
     //wash out the status report
     printf("                                                                           \r"); fflush(stdout);
+
+    return status;
 }
 
 
-void initialize_psi(grid * simulation)
+int initialize_psi(grid * simulation)
 {
-    simulation->psi = malloc( simulation->Ny*sizeof(*simulation->psi) );
-    if(!simulation->psi)
-    { 
-        perror("initialize_psi: cannot allocate memory. Abort!\n");
-        exit(EXIT_FAILURE);
+    // numa=1: the rows are mapped up front, and each stripe is first written by its own thread (see numa.h)
+    if(simulation->numa)
+    {
+        int status = create_numa(simulation);
+        if(!status)
+            status = numa_allocate_psi(simulation);
+        if(status)
+            return status;
+    }
+    else
+    {
+        simulation->psi = malloc( simulation->Ny*sizeof(*simulation->psi) );
+        if(!simulation->psi)
+        { 
+            perror("initialize_psi: cannot allocate memory. Abort!\n");
+            return FDTD_ERROR_MEMORY;
+        }
     }
     simulation->psi_x_size = simulation->Ntotal;
     simulation->psi_y_size = 0;
     for(int j=0; j<simulation->Ny; j++)
     {
-        simulation->psi[j] = calloc( simulation->Ntotal, sizeof(*simulation->psi[j]) );
+        if(!simulation->placement)
+            simulation->psi[j] = calloc( simulation->Ntotal, sizeof(*simulation->psi[j]) );
         if(!simulation->psi[j])
         { 
             fprintf(stderr, "%s: cannot allocate memory at t=%d*Delta. Abort!\n", __func__, j);
-            exit(EXIT_FAILURE);
+            return FDTD_ERROR_MEMORY;
         }
         simulation->psi_y_size++;
+        stats_update(simulation->stats, j);
 
-        // take boundary conditions
+        // take boundary conditions (pipeline>0: they are written while the march runs, see pipeline.h)
+        if(!simulation->psix0)
+           continue;
         for(int i=0; i<simulation->psix0_x_size; i++)
            simulation->psi[j][i] = simulation->psix0[j][i];
+
+        // in envelope mode the carrier is factored out
+        if(simulation->envelope)
+        {
+           for(int i=0; i<simulation->psix0_x_size; i++)
+              simulation->psi[j][i] /= carrier(j, i, simulation);
+        }
     }
  
     // take the initial condition
     for(int i=0; i<simulation->psit0_size; i++)
        simulation->psi[0][i+simulation->psix0_x_size] = simulation->psit0[i];
+
+    if(simulation->envelope)
+    {
+       for(int i=simulation->psix0_x_size; i<simulation->Ntotal; i++)
+          simulation->psi[0][i] /= carrier(0, i, simulation);
+    }
+
+    // the march starts at the first column that the data can reach: the box is entered only through
+    // the strip, the initial row and the two-photon source, and in x<-a, where the data start, psi
+    // only depends on nodes not to its right, so it stays zero on the left of all of them (this only
+    // matters for a tabulated wavepacket that is shorter than the box)
+    simulation->window_start = simulation->psix0_x_size;
+    if(simulation->init_cond == 4 || simulation->init_cond == 5)
+    {
+       int strip = 0;
+       for(int j=0; j<simulation->psix0_y_size && !strip; j++)
+          for(int i=0; i<simulation->psix0_x_size; i++)
+             strip |= (simulation->psix0[j][i] != 0);
+
+       if(!strip)
+       {
+          simulation->window_start = simulation->Ntotal;
+          for(int i=simulation->Ntotal-1; i>=simulation->psix0_x_size; i--)
+             if(simulation->psi[0][i] != 0)
+                simulation->window_start = i;
+
+          //chi(x1, x2, 0) vanishes for x1 behind the tail of the table (x1 = x-t is at most one step off a node)
+          if(simulation->init_cond == 5)
+          {
+             int tail = simulation->origin_index + (int)floor(-0.5*simulation->nx - (simulation->wavepacket_size-1)*simulation->wavepacket_dx) - 1;
+             if(tail < simulation->window_start)
+                simulation->window_start = (tail > simulation->psix0_x_size ? tail : simulation->psix0_x_size);
+          }
+       }
+    }
+
+    // the fourth-order scheme takes the nodes on the light cone t=x+a as the average
+    // of the two limits, and psi is zero just ahead of the wavefront at t=0
+    if(simulation->scheme == 4)
+       simulation->psi[0][simulation->minus_a_index] *= 0.5;
+
+    // the tiled march publishes the progress of each row (see solver.c)
+    if(simulation->tile_rows > 1)
+    {
+       simulation->row_progress = malloc(simulation->Ny*sizeof(*simulation->row_progress));
+       if(!simulation->row_progress)
+       {
+          fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+          return FDTD_ERROR_MEMORY;
+       }
+       //the width of a tile: tile_rows*(tile_columns+tile_rows*nx) points in about 1MB
+       if(simulation->tile_columns == 0)
+       {
+          int width = 65536/simulation->tile_rows - simulation->tile_rows*simulation->nx;
+          simulation->tile_columns = (width > 256 ? width : 256);
+       }
+    }
+
+    // the terms of the box scheme are gathered from a plan built once per grid (see stencil.h)
+    if(simulation->scheme == 2)
+    {
+       int status = create_stencil(simulation);
+       if(status)
+          return status;
+    }
+
+    // the box scheme reads the light cones from copies of the diagonals of psi (see solver.c)
+    simulation->cone_diagonal_row = -1;
+    if(simulation->scheme == 2 && simulation->diagonal_copy && !simulation->reference)
+    {
+       for(int n=0; n<4; n++)
+       {
+          simulation->cone_diagonal[n] = malloc(simulation->Ny*sizeof(*simulation->cone_diagonal[n]));
+          if(!simulation->cone_diagonal[n])
+          {
+             fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+             return FDTD_ERROR_MEMORY;
+          }
+       }
+    }
+
+    return FDTD_SUCCESS;
 }
 
 
 //a set of checks (poka-yoke) that make sure the input file is sane
-void sanity_check(grid * simulation)
+int sanity_check(grid * simulation)
 {
+    //the grid must not be empty
+    if(simulation->nx < 2 || simulation->Nx < 1 || simulation->Ny < 2 || !(simulation->Delta > 0))
+    {
+        fprintf(stderr, "%s: nx>=2, Nx>=1, Ny>=2 and Delta>0 are required. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
     //nx must be multiple of 2
     if(simulation->nx % 2) 
     {
         fprintf(stderr, "%s: nx must be an integer multiple of 2. Abort!\n", __func__);
-        exit(EXIT_FAILURE);
+        return FDTD_ERROR_INPUT;
     }   
 
     //nx<=2Nx
     if(simulation->nx > 2*simulation->Nx)
     {
         fprintf(stderr, "%s: nx must be smaller than, or at most equal to, twice of Nx (nx<=2Nx). Abort!\n", __func__);
-        exit(EXIT_FAILURE);
+        return FDTD_ERROR_INPUT;
     } 
 
     //Nyquist limit
-    if(simulation->k >= M_PI/simulation->Delta || simulation->w0 >= M_PI/simulation->Delta)
+    if(!simulation->envelope && (simulation->k >= M_PI/simulation->Delta || simulation->w0 >= M_PI/simulation->Delta))
     {
         fprintf(stderr, "%s: k or w0 must be smaller than pi/Delta in order not to reach the Nyquist limit. Abort!\n", __func__);
-        exit(EXIT_FAILURE);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //the discretization order
+    if(simulation->scheme != 2 && simulation->scheme != 4)
+    {
+        fprintf(stderr, "%s: scheme has to be 2 or 4. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //the fourth-order stencils need 4 points in-between the qubit and its mirror image
+    if(simulation->scheme == 4 && simulation->nx < 4)
+    {
+        fprintf(stderr, "%s: scheme=4 requires nx>=4. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //Richardson mode
+    if(simulation->richardson_tol < 0)
+    {
+        fprintf(stderr, "%s: richardson_tol has to be nonnegative. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //Green's-function mode (see green.h): the impulse responses are those of the box scheme for a single photon
+    if(simulation->green && ((simulation->init_cond != 2 && simulation->init_cond != 4) || simulation->scheme != 2 || simulation->envelope || simulation->richardson))
+    {
+        fprintf(stderr, "%s: green=1 requires init_cond=2 or 4 and scheme=2, and cannot be combined with envelope or richardson. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+    if(simulation->green && (simulation->save_chi || simulation->save_psi || simulation->save_psi_square_integral \
+                             || simulation->save_psi_binary || simulation->measure_NM || simulation->save_g2))
+    {
+        fprintf(stderr, "%s: green=1 does not march psi, so it only writes chi on the green_tau window. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //steady-state detection: only the plane wave drives psi at a single frequency forever
+    if(simulation->steady_state_tol < 0 || (simulation->steady_state_tol > 0 && (simulation->init_cond != 1 || simulation->richardson)))
+    {
+        fprintf(stderr, "%s: steady_state_tol has to be nonnegative, and can only be used with init_cond=1 and without richardson. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //the tiled march (see solver.c) handles the box scheme row by row otherwise, and the threads share its blocks
+    if(simulation->tile_rows < 0 || simulation->tile_rows > FDTD_MAX_TILE_ROWS || simulation->tile_columns < 0 \
+       || simulation->threads < 1 || simulation->threads > FDTD_MAX_THREADS)
+    {
+        fprintf(stderr, "%s: tile_rows has to be in [0, %d], tile_columns nonnegative and threads in [1, %d]. Abort!\n",
+                __func__, FDTD_MAX_TILE_ROWS, FDTD_MAX_THREADS);
+        return FDTD_ERROR_INPUT;
+    }
+    if(simulation->threads > 1 && ((simulation->tile_rows < 2 && !simulation->numa) || simulation->scheme != 2 || simulation->steady_state_tol > 0))
+    {
+        fprintf(stderr, "%s: threads>1 requires tile_rows>=2 or numa=1 and scheme=2, and cannot be combined with steady_state_tol. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //the NUMA stripes (see numa.h) replace the tiles
+    if(simulation->numa && (simulation->scheme != 2 || simulation->tile_rows > 1 || simulation->reference || simulation->steady_state_tol > 0))
+    {
+        fprintf(stderr, "%s: numa=1 requires scheme=2, and cannot be combined with tile_rows, reference or steady_state_tol. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //the pipelined set-up (see pipeline.h) prepares the strip row by row
+    if(simulation->pipeline < 0 || simulation->pipeline > FDTD_MAX_THREADS)
+    {
+        fprintf(stderr, "%s: pipeline has to be in [0, %d]. Abort!\n", __func__, FDTD_MAX_THREADS);
+        return FDTD_ERROR_INPUT;
+    }
+    if(simulation->pipeline && (simulation->init_cond < 1 || simulation->init_cond > 3 || simulation->green))
+    {
+        fprintf(stderr, "%s: pipeline>0 requires init_cond=1, 2 or 3, and cannot be combined with green. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //the reference kernel (see solver.c) is the row-by-row box scheme of the original code
+    if(simulation->reference && (simulation->scheme != 2 || simulation->envelope || simulation->tile_rows > 1))
+    {
+        fprintf(stderr, "%s: reference=1 requires scheme=2, and cannot be combined with envelope or tile_rows. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //in envelope mode only the detunings from the carrier k0 need to be resolved
+    //(k is not used by the tabulated wavepacket, whose spectrum is up to the user)
+    if(simulation->envelope && ((simulation->init_cond < 4 && fabs(simulation->k - simulation->k0) >= M_PI/simulation->Delta)
+                                || fabs(simulation->w0 - simulation->k0) >= M_PI/simulation->Delta))
+    {
+        fprintf(stderr, "%s: |k-k0| and |w0-k0| must be smaller than pi/Delta in order not to reach the Nyquist limit. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
     }
 
     //it is meaningless if one performs the computation without saving any result
     if(!simulation->save_chi && !simulation->save_psi && !simulation->save_psi_square_integral \
-       && !simulation->save_psi_binary && !simulation->measure_NM)
+       && !simulation->save_psi_binary && !simulation->measure_NM && !simulation->green && !simulation->save_g2)
     {
         //fprintf(stderr, "%s: either save_chi or save_psi has to be 1. Abort!\n", __func__);
         fprintf(stderr, "%s: need to specify the output options (available: save_chi, save_psi, save_psi_square_integral,\
-                         save_psi_binary, measure_NM). Abort!\n", __func__);
-        exit(EXIT_FAILURE);
+                         save_psi_binary, save_g2, measure_NM). Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
     }
 
     ////if Ny is too small then no result will be written to file
@@ -355,17 +769,19 @@ void sanity_check(grid * simulation)
     //1 (two-photon plane wave)
     //2 (single-photon exponential wavepacket)
     //3 (two-photon exponential wavepackets)
-    if(simulation->init_cond < 1 || simulation->init_cond > 3)
+    //4 (single-photon tabulated wavepacket)
+    //5 (two-photon tabulated wavepackets)
+    if(simulation->init_cond < 1 || simulation->init_cond > 5)
     {
-        fprintf(stderr, "%s: init_cond has to be 1, 2 or 3. Abort!\n", __func__);
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "%s: init_cond has to be 1, 2, 3, 4 or 5. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
     }
 
     if((simulation->init_cond == 1 || simulation->init_cond == 2) && !lookupValue(simulation->parameters_key_value_pair, "k"))
     {
         //k is a mandatory parameter when init_cond is 1 or 2
         fprintf(stderr, "%s: the incident frequency k must be given when init_cond is 1 or 2. Abort!\n", __func__);
-        exit(EXIT_FAILURE);
+        return FDTD_ERROR_INPUT;
     }
 
     if(simulation->init_cond == 2) 
@@ -374,7 +790,7 @@ void sanity_check(grid * simulation)
         if(!lookupValue(simulation->parameters_key_value_pair, "alpha"))
 	{
            fprintf(stderr, "%s: alpha is not given. Abort!\n", __func__);
-           exit(EXIT_FAILURE);
+           return FDTD_ERROR_INPUT;
 	}
 
 	//always 1 in this case, in case the user prepared it wrong
@@ -389,7 +805,7 @@ void sanity_check(grid * simulation)
        {
           fprintf(stderr, "%s: for two-photon wavapacket calculations, identical_photons needs to be specified (either 0 or 1). Abort!\n", 
 		 __func__);
-          exit(EXIT_FAILURE);
+          return FDTD_ERROR_INPUT;
        }
 
        //two identical photons
@@ -397,7 +813,7 @@ void sanity_check(grid * simulation)
 	     !lookupValue(simulation->parameters_key_value_pair, "alpha")) )
        {
           fprintf(stderr, "%s: for two identical photons, k and alpha need to be specified. Abort!\n", __func__);
-          exit(EXIT_FAILURE);
+          return FDTD_ERROR_INPUT;
        }
 
        //two different photons
@@ -407,27 +823,51 @@ void sanity_check(grid * simulation)
 	     || !lookupValue(simulation->parameters_key_value_pair, "alpha2")) )
        {
           fprintf(stderr, "%s: for two different photons, k1, k2, alpha1 and alpha2 need to be specified. Abort!\n", __func__);
-          exit(EXIT_FAILURE);
+          return FDTD_ERROR_INPUT;
        }
 
     }
 
+    if(simulation->init_cond == 4 || simulation->init_cond == 5)
+    {
+       if(!lookupValue(simulation->parameters_key_value_pair, "wavepacket_file") || simulation->wavepacket_dx <= 0)
+       {
+          fprintf(stderr, "%s: for the tabulated wavepacket, wavepacket_file and wavepacket_dx (>0) need to be specified. Abort!\n", __func__);
+          return FDTD_ERROR_INPUT;
+       }
+
+       //only one wavepacket is tabulated
+       simulation->identical_photons = 1;
+    }
+
     //calculate_NM_measure only supports well-defined (normalized) wavepackets
     //TODO: allow init_cond=3
     if(simulation->measure_NM && (simulation->init_cond!=2))// || simulation->init_cond!=3))
     {
         fprintf(stderr, "%s: to calculate lambda and mu for NM measures, set init_cond to be 2. Abort!\n", __func__);
-        exit(EXIT_FAILURE);
+        return FDTD_ERROR_INPUT;
     }
+
+    //g2 is normalized by the two-photon input, which a single photon does not have
+    if(simulation->save_g2 && simulation->init_cond!=1 && simulation->init_cond!=3 && simulation->init_cond!=5)
+    {
+        fprintf(stderr, "%s: save_g2 requires a two-photon input (init_cond=1, 3 or 5). Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    return FDTD_SUCCESS;
 }
 
 
 void free_initial_boundary_conditions(grid * simulation)
 {//free psit0 and psix0 to save memory
     free(simulation->psit0);
-    for(int j=0; j<simulation->Ny; j++)
-       free(simulation->psix0[j]);
-    free(simulation->psix0);
+    if(simulation->psix0)
+    {
+       for(int j=0; j<simulation->psix0_y_size; j++)
+          free(simulation->psix0[j]);
+       free(simulation->psix0);
+    }
   
     //reset
     simulation->psix0 = NULL;
@@ -438,107 +878,384 @@ void free_initial_boundary_conditions(grid * simulation)
 }
 
 
+//safe to call on a partially initialized grid (all pointers start as NULL)
 void free_grid(grid * simulation)
 {
+    if(!simulation)
+       return;
+
+    //the set-up threads still write into psi and the tables
+    free_pipeline(simulation);
+    free_g2(simulation);
+
     freeKVs(simulation->parameters_key_value_pair);
 
-    //free psit0 and psix0
-    //free_initial_boundary_conditions(simulation);
+    //free psit0 and psix0 (already done unless the initialization failed)
+    free_initial_boundary_conditions(simulation);
 
     //free psi
-    for(int j=0; j<simulation->Ny; j++)
-       free(simulation->psi[j]);
-    free(simulation->psi);
+    if(simulation->psi && simulation->placement)
+       numa_free_psi(simulation);
+    else if(simulation->psi)
+    {
+       for(int j=0; j<simulation->psi_y_size; j++)
+          free(simulation->psi[j]);
+       free(simulation->psi);
+    }
+
+    //free e0 & e1 (NULL if unused)
+    free(simulation->e0);
+    free(simulation->e0_1);
+    free(simulation->e0_2);
+    free(simulation->e1);
+    free(simulation->wavepacket);
+    free(simulation->wavepacket_norm);
+    for(int n=0; n<4; n++)
+       free(simulation->cone_diagonal[n]);
+    free(simulation->row_progress);
+    free_stencil(simulation->stencil);
+    free_numa(simulation->placement);
+
+    free_profiler(simulation->profiler);
+    free_stats(simulation->stats);
+
+    free(simulation);
+}
+
+
+//read the input file and prepare the grid; on success *simulation points to
+//a grid ready for the march, on failure it is NULL and an error code is returned
+int initialize_grid(const char * filename, grid ** simulation)
+{
+   *simulation = NULL;
+
+   //read from input
+   kvarray_t * parameters = readKVs(filename);
+   if(!parameters)
+   {
+      fprintf(stderr, "%s: cannot read the input file %s. Abort!\n", __func__, filename);
+      return FDTD_ERROR_FILE;
+   }
+
+   return initialize_grid_from_kv(parameters, filename, simulation);
+}
 
-    //free e0 & e1 
-    //TODO: take care of this part if the code grows!
-    if(simulation->init_cond == 2 || simulation->init_cond == 3)
+
+//same as initialize_grid but takes the parameters from memory; the grid takes
+//ownership of parameters (they are freed by free_grid, or here on failure);
+//name is only used to label the live progress block
+int initialize_grid_from_kv(kvarray_t * parameters, const char * name, grid ** simulation)
+{
+   return initialize_refined_grid(parameters, name, NULL, simulation);
+}
+
+
+/*
+   The smallest grid for the output window (t_max, tau_max, x_max > 0, in the
+   same units as Delta). psi at (t, x) only depends on the rows below it and,
+   as all characteristics and delayed images point to the right, on the columns
+   to its left, so a window needs no margin beyond the points that are read:
+
+      rows 0..T of psi (save_psi*, T=t_max/Delta):       Ny >= T+1
+      chi up to t_max (save_chi, green; j<=Ny is read): Ny >= T
+      chi up to tau_max (tau index i<=Nx-nx/2):         Nx >= tau_max/Delta+nx/2
+      psi up to x_max (save_psi*):                      Nx >= x_max/Delta
+      psi_square_integral and measure_NM up to t_max
+      (rows j<min(Ny-1, Nx-nx/2)):                      Ny >= T+2, Nx >= T+1+nx/2
+
+   The rows above and the columns on the right are cut exactly. The boundary
+   strip holds the exact solution for any Nx>=nx/2, so moving it (Nx also sets
+   x=-L) only changes psi at the level of the discretization error. Every row
+   keeps the Nx+nx/2+1 rows below it in reach of the light cones (the history
+   depth), all of which stay in memory. Nx or Ny are set to these values when
+   they are not given; larger values only cost time and memory, and are
+   reported (or refused with strict_grid=1), while smaller ones would cut the
+   window.
+*/
+static int size_grid(grid * simulation)
+{
+    if(simulation->t_max < 0 || simulation->tau_max < 0 || simulation->x_max < 0)
+    {
+        fprintf(stderr, "%s: t_max, tau_max and x_max have to be nonnegative. Abort!\n", __func__);
+        return FDTD_ERROR_INPUT;
+    }
+
+    //grid points needed by the window (rounded up, but not for a rounding error of the division)
+    int T   = (int)ceil(simulation->t_max/simulation->Delta - 1e-9);
+    int tau = (int)ceil(simulation->tau_max/simulation->Delta - 1e-9);
+    int X   = (int)ceil(simulation->x_max/simulation->Delta - 1e-9);
+    int psi = (simulation->save_psi || simulation->save_psi_binary);
+    int chi = (simulation->save_chi || simulation->green || simulation->save_g2);
+    int Nx_min = 0, Ny_min = 0;
+    if(simulation->t_max > 0)
     {
-       if(simulation->identical_photons)
-          free(simulation->e0);
-       else
+       if(chi && T > Ny_min) Ny_min = T;
+       if(psi && T+1 > Ny_min) Ny_min = T+1;
+       if(simulation->save_psi_square_integral || simulation->measure_NM)
        {
-          free(simulation->e0_1);
-          free(simulation->e0_2);
+          if(T+2 > Ny_min) Ny_min = T+2;
+          if(T+1+simulation->nx/2 > Nx_min) Nx_min = T+1+simulation->nx/2;
+       }
+    }
+    if(simulation->tau_max > 0 && chi && tau+simulation->nx/2 > Nx_min)
+       Nx_min = tau+simulation->nx/2;
+    if(simulation->x_max > 0 && psi && X > Nx_min)
+       Nx_min = X;
+    if(Nx_min > 0 && Nx_min < simulation->nx/2)
+       Nx_min = simulation->nx/2; //nx<=2Nx
+
+    int * size[2] = {&simulation->Nx, &simulation->Ny};
+    int minimum[2] = {Nx_min, Ny_min};
+    const char * name[2] = {"Nx", "Ny"};
+    for(int n=0; n<2; n++)
+    {
+       if(*size[n] == 0 && minimum[n] == 0)
+       {
+          fprintf(stderr, "%s: %s is not given, and the output window (t_max, tau_max, x_max) does not fix it. Abort!\n", __func__, name[n]);
+          return FDTD_ERROR_INPUT;
+       }
+       if(*size[n] == 0)
+          *size[n] = minimum[n];
+       else if(minimum[n] > 0 && *size[n] < minimum[n])
+       {
+          fprintf(stderr, "%s: %s=%d does not cover the output window, which needs %s=%d. Abort!\n",
+                  __func__, name[n], *size[n], name[n], minimum[n]);
+          return FDTD_ERROR_INPUT;
+       }
+       else if(minimum[n] > 0 && *size[n] > minimum[n])
+       {
+          fprintf(stderr, "%s: %s%s=%d is larger than the %s=%d that the output window needs.%s\n", __func__,
+                  (simulation->strict_grid ? "" : "Warning: "), name[n], *size[n], name[n], minimum[n],
+                  (simulation->strict_grid ? " Abort!" : ""));
+          if(simulation->strict_grid)
+             return FDTD_ERROR_INPUT;
        }
-       free(simulation->e1);
     }
 
-    free(simulation);
+    if(Nx_min > 0 || Ny_min > 0)
+       printf("FDTD: grid for the output window: Nx=%d, Ny=%d (history depth %d rows)\n",
+              simulation->Nx, simulation->Ny, simulation->Nx+simulation->nx/2+1);
+    return FDTD_SUCCESS;
 }
 
 
-grid * initialize_grid(const char * filename)
+//the first half of initialize_grid_from_kv: read and check the parameters and size
+//the grid, without allocating any array (free the grid with free_grid); the grid
+//takes ownership of parameters
+int initialize_grid_parameters(kvarray_t * parameters, grid ** simulation)
 {
-   grid * FDTDsimulation = malloc(sizeof(*FDTDsimulation));
+   *simulation = NULL;
+
+   grid * FDTDsimulation = calloc(1, sizeof(*FDTDsimulation));
    if(!FDTDsimulation)
    {
       perror("initialize_grid: could not allocate memory. Abort!\n");
-      exit(EXIT_FAILURE);
+      freeKVs(parameters);
+      return FDTD_ERROR_MEMORY;
+   }
+   FDTDsimulation->parameters_key_value_pair = parameters;
+
+   //these have no default values (Nx and Ny can be left to size_grid)
+   const char * mandatory[] = {"nx", "Delta", "w0", "gamma"};
+   for(size_t n=0; n<sizeof(mandatory)/sizeof(*mandatory); n++)
+   {
+      if(!givenValue(parameters, mandatory[n]))
+      {
+         fprintf(stderr, "%s: %s is not given. Abort!\n", __func__, mandatory[n]);
+         free_grid(FDTDsimulation);
+         return FDTD_ERROR_INPUT;
+      }
    }
-   
-   //read from input
-   FDTDsimulation->parameters_key_value_pair = readKVs(filename);
 
    //initialize from the input parameters
    FDTDsimulation->nx            = atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "nx"));
-   FDTDsimulation->Nx            = atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "Nx"));
-   FDTDsimulation->Ntotal        = 2 * FDTDsimulation->Nx + FDTDsimulation->nx + 2;
-   FDTDsimulation->Ny            = atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "Ny"));
+   FDTDsimulation->Nx            = (givenValue(FDTDsimulation->parameters_key_value_pair, "Nx") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "Nx")) : 0); //default: from the output window
+   FDTDsimulation->Ny            = (givenValue(FDTDsimulation->parameters_key_value_pair, "Ny") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "Ny")) : 0); //default: from the output window
    FDTDsimulation->Delta         = strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "Delta"), NULL);
-   //FDTDsimulation->k             = strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "k"), NULL);
-   FDTDsimulation->k             = (lookupValue(FDTDsimulation->parameters_key_value_pair, "k") ? \
-	                           strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "k"), NULL) : 0); //default: 0
-   FDTDsimulation->k1            = (lookupValue(FDTDsimulation->parameters_key_value_pair, "k1") ? \
-	                           strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "k1"), NULL) : 0); //default: 0
-   FDTDsimulation->k2            = (lookupValue(FDTDsimulation->parameters_key_value_pair, "k2") ? \
-	                           strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "k2"), NULL) : 0); //default: 0
+   //FDTDsimulation->k             = strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "k"), NULL);
+   FDTDsimulation->k             = (givenValue(FDTDsimulation->parameters_key_value_pair, "k") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "k"), NULL) : 0); //default: 0
+   FDTDsimulation->k1            = (givenValue(FDTDsimulation->parameters_key_value_pair, "k1") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "k1"), NULL) : 0); //default: 0
+   FDTDsimulation->k2            = (givenValue(FDTDsimulation->parameters_key_value_pair, "k2") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "k2"), NULL) : 0); //default: 0
    FDTDsimulation->w0            = strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "w0"), NULL);
    FDTDsimulation->Gamma         = strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "gamma"), NULL);
+   FDTDsimulation->save_chi      = (givenValue(FDTDsimulation->parameters_key_value_pair, "save_chi") ? \
+				   atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "save_chi")) : 0); //default: off
+   FDTDsimulation->save_psi      = (givenValue(FDTDsimulation->parameters_key_value_pair, "save_psi") ? \
+				   atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "save_psi")) : 0); //default: off
+   FDTDsimulation->save_psi_square_integral = (givenValue(FDTDsimulation->parameters_key_value_pair, "save_psi_square_integral") ? \
+		                atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "save_psi_square_integral")) : 0); //default: off
+   FDTDsimulation->save_psi_binary = (givenValue(FDTDsimulation->parameters_key_value_pair, "save_psi_binary") ? \
+				   atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "save_psi_binary")) : 0); //default: off
+   FDTDsimulation->save_g2       = (givenValue(FDTDsimulation->parameters_key_value_pair, "save_g2") ? \
+				   atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "save_g2")) : 0); //default: off
+   FDTDsimulation->init_cond     = (givenValue(FDTDsimulation->parameters_key_value_pair, "init_cond") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "init_cond")) : 0); //default: 0 (unspecified)
+   FDTDsimulation->identical_photons = (givenValue(FDTDsimulation->parameters_key_value_pair, "identical_photons") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "identical_photons")) : 1); //default: 1 (yes)
+   FDTDsimulation->alpha         = (givenValue(FDTDsimulation->parameters_key_value_pair, "alpha") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "alpha"), NULL) : 0); //default: 0
+   FDTDsimulation->alpha1        = (givenValue(FDTDsimulation->parameters_key_value_pair, "alpha1") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "alpha1"), NULL) : 0); //default: 0
+   FDTDsimulation->alpha2        = (givenValue(FDTDsimulation->parameters_key_value_pair, "alpha2") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "alpha2"), NULL) : 0); //default: 0
+   FDTDsimulation->wavepacket_dx = (givenValue(FDTDsimulation->parameters_key_value_pair, "wavepacket_dx") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "wavepacket_dx"), NULL) : 0) \
+	                           / FDTDsimulation->Delta; //default: 0 (unspecified)
+   FDTDsimulation->Tstep         = (givenValue(FDTDsimulation->parameters_key_value_pair, "Tstep") ? \
+				   atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "Tstep")) : 0); //default: 0
+   FDTDsimulation->measure_NM    = (givenValue(FDTDsimulation->parameters_key_value_pair, "measure_NM") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "measure_NM")) : 0); //default: off
+   FDTDsimulation->profile       = (givenValue(FDTDsimulation->parameters_key_value_pair, "profile") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "profile")) : 0); //default: off
+   FDTDsimulation->profiler      = NULL;
+   FDTDsimulation->publish_stats = (givenValue(FDTDsimulation->parameters_key_value_pair, "stats") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "stats")) : 0); //default: off
+   FDTDsimulation->stats         = NULL;
+   FDTDsimulation->envelope      = (givenValue(FDTDsimulation->parameters_key_value_pair, "envelope") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "envelope")) : 0); //default: off
+   FDTDsimulation->scheme        = (givenValue(FDTDsimulation->parameters_key_value_pair, "scheme") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "scheme")) : 2); //default: box scheme
+   FDTDsimulation->diagonal_copy = (givenValue(FDTDsimulation->parameters_key_value_pair, "diagonal_copy") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "diagonal_copy")) : 1); //default: on
+   FDTDsimulation->threads       = (givenValue(FDTDsimulation->parameters_key_value_pair, "threads") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "threads")) : 1); //default: serial
+   FDTDsimulation->tile_rows     = (givenValue(FDTDsimulation->parameters_key_value_pair, "tile_rows") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "tile_rows")) : 0); //default: row by row
+   FDTDsimulation->tile_columns  = (givenValue(FDTDsimulation->parameters_key_value_pair, "tile_columns") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "tile_columns")) : 0); //default: see below
+   FDTDsimulation->reference     = (givenValue(FDTDsimulation->parameters_key_value_pair, "reference") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "reference")) : 0); //default: off
+   FDTDsimulation->numa          = (givenValue(FDTDsimulation->parameters_key_value_pair, "numa") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "numa")) : 0); //default: off
+   FDTDsimulation->pipeline      = (givenValue(FDTDsimulation->parameters_key_value_pair, "pipeline") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "pipeline")) : 0); //default: off
+   FDTDsimulation->richardson    = (givenValue(FDTDsimulation->parameters_key_value_pair, "richardson") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "richardson")) : 0); //default: off
+   FDTDsimulation->richardson_tol = (givenValue(FDTDsimulation->parameters_key_value_pair, "richardson_tol") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "richardson_tol"), NULL) : 0); //default: no refinement
+   FDTDsimulation->green         = (givenValue(FDTDsimulation->parameters_key_value_pair, "green") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "green")) : 0); //default: off
+   FDTDsimulation->steady_state_tol = (givenValue(FDTDsimulation->parameters_key_value_pair, "steady_state_tol") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "steady_state_tol"), NULL) : 0); //default: off
+   FDTDsimulation->k0            = (givenValue(FDTDsimulation->parameters_key_value_pair, "k0") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "k0"), NULL) : FDTDsimulation->w0); //default: w0
+
+   FDTDsimulation->t_max         = (givenValue(FDTDsimulation->parameters_key_value_pair, "t_max") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "t_max"), NULL) : 0); //default: no output window
+   FDTDsimulation->tau_max       = (givenValue(FDTDsimulation->parameters_key_value_pair, "tau_max") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "tau_max"), NULL) : 0); //default: no output window
+   FDTDsimulation->x_max         = (givenValue(FDTDsimulation->parameters_key_value_pair, "x_max") ? \
+	                           strtod(givenValue(FDTDsimulation->parameters_key_value_pair, "x_max"), NULL) : 0); //default: no output window
+   //default: no cache, or that of the job server (see cache.h); cache_dir=none means no cache
+   FDTDsimulation->cache_dir     = givenValue(FDTDsimulation->parameters_key_value_pair, "cache_dir");
+   if(!FDTDsimulation->cache_dir)
+      FDTDsimulation->cache_dir = cache_default_dir();
+   else if(strcmp(FDTDsimulation->cache_dir, "none") == 0)
+      FDTDsimulation->cache_dir = NULL;
+   FDTDsimulation->strict_grid   = (givenValue(FDTDsimulation->parameters_key_value_pair, "strict_grid") ? \
+	                           atoi(givenValue(FDTDsimulation->parameters_key_value_pair, "strict_grid")) : 0); //default: only warn
+
+   FDTDsimulation->rows_done     = 1; //the initial condition
+
+   //fit Nx and Ny to the output window, if one is given
+   int status = size_grid(FDTDsimulation);
+   if(status)
+   {
+      free_grid(FDTDsimulation);
+      return status;
+   }
+   FDTDsimulation->Ntotal        = 2 * FDTDsimulation->Nx + FDTDsimulation->nx + 2;
    FDTDsimulation->Lx            = 2 * FDTDsimulation->Nx * FDTDsimulation->Delta;
    FDTDsimulation->Ly            = (FDTDsimulation->Ny-1) * FDTDsimulation->Delta;
    FDTDsimulation->plus_a_index  = FDTDsimulation->Nx + 3*FDTDsimulation->nx/2 + 1;
    FDTDsimulation->minus_a_index = FDTDsimulation->Nx + FDTDsimulation->nx/2 + 1;
    FDTDsimulation->origin_index  = FDTDsimulation->Nx + FDTDsimulation->nx + 1;
-   FDTDsimulation->save_chi      = (lookupValue(FDTDsimulation->parameters_key_value_pair, "save_chi") ? \
-				   atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "save_chi")) : 0); //default: off
-   FDTDsimulation->save_psi      = (lookupValue(FDTDsimulation->parameters_key_value_pair, "save_psi") ? \
-				   atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "save_psi")) : 0); //default: off
-   FDTDsimulation->save_psi_square_integral = (lookupValue(FDTDsimulation->parameters_key_value_pair, "save_psi_square_integral") ? \
-		                atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "save_psi_square_integral")) : 0); //default: off
-   FDTDsimulation->save_psi_binary = (lookupValue(FDTDsimulation->parameters_key_value_pair, "save_psi_binary") ? \
-				   atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "save_psi_binary")) : 0); //default: off
-   FDTDsimulation->init_cond     = (lookupValue(FDTDsimulation->parameters_key_value_pair, "init_cond") ? \
-	                           atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "init_cond")) : 0); //default: 0 (unspecified)
-   FDTDsimulation->identical_photons = (lookupValue(FDTDsimulation->parameters_key_value_pair, "identical_photons") ? \
-	                           atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "identical_photons")) : 1); //default: 1 (yes)
-   FDTDsimulation->alpha         = (lookupValue(FDTDsimulation->parameters_key_value_pair, "alpha") ? \
-	                           strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "alpha"), NULL) : 0); //default: 0
-   FDTDsimulation->alpha1        = (lookupValue(FDTDsimulation->parameters_key_value_pair, "alpha1") ? \
-	                           strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "alpha1"), NULL) : 0); //default: 0
-   FDTDsimulation->alpha2        = (lookupValue(FDTDsimulation->parameters_key_value_pair, "alpha2") ? \
-	                           strtod(lookupValue(FDTDsimulation->parameters_key_value_pair, "alpha2"), NULL) : 0); //default: 0
-   FDTDsimulation->Tstep         = (lookupValue(FDTDsimulation->parameters_key_value_pair, "Tstep") ? \
-				   atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "Tstep")) : 0); //default: 0
-   FDTDsimulation->measure_NM    = (lookupValue(FDTDsimulation->parameters_key_value_pair, "measure_NM") ? \
-	                           atoi(lookupValue(FDTDsimulation->parameters_key_value_pair, "measure_NM")) : 0); //default: off
 
    //check the validity of parameters
-   sanity_check(FDTDsimulation);
+   status = sanity_check(FDTDsimulation);
+   if(status)
+   {
+      free_grid(FDTDsimulation);
+      return status;
+   }
+
+   *simulation = FDTDsimulation;
+   return FDTD_SUCCESS;
+}
+
+
+//same as initialize_grid_from_kv for a grid at half the spacing of coarser (or
+//NULL), whose qubit tables are copied instead of recomputed where the rows coincide
+int initialize_refined_grid(kvarray_t * parameters, const char * name, const grid * coarser, grid ** simulation)
+{
+   *simulation = NULL;
+
+   grid * FDTDsimulation;
+   int status = initialize_grid_parameters(parameters, &FDTDsimulation);
+   if(status)
+      return status;
+   FDTDsimulation->coarser = coarser;
 
    //calculate the normalization constant
    if(FDTDsimulation->init_cond==3) calculate_normalization_const(FDTDsimulation);
 
-   //initialize arrays
-   prepare_qubit_wavefunction(FDTDsimulation);
-   initial_condition(FDTDsimulation);
-   boundary_condition(FDTDsimulation);
-   initialize_psi(FDTDsimulation);
+   //start collecting hardware counters if requested
+   if(FDTDsimulation->profile) FDTDsimulation->profiler = create_profiler();
+
+   //publish live progress if requested (stats_dir is optional); a failure here only costs the progress report
+   if(FDTDsimulation->publish_stats)
+      FDTDsimulation->stats = create_stats(givenValue(FDTDsimulation->parameters_key_value_pair, "stats_dir"), name);
+
+   //initialize arrays; with pipeline>0 the qubit tables and the strip are prepared while the march runs (see pipeline.h)
+   if(!FDTDsimulation->pipeline)
+   {
+      stats_set_phase(FDTDsimulation->stats, STATS_PHASE_QUBIT, FDTDsimulation->Ny);
+      profiler_begin(FDTDsimulation->profiler, "prepare_qubit_wavefunction");
+      status = prepare_qubit_wavefunction(FDTDsimulation);
+      profiler_end(FDTDsimulation->profiler, 0, 0);
+   }
+   if(!status)
+   {
+      stats_set_phase(FDTDsimulation->stats, STATS_PHASE_INITIAL, 0);
+      profiler_begin(FDTDsimulation->profiler, "initial_condition");
+      status = initial_condition(FDTDsimulation);
+      profiler_end(FDTDsimulation->profiler, 0, 0);
+   }
+   if(!status && !FDTDsimulation->pipeline)
+   {
+      stats_set_phase(FDTDsimulation->stats, STATS_PHASE_BOUNDARY, FDTDsimulation->Ny);
+      profiler_begin(FDTDsimulation->profiler, "boundary_condition");
+      status = boundary_condition(FDTDsimulation);
+      profiler_end(FDTDsimulation->profiler, 0, 0);
+   }
+   else if(!status)
+      FDTDsimulation->psix0_x_size = FDTDsimulation->nx+1; //the width of the strip, for initialize_psi
+   if(!status)
+   {
+      stats_set_phase(FDTDsimulation->stats, STATS_PHASE_PSI, FDTDsimulation->Ny);
+      profiler_begin(FDTDsimulation->profiler, "initialize_psi");
+      status = initialize_psi(FDTDsimulation);
+      profiler_end(FDTDsimulation->profiler, 0, 0);
+   }
+   if(!status && FDTDsimulation->pipeline)
+      status = start_pipeline(FDTDsimulation);
+   if(status)
+   {
+      free_grid(FDTDsimulation);
+      return status;
+   }
 
    //save memory
    free_initial_boundary_conditions(FDTDsimulation);
 
-   return FDTDsimulation;
+   FDTDsimulation->coarser = NULL;
+   *simulation = FDTDsimulation;
+   return FDTD_SUCCESS;
 }
 
 
@@ -606,7 +1323,17 @@ void print_psi(grid * simulation)
 //this function stores the computed wavefunction into a file;
 //the third argument "part" can be any function converting a 
 //double complex to a double, e.g., creal, cimag, cabs, etc. 
-void save_psi(grid * simulation, const char * filename, double (*part)(double complex))
+//the text outputs start with a comment line (skipped by e.g. numpy.loadtxt) if the rows
+//from steady_state_row on are extrapolated rather than marched (see solver.c)
+static void write_steady_state_note(FILE * f, grid * simulation)
+{
+    if(simulation->steady_state_row)
+       fprintf( f, "# steady state reached at t=%.10g: rows j>=%d are extrapolated as exp(-2ik*Delta)*psi(x,t-Delta)\n",
+                (simulation->steady_state_row-1)*simulation->Delta, simulation->steady_state_row );
+}
+
+
+int save_psi(grid * simulation, const char * filename, double (*part)(double complex))
 {
     char * str = strdup(filename);
     str = realloc(str, (strlen(filename)+10)*sizeof(char) );
@@ -624,7 +1351,14 @@ void save_psi(grid * simulation, const char * filename, double (*part)(double co
     }
 
     FILE * f = fopen(str, "w");
+    if(!f)
+    {
+        fprintf(stderr, "%s: cannot create %s. Abort!\n", __func__, str);
+        free(str);
+        return FDTD_ERROR_FILE;
+    }
 
+    write_steady_state_note(f, simulation);
     for(int j=0; j<simulation->Ny; j+=(simulation->Tstep+1))
     {
         for(int i=0; i<simulation->Ntotal; i++)
@@ -638,14 +1372,15 @@ void save_psi(grid * simulation, const char * filename, double (*part)(double co
         fprintf( f, "\n");
     }
 
-    fclose(f);
+    close_output_file(f, simulation);
     free(str);
+    return FDTD_SUCCESS;
 }
 
 
 //this function stores the computed wavefunction into a binary file
 //note that each data point is a complex number which takes 16 bytes!
-void save_psi_binary(grid * simulation, const char * filename)
+int save_psi_binary(grid * simulation, const char * filename)
 {
     char * str = strdup(filename);
     str = realloc(str, (strlen(filename)+10)*sizeof(char) );
@@ -654,8 +1389,9 @@ void save_psi_binary(grid * simulation, const char * filename)
     FILE * f = fopen(str, "wb");
     if(!f)
     {
-        fprintf(stderr, "%s: file cannot be created!", __func__);
-        exit(EXIT_FAILURE);
+        fprintf(stderr, "%s: cannot create %s. Abort!\n", __func__, str);
+        free(str);
+        return FDTD_ERROR_FILE;
     }
 
     size_t array_size = simulation->Ntotal - simulation->minus_a_index;
@@ -665,16 +1401,62 @@ void save_psi_binary(grid * simulation, const char * filename)
         fwrite(simulation->psi[j] + simulation->minus_a_index, sizeof(double complex), array_size, f);
     }
 
-    fclose(f);
+    close_output_file(f, simulation);
     free(str);
+    return FDTD_SUCCESS;
+}
+
+
+//psi[j][i], with the carrier put back if the march is still in envelope mode
+static double complex stored_psi(int j, int i, grid * simulation)
+{
+    if(simulation->envelope && !simulation->carrier_restored)
+       return simulation->psi[j][i] * carrier(j, i, simulation);
+    return simulation->psi[j][i];
+}
+
+
+//this function computes one row (t=j*Delta) of the two-photon wavefunction
+//chi(a+Delta, a+Delta+tau, t) with tau=i*Delta for 0 <= i <= Nx-nx/2 (the
+//length of chi is therefore Nx-nx/2+1); rows 0..j-1 of psi must be ready
+void compute_chi(int j, grid * simulation, double complex * chi)
+{
+    //to make all terms in chi well-defined requires 0 <= i <= Nx-nx/2.
+    //
+    //Update: To access transient dynamics for two photons, j now starts from 0 instead of minus_a_index (=Nx+nx/2+1)
+    //
+    //(In the previous version, j >= simulation->minus_a_index in order to let signal from the 1st qubit reach the boundary;
+    //put it differently, one cannot take data before the first light cone intersects with the boundary x=Nx*Delta.)
+    for(int i=0; i<=simulation->Nx-simulation->nx/2; i++)
+    {
+        double complex temp = 0;
+        chi[i] = 0;
+
+        if(simulation->init_cond == 1 || simulation->init_cond == 3 || simulation->init_cond == 5)
+           chi[i] += two_photon_input(simulation->nx/2+1-j, simulation->nx/2+1+i-j, simulation);
+
+        if( j>=(simulation->nx+i+1) )
+           temp += stored_psi(j-(simulation->nx+i+1), simulation->minus_a_index-i, simulation);
+
+        if( j>=(i+1) )
+           temp -= stored_psi(j-(i+1), simulation->plus_a_index-i, simulation);
+
+        if( j>=(simulation->nx+1) )
+           temp += stored_psi(j-(simulation->nx+1), simulation->minus_a_index+i, simulation);
+
+        if( j>=1 )
+           temp -= stored_psi(j-1, simulation->plus_a_index+i, simulation);
+
+        chi[i] -= sqrt(simulation->Gamma)/2.0 * temp;
+    }
 }
 
 
 //this function computes the two-photon wavefunction on the fly and
-//then writes to a file, so no extra memory is allocated;
+//then writes to a file, so only one row of chi is stored in memory;
 //the third argument "part" can be any function converting a
 //complex to a double, e.g., creal, cimag, cabs, etc.
-void save_chi(grid * simulation, const char * filename, double (*part)(double complex))
+int save_chi(grid * simulation, const char * filename, double (*part)(double complex))
 {
     char * str = strdup(filename);
     str = realloc(str, (strlen(filename)+15)*sizeof(char) );
@@ -691,45 +1473,48 @@ void save_chi(grid * simulation, const char * filename, double (*part)(double co
        strcat(str, ".chi.out");
     }
 
+    double complex * chi = malloc((simulation->Nx-simulation->nx/2+1)*sizeof(*chi));
+    if(!chi)
+    {
+        fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+        free(str);
+        return FDTD_ERROR_MEMORY;
+    }
+
     FILE * f = fopen(str, "w");
+    if(!f)
+    {
+        fprintf(stderr, "%s: cannot create %s. Abort!\n", __func__, str);
+        free(chi);
+        free(str);
+        return FDTD_ERROR_FILE;
+    }
 
-    //compute chi(a+Delta, a+Delta+tau, t) with tau=i*Delta and t=j*Delta:
-    //to make all terms in chi well-defined requires 0 <= i <= Nx-nx/2.
-    //
-    //Update: To access transient dynamics for two photons, j now starts from 0 instead of minus_a_index (=Nx+nx/2+1)
-    //
-    //(In the previous version, j >= simulation->minus_a_index in order to let signal from the 1st qubit reach the boundary;
-    //put it differently, one cannot take data before the first light cone intersects with the boundary x=Nx*Delta.)
+    write_steady_state_note(f, simulation);
+
+    //compute chi(a+Delta, a+Delta+tau, t) with tau=i*Delta and t=j*Delta
     for(int j=0; j<=simulation->Ny; j+=(simulation->Tstep+1))
     {
+        compute_chi(j, simulation, chi);
         for(int i=0; i<=simulation->Nx-simulation->nx/2; i++)
-        {
-            double complex chi = 0;
-	    double complex temp = 0;
-
-            if(simulation->init_cond == 1 || simulation->init_cond == 3)
-	       chi += two_photon_input(simulation->nx/2+1-j, simulation->nx/2+1+i-j, simulation);
-
-            if( j>=(simulation->nx+i+1) ) 
-	       temp += simulation->psi[j-(simulation->nx+i+1)][simulation->minus_a_index-i];
-
-            if( j>=(i+1) ) 
-	       temp -= simulation->psi[j-(i+1)][simulation->plus_a_index-i];
-
-	    if( j>=(simulation->nx+1) )
-	       temp += simulation->psi[j-(simulation->nx+1)][simulation->minus_a_index+i];
-
-	    if( j>=1 )
-	       temp -= simulation->psi[j-1][simulation->plus_a_index+i];
-
-            chi -= sqrt(simulation->Gamma)/2.0 * temp;
-            fprintf( f, "%.5g ", part(chi) );
-        }
+            fprintf( f, "%.5g ", part(chi[i]) );
         fprintf( f, "\n");
     }
 
-    fclose(f);
+    close_output_file(f, simulation);
+    free(chi);
     free(str);
+    return FDTD_SUCCESS;
+}
+
+
+//close an output file and account for its size in the live progress block
+void close_output_file(FILE * f, grid * simulation)
+{
+    long bytes = ftell(f);
+    fclose(f);
+    if(bytes > 0)
+       stats_add_bytes_written(simulation->stats, bytes);
 }
 
 
@@ -757,7 +1542,7 @@ void print_grid(grid * simulation)
 }
 
 
-void save_psi_square_integral(grid * simulation, const char * filename)
+int save_psi_square_integral(grid * simulation, const char * filename)
 {
     char * str = strdup(filename);
     str = realloc(str, (strlen(filename)+18)*sizeof(char) );
@@ -765,10 +1550,17 @@ void save_psi_square_integral(grid * simulation, const char * filename)
 
     int Tmax = (simulation->Ny-1 < simulation->Nx - simulation->nx/2 ? simulation->Ny-1 : simulation->Nx - simulation->nx/2);
     FILE * f = fopen(str, "w");
+    if(!f)
+    {
+        fprintf(stderr, "%s: cannot create %s. Abort!\n", __func__, str);
+        free(str);
+        return FDTD_ERROR_FILE;
+    }
 
     for(int j=0; j<Tmax; j++)
        fprintf( f, "%.10g\n", psi_square_integral(j, simulation) );
 
-    fclose(f);
+    close_output_file(f, simulation);
     free(str);
+    return FDTD_SUCCESS;
 }
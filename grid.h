@@ -16,6 +16,28 @@
 #include <complex.h> 
 #include "kv.h"
 
+struct _profiler; //see profiler.h
+struct _stats;    //see stats.h
+struct _stencil;  //see stencil.h
+struct _numa;     //see numa.h
+struct _pipeline; //see pipeline.h
+struct _g2;       //see g2.h
+
+//status codes returned by the solver functions; none of them terminates the program
+enum fdtd_status
+{
+   FDTD_SUCCESS = 0,
+   FDTD_ERROR_INPUT,   //missing or invalid input parameter
+   FDTD_ERROR_MEMORY,  //memory allocation failed
+   FDTD_ERROR_FILE,    //a file cannot be read or written
+   FDTD_ERROR_NUMERIC, //NaN is produced
+   FDTD_ERROR_STATE    //the request does not fit the current state of the grid
+};
+
+#define FDTD_MAX_OBSERVERS 8
+#define FDTD_MAX_TILE_ROWS 64
+#define FDTD_MAX_THREADS   64
+
 /* 
    Create a grid which stores the wavefunction and other relavant information.
    The layout of the grid should look like this:
@@ -71,6 +93,7 @@ struct _grid
    double alpha1; // exponential tail for photon #1 (dimensionless)
    double alpha2; // exponential tail for photon #2 (dimensionless)
    double A;      // normalization constant for two-photon exponential wavepacket
+   double k0;     // carrier frequency factored out in envelope mode (in units of 1/Delta; default: w0)
 
    //actual info on dynamics
    double complex * psit0;  //initial condition psi(x,0) (stored as psi0[x])
@@ -80,6 +103,8 @@ struct _grid
    double complex * e0_1;   //qubit wavefunction for I.C. e(0)=0 and the exponential wavepacket #1
    double complex * e0_2;   //qubit wavefunction for I.C. e(0)=0 and the exponential wavepacket #2
    double complex * e1;     //qubit wavefunction for I.C. e(0)=1 and no incident wavepacket
+   double complex * wavepacket; //tabulated wavepacket phi(-a-n*wavepacket_dx), n=0,1,... (init_cond=4 and 5)
+   double * wavepacket_norm;    //\int_{-\infty}^{-a-n*wavepacket_dx} dx |phi(x)|^2 for the tabulated wavepacket
    double complex * mu;     //mu(t) for calculating NM measures
    double * lambda;         //lambda(t) for calculating NM measures
    
@@ -89,43 +114,106 @@ struct _grid
    int psi_y_size;   //array size of psi in t
    int psix0_x_size; //array size of psix0 in x
    int psix0_y_size; //array size of psix0 in t
+   int window_start; //first column visited by the march: psi stays zero to its left (see solver.c)
+   int wavepacket_size;  //number of samples of the tabulated wavepacket
+   double wavepacket_dx; //spacing of the tabulated wavepacket (in units of Delta)
 
    //program options
    int save_chi;          //whether or not to save the two-photon wavefunction to file (default: no)
    int save_psi;          //whether or not to save the wavefunction to file (default: no)
    int save_psi_square_integral; //whether or not to save \int dx |psi(x,t)|^2 to file (default: no)
    int save_psi_binary;   //whether or not to save the wavefunction to binary file (default: no)
+   int save_g2;           //whether or not to save g2(tau,t) to binary file, see g2.h (default: no)
    int init_cond;         //the initial condition of the wavefunction (default: unspecified)
    int identical_photons; //whether or not the two photons are identical (default: yes; only effective for init_cond=3)
    size_t Tstep;          //for output of save_psi: save psi for every (Tstep+1) temporal steps
    int measure_NM;        //currently it means whether to save e0 and e1 or not //TODO: extend this part
+   int profile;           //whether or not to collect hardware counters and a roofline summary (default: no)
+   int publish_stats;     //whether or not to publish live progress in a shared-memory block (default: no)
+   int envelope;          //whether or not to march the envelope psi*exp(-i*k0*(x-2t)) instead of psi (default: no)
+   int scheme;            //order of the discretization: 2 (box scheme) or 4 (see solver.c) (default: 2)
+   int diagonal_copy;     //scheme=2: whether or not the light cones read psi from contiguous copies of its diagonals (default: yes)
+   int tile_rows;         //scheme=2: number of rows marched together in tiles, see solver.c (default: 0, row by row)
+   int tile_columns;      //width of the tiles (default: 0, chosen to fit into L2)
+   int threads;           //number of threads of the tiled march (default: 1)
+   int reference;         //scheme=2: whether or not to march with the point-by-point reference kernel (default: no)
+   int numa;              //scheme=2: whether or not to place psi and the threads in stripes per NUMA node, see numa.h (default: no)
+   int pipeline;          //number of threads that prepare the qubit tables and the strip while the march runs, see pipeline.h (default: 0, before the march)
+   int richardson;        //whether or not to extrapolate psi from runs at Delta and Delta/2 (default: no)
+   double richardson_tol; //Richardson mode: halve Delta until the error estimate is below this (default: 0, no refinement)
+   int green;             //whether or not to obtain chi from stored impulse responses instead of marching (default: no)
+   double steady_state_tol; //init_cond=1: extrapolate the rows once psi is stationary to this tolerance (default: 0, never)
+   double t_max;          //output window: last time that the outputs need (default: 0, Ny as given)
+   double tau_max;        //output window: largest tau of chi (default: 0, Nx as given)
+   double x_max;          //output window: largest x of psi (default: 0, Nx as given)
+   int strict_grid;       //whether or not to refuse Nx and Ny larger than the output window needs (default: no, only warn)
+   const char * cache_dir; //directory of the cached qubit tables, see cache.h (default: NULL, no cache)
 
    //input parameters (stored for convenience)
    kvarray_t * parameters_key_value_pair;
+
+   //only set while a grid refined from it is being initialized (Richardson mode),
+   //so that its qubit tables are reused on the even rows
+   const struct _grid * coarser;
+
+   //profiling data (NULL unless profile=1)
+   struct _profiler * profiler;
+
+   //live progress block (NULL unless stats=1)
+   struct _stats * stats;
+
+   //march state: rows [0, rows_done) of psi are final (row 0 is the initial condition)
+   int rows_done;
+   int stopped;           //set when an observer asked the current fdtd_step to stop
+   int steady_state_row;  //first row extrapolated from the steady state, or 0 if all rows are marched (see solver.c)
+   int steady_rows;       //number of consecutive rows that met steady_state_tol so far
+   int carrier_restored;  //envelope mode: set once the carrier is multiplied back into psi
+   double complex * cone_diagonal[4]; //diagonal_copy: psi along the diagonals read by the light cones (see solver.c)
+   int cone_diagonal_row; //the row for which cone_diagonal was last updated, or -1
+   struct _stencil * stencil; //scheme=2: the delayed and light-cone terms of the march (see stencil.h)
+   int * row_progress;    //tiled march: last column computed so far in each row (see solver.c)
+   struct _numa * placement; //numa=1: the stripes of psi and the CPUs of their threads (see numa.h)
+   struct _pipeline * setup; //pipeline>0: the rows whose strip is ready, until the set-up threads are joined (see pipeline.h)
+   struct _g2 * g2;       //save_g2=1: the file the rows of g2 are streamed to (see g2.h)
+   int n_observers;
+   int (*observers[FDTD_MAX_OBSERVERS])(struct _grid * simulation, int j, void * data);
+   void * observer_data[FDTD_MAX_OBSERVERS];
 };
 typedef struct _grid grid;
 
+//called after row j of psi is computed; return nonzero to stop the march
+typedef int (*fdtd_observer)(grid * simulation, int j, void * data);
+
+double complex plane_wave_e(int j, grid * simulation);
+double complex plane_wave_BC_from_e(double complex e_t, int j, int i, grid * simulation);
 double complex plane_wave_BC(int j, int i, grid * simulation);
 double complex exponential_BC(int j, int i, grid * simulation);
 double complex two_exponential_BC(int j, int i, grid * simulation);
-void initial_condition(grid * simulation);
-void boundary_condition(grid * simulation);
-void initialize_psi(grid * simulation);
-void sanity_check (grid * simulation);
+double complex tabulated_BC(int j, int i, grid * simulation);
+int initial_condition(grid * simulation);
+int boundary_condition(grid * simulation);
+int initialize_psi(grid * simulation);
+int sanity_check (grid * simulation);
 void free_initial_boundary_conditions(grid * simulation);
 void free_grid(grid * simulation);
-grid * initialize_grid(const char * filename);
+int initialize_grid(const char * filename, grid ** simulation);
+int initialize_grid_from_kv(kvarray_t * parameters, const char * name, grid ** simulation);
+int initialize_grid_parameters(kvarray_t * parameters, grid ** simulation);
+int initialize_refined_grid(kvarray_t * parameters, const char * name, const grid * coarser, grid ** simulation);
 void print_initial_condition(grid * simulation);
 void print_boundary_condition(grid * simulation);
 void print_grid(grid * simulation);
 void print_psi(grid * simulation);
-void save_psi(grid * simulation, const char * filename, double (*part)(double complex));
-void save_psi_binary(grid * simulation, const char * filename);
-void save_chi(grid * simulation, const char * filename, double (*part)(double complex));
-void save_psi_square_integral(grid * simulation, const char * filename);
-void prepare_qubit_wavefunction(grid * simulation);
-void initialize_e0(grid * simulation);
-void initialize_e1(grid * simulation);
+int save_psi(grid * simulation, const char * filename, double (*part)(double complex));
+int save_psi_binary(grid * simulation, const char * filename);
+void compute_chi(int j, grid * simulation, double complex * chi);
+int save_chi(grid * simulation, const char * filename, double (*part)(double complex));
+int save_psi_square_integral(grid * simulation, const char * filename);
+int read_wavepacket(grid * simulation);
+int prepare_qubit_wavefunction(grid * simulation);
+int initialize_e0(grid * simulation);
+int initialize_e1(grid * simulation);
 void calculate_normalization_const(grid * simulation);
+void close_output_file(FILE * f, grid * simulation);
 
 #endif
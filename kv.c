@@ -39,22 +39,18 @@ void readfile(FILE * f, char *** str_array, size_t *count)
 
 kvpair_t * create_kvpair(char * str)
 {
-   kvpair_t * kvpair = malloc(sizeof(*kvpair));
-   kvpair->key = NULL;
-   kvpair->value = NULL;
-   
    char * equal_sign1 = strchr(str, '=');
    if(!equal_sign1) 
    {
       fprintf(stderr, "Equal sign is not found in the intput. Abort!\n");
-      exit(EXIT_FAILURE);
+      return NULL;
    }
 
    char * line_end = strchr(str, '\n'); //str is read using getline, so the string is ended with "\n\0"
    if(!line_end)
    {
       fprintf(stderr, "Line delimiter is not found in the input. Abort!\n");
-      exit(EXIT_FAILURE);
+      return NULL;
    }
    line_end--;
 
@@ -66,20 +62,31 @@ kvpair_t * create_kvpair(char * str)
    if(key_end < str)
    {
       fprintf(stderr, "Key is empty. Abort!\n");
-      exit(EXIT_FAILURE);
+      return NULL;
    }
-   kvpair->key = realloc(kvpair->key, (key_end-str+2)*sizeof(char) );
-   strncpy(kvpair->key, str, key_end-str+1);
-   kvpair->key[key_end-str+1] = '\0';
    
    //get value
    //let stdlib utilities handle whitespaces
    if(line_end < equal_sign1+1)
    {
       fprintf(stderr, "Value is empty. Abort!\n");
-      exit(EXIT_FAILURE);
+      return NULL;
    }
-   kvpair->value = realloc(kvpair->value, (line_end-equal_sign1+1)*sizeof(char) );
+
+   kvpair_t * kvpair = malloc(sizeof(*kvpair));
+   if(!kvpair)
+      return NULL;
+   kvpair->key = malloc( (key_end-str+2)*sizeof(char) );
+   kvpair->value = malloc( (line_end-equal_sign1+1)*sizeof(char) );
+   if(!kvpair->key || !kvpair->value)
+   {
+      free(kvpair->key);
+      free(kvpair->value);
+      free(kvpair);
+      return NULL;
+   }
+   strncpy(kvpair->key, str, key_end-str+1);
+   kvpair->key[key_end-str+1] = '\0';
    strncpy(kvpair->value, equal_sign1+1, line_end-equal_sign1);
    kvpair->value[line_end-equal_sign1] = '\0';
 
@@ -87,17 +94,14 @@ kvpair_t * create_kvpair(char * str)
 }
 
 
+//returns NULL if the file cannot be read or is not in the key=value format
 kvarray_t * readKVs(const char * fname) {
-  kvarray_t * kvarray = malloc(sizeof(*kvarray));
-  kvarray->kvpair = NULL;
-  kvarray->kvpair_len = 0;
-  
   //open file
   FILE * kv_input_file = fopen(fname, "r");
   if(!kv_input_file)
   {
      perror("Could not open key-value input file.\n");
-     exit(EXIT_FAILURE);
+     return NULL;
   }
 
   //read raw strings from file
@@ -106,25 +110,35 @@ kvarray_t * readKVs(const char * fname) {
   readfile(kv_input_file, &raw_data, &size);
 
   //create kvpair_t object
-  for(int i=0; i<size; i++)
+  kvarray_t * kvarray = createKVs();
+  for(int i=0; kvarray && i<size; i++)
   {
-     kvarray->kvpair = realloc(kvarray->kvpair, (kvarray->kvpair_len+1)*sizeof(*(kvarray->kvpair)) );
-     kvarray->kvpair[i] = create_kvpair(raw_data[i]);
+     kvpair_t ** kvpair = realloc(kvarray->kvpair, (kvarray->kvpair_len+1)*sizeof(*(kvarray->kvpair)) );
+     kvpair_t * pair = create_kvpair(raw_data[i]);
+     if(kvpair)
+        kvarray->kvpair = kvpair;
+     if(!kvpair || !pair)
+     {
+        if(pair)
+        {
+           free(pair->key);
+           free(pair->value);
+           free(pair);
+        }
+        freeKVs(kvarray);
+        kvarray = NULL;
+        break;
+     }
+     kvarray->kvpair[i] = pair;
      kvarray->kvpair_len++;
   }
 
-  //quick check
-  if(kvarray->kvpair_len != size) 
-  {
-     fprintf(stderr, "Something is wrong. Abort!\n");
-     exit(EXIT_FAILURE);
-  }   
-
   //close file
   if( fclose(kv_input_file) )
   {
      perror("Error when closing the key-value input file.\n");
-     exit(EXIT_FAILURE);
+     freeKVs(kvarray);
+     kvarray = NULL;
   }
 
   //free raw data
@@ -136,7 +150,70 @@ kvarray_t * readKVs(const char * fname) {
 }
 
 
+//an empty array to be filled by addKV
+kvarray_t * createKVs(void) {
+  kvarray_t * kvarray = malloc(sizeof(*kvarray));
+  if(!kvarray)
+     return NULL;
+  kvarray->kvpair = NULL;
+  kvarray->kvpair_len = 0;
+  return kvarray;
+}
+
+
+//set key=value, replacing the value if the key exists; returns 0 on success
+int addKV(kvarray_t * pairs, const char * key, const char * value) {
+  char * new_value = strdup(value);
+  if(!new_value)
+     return -1;
+
+  for(int i=0; i<pairs->kvpair_len; i++)
+  {
+     if(strcmp(pairs->kvpair[i]->key, key)==0)
+     {
+        free(pairs->kvpair[i]->value);
+        pairs->kvpair[i]->value = new_value;
+        return 0;
+     }
+  }
+
+  kvpair_t ** kvpair = realloc(pairs->kvpair, (pairs->kvpair_len+1)*sizeof(*(pairs->kvpair)) );
+  kvpair_t * pair = malloc(sizeof(*pair));
+  char * new_key = strdup(key);
+  if(kvpair)
+     pairs->kvpair = kvpair;
+  if(!kvpair || !pair || !new_key)
+  {
+     free(new_value);
+     free(new_key);
+     free(pair);
+     return -1;
+  }
+  pair->key = new_key;
+  pair->value = new_value;
+  pairs->kvpair[pairs->kvpair_len++] = pair;
+  return 0;
+}
+
+
+//a deep copy of pairs (NULL if out of memory)
+kvarray_t * copyKVs(kvarray_t * pairs) {
+  kvarray_t * kvarray = createKVs();
+  for(int i=0; kvarray && i<pairs->kvpair_len; i++)
+  {
+     if(addKV(kvarray, pairs->kvpair[i]->key, pairs->kvpair[i]->value))
+     {
+        freeKVs(kvarray);
+        kvarray = NULL;
+     }
+  }
+  return kvarray;
+}
+
+
 void freeKVs(kvarray_t * pairs) {
+  if(!pairs)
+     return;
   for(int i=0; i<pairs->kvpair_len; i++)
   {
      free(pairs->kvpair[i]->key);
@@ -182,3 +259,13 @@ char * lookupValue(kvarray_t * pairs, const char * key) {
   else
       return pairs->kvpair[key_index]->value;
 }
+
+
+char * givenValue(kvarray_t * pairs, const char * key) {
+  for(int i=0; i<pairs->kvpair_len; i++)
+  {
+     if(strcmp(pairs->kvpair[i]->key, key)==0)
+        return pairs->kvpair[i]->value;
+  }
+  return NULL;
+}
@@ -36,8 +36,17 @@ kvarray_t * readKVs(const char * fname);
 
 void freeKVs(kvarray_t * pairs);
 
+kvarray_t * createKVs(void);
+
+int addKV(kvarray_t * pairs, const char * key, const char * value);
+
+kvarray_t * copyKVs(kvarray_t * pairs);
+
 void printKVs(kvarray_t * pairs);
 
 char * lookupValue(kvarray_t * pairs, const char * key);
 
+//the same without the warning if key is not given, for the optional keys
+char * givenValue(kvarray_t * pairs, const char * key);
+
 #endif
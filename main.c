@@ -8,141 +8,188 @@
  * http://www.wtfpl.net/ for more details.
  */
 
-#include <math.h>
-#include "grid.h"
-#include "kv.h"
-#include "dynamics.h"
-#include "NM_measure.h"
+#include <string.h>
+#include "fdtd.h"
+#include "solver.h"
+#include "profiler.h"
+#include "stats.h"
+#include "richardson.h"
+#include "green.h"
+#include "plan.h"
+#include "server.h"
+#include "selftest.h"
+#include "numa.h"
+#include "g2.h"
 
 
-int main(int argc, char **argv)
+//the outputs of lane l are named input_filename.lane<l>.* if there are several lanes
+static char * output_name(const char * input, int l, int nlanes)
 {
-   if(argc != 2)
+   char * name = malloc(strlen(input)+16);
+   if(name)
    {
-      fprintf(stderr, "Usage: ./FDTD input_parameters\n");
-      exit(EXIT_FAILURE);
+      if(nlanes == 1)
+         strcpy(name, input);
+      else
+         sprintf(name, "%s.lane%d", input, l);
    }
-   
-   printf("FDTD: solving 1+1D delay PDE\n");
-   printf("This code is released under the WTFPL without any warranty.\n");
-   printf("See LICENSE or http://www.wtfpl.net/ for more details.\n");
-   printf("Copyright (C) 2016 Leo Fang\n\n");
-   //printf("For the academic uses, citation to (ref) is strongly encouraged but not required.\n");
-   
+   return name;
+}
+
+
+//solve the problem of one input file, and write the results next to it
+static int run_input(const char * input)
+{
    printf("FDTD: preparing the grid...\n");
-   grid * simulation = initialize_grid(argv[1]);
+   grid * lanes[FDTD_MAX_LANES];
+   int nlanes;
+   int status = fdtd_create_lanes_from_file(input, lanes, &nlanes);
+   if(status)
+   {
+      fprintf(stderr, "FDTD: %s. Abort!\n", fdtd_strerror(status));
+      return EXIT_FAILURE;
+   }
+   grid * simulation = lanes[0];
 //   printf("\033[F\033[2KFDTD: preparing the grid...Done!\n");
    printf("FDTD: simulation starts...\n");// fflush(stdout);
+   if(nlanes > 1)
+      printf("FDTD: marching %d lanes...\n", nlanes);
 
-   // W = (i*w0+Gamma/2)
-   double complex W = simulation->w0*I+0.5*simulation->Gamma;
-
-   //simulation starts
-   for(int j=1; j<simulation->Ny; j++) //start from t=1*Delta
+   if(simulation->green)
    {
-       for(int i=simulation->nx+1; i<simulation->Ntotal; i++) //start from x=-Nx*Delta
-       {
-           //points (i) right next to the 1st light cone and in tile B1, 
-           //and (ii) right next to the 2nd light cone 
-           //should be strictly zero under any circumstances
-           if( ((j < simulation->nx) && (i==j+simulation->minus_a_index+1))
-               || (i==j+simulation->plus_a_index+1) )
-               continue; //do nothing, as psi is already zero initailized
-
-           //free propagation (decay included)
-           simulation->psi[j][i] = (1./simulation->Delta-0.25*W)*simulation->psi[j-1][i-1]   \
-                                   -0.25*W*(simulation->psi[j-1][i]+simulation->psi[j][i-1]);
-           
-           //delay term: psi(x-2a, t-2a)theta(t-2a)
-           if(j>simulation->nx)
-               simulation->psi[j][i] += 0.5*simulation->Gamma*square_average(j-simulation->nx, i-simulation->nx, simulation);
-   
-           //left light cone No.1: psi(-x-2a, t-x-a)theta(x+a)theta(t-x-a)
-           if( (i>simulation->minus_a_index) && (j-i>=-simulation->minus_a_index) )
-           { 
-               double on_light_cone = (j-i == -simulation->minus_a_index?0.5:1.0);
-               simulation->psi[j][i] -= 0.5*simulation->Gamma*bar_average(j-(i-simulation->origin_index)-simulation->nx/2, \
-                                        2*simulation->origin_index-i-simulation->nx+1, simulation)*on_light_cone; 
-           }
-   
-           //left light cone No.2: -psi(-x, t-x-a)theta(x+a)theta(t-x-a)
-           if( (i>simulation->minus_a_index) && (j-i>=-simulation->minus_a_index) )
-           { 
-               double on_light_cone = (j-i == -simulation->minus_a_index?0.5:1.0);
-               simulation->psi[j][i] += 0.5*simulation->Gamma*bar_average(j-(i-simulation->origin_index)-simulation->nx/2, \
-                                        2*simulation->origin_index-i+1, simulation)*on_light_cone; 
-           }
-    
-           //right light cone No.1: psi(2a-x, t-x+a)theta(x-a)theta(t-x+a)
-           if( (i>simulation->plus_a_index) && (j-i>=-simulation->plus_a_index) )
-           { 
-               double on_light_cone = (j-i == -simulation->plus_a_index?0.5:1.0);
-               simulation->psi[j][i] -= 0.5*simulation->Gamma*bar_average(j-(i-simulation->origin_index)+simulation->nx/2, \
-                                        2*simulation->origin_index-i+simulation->nx+1, simulation)*on_light_cone; 
-           }
-    
-           //right light cone No.2: -psi(-x, t-x+a)theta(x-a)theta(t-x+a)
-           if( (i>simulation->plus_a_index) && (j-i>=-simulation->plus_a_index) )
-           { 
-               double on_light_cone = (j-i == -simulation->plus_a_index?0.5:1.0);
-               simulation->psi[j][i] += 0.5*simulation->Gamma*bar_average(j-(i-simulation->origin_index)+simulation->nx/2, \
-                                        2*simulation->origin_index-i+1, simulation)*on_light_cone; 
-           }
-   
-           //two-photon input: 2*( chi(x-t,-a-t, 0)-chi(x-t,a-t,0) )
-           if( (simulation->init_cond == 1 || simulation->init_cond == 3) \
-	       && j-i>=-simulation->minus_a_index ) //it's nonzero only when t-x-a>=0 
-           { 
-               double on_light_cone = (j-i == -simulation->minus_a_index?0.5:1.0);
-
-               //shift +0.5 due to Taylor expansion at the center of square 
-               simulation->psi[j][i] += sqrt(simulation->Gamma) * on_light_cone \
-                                        * two_photon_input((i-simulation->origin_index)-j, -simulation->nx/2-j+0.5, simulation);
-
-               if(j>simulation->nx)
-               {
-                   simulation->psi[j][i] -= sqrt(simulation->Gamma) * on_light_cone \
-                                            * two_photon_input((i-simulation->origin_index)-j, simulation->nx/2-j+0.5, simulation);
-               }
-           }
-   
-           //prefactor
-           simulation->psi[j][i] /= (1./simulation->Delta+0.25*W);
-       }
+      //chi is obtained from the stored impulse responses instead of a march (see green.h)
+      profiler_begin(simulation->profiler, "green");
+      status = green_solve(simulation, input);
+      profiler_end(simulation->profiler, 0, 0);
    }
-   //printf("Done!\n");
-
-   printf("FDTD: writing results to files...\n");// fflush(stdout);
-//   print_initial_condition(simulation);
-//   print_boundary_condition(simulation);
-//   printf("******************************************\n");
-//   print_psi(simulation);
-//   print_grid(simulation);
-   if(simulation->save_psi)
+   else
    {
-      save_psi(simulation, argv[1], creal);
-      save_psi(simulation, argv[1], cimag);
-      //save_psi(simulation, argv[1], cabs);
+      //save_g2: the rows of g2 are written as they are marched, but richardson replaces psi afterwards (see g2.h)
+      for(int l=0; l<nlanes && !status && simulation->save_g2 && !simulation->richardson; l++)
+      {
+         char * name = output_name(input, l, nlanes);
+         status = (name ? stream_g2(lanes[l], name) : FDTD_ERROR_MEMORY);
+         free(name);
+      }
+
+      //simulation starts
+      profiler_begin(simulation->profiler, "march");
+      if(!status)
+         status = fdtd_step_lanes(lanes, nlanes, fdtd_rows_total(simulation));
+      for(int l=0; l<nlanes && !status; l++)
+         if(lanes[l]->steady_state_row)
+            printf("FDTD: steady state reached at t=%g%s, the remaining rows are extrapolated...\n",
+                   (lanes[l]->steady_state_row-1)*simulation->Delta, (nlanes > 1 ? " in a lane" : ""));
+      //the extrapolated rows cost one multiplication per point and are not counted
+      double points = 0;
+      for(int l=0; l<nlanes; l++)
+         points += marched_points(lanes[l], lanes[l]->steady_state_row ? lanes[l]->steady_state_row : fdtd_rows_done(lanes[l]));
+      profiler_end(simulation->profiler, MARCH_FLOPS_PER_POINT*points, MARCH_BYTES_PER_POINT*points);
+      for(int l=0; l<nlanes && !status; l++)
+         if(lanes[l]->placement)
+            numa_report(lanes[l]);
+
+      //the marches of the refined grids are profiled as phases of their own (see richardson.c)
+      if(!status && simulation->richardson)
+         status = richardson_extrapolate(&lanes[0], input);
+      simulation = lanes[0];
+      //printf("Done!\n");
+
+      if(!status)
+      {
+         printf("FDTD: writing results to files...\n");// fflush(stdout);
+         profiler_begin(simulation->profiler, "output");
+         for(int l=0; l<nlanes && !status; l++)
+         {
+            char * name = output_name(input, l, nlanes);
+            status = (name ? fdtd_save(lanes[l], name) : FDTD_ERROR_MEMORY);
+            free(name);
+         }
+         profiler_end(simulation->profiler, 0, 0);
+         //printf("Done!\n");
+      }
    }
-   if(simulation->save_psi_square_integral) //for testing init_cond=3
-      save_psi_square_integral(simulation, argv[1]); 
-   if(simulation->save_psi_binary)
-      save_psi_binary(simulation, argv[1]);
-   if(simulation->save_chi)
-      save_chi(simulation, argv[1], cabs);
-   if(simulation->measure_NM)
+
+   if(!status && simulation->profiler)
    {
-      printf("FDTD: calculating lambda and mu for NM measures...\n"); fflush(stdout);
-      calculate_NM_measure(simulation, argv[1]);
-      save_e0(simulation, argv[1], creal);
-      save_e0(simulation, argv[1], cimag);
-      save_e1(simulation, argv[1], creal);
-      save_e1(simulation, argv[1], cimag);
+      printf("FDTD: measuring machine peaks for the roofline summary...\n");
+      profiler_calibrate(simulation->profiler);
+      status = save_profile(simulation->profiler, simulation, input);
    }
 
-   //printf("Done!\n");
+   for(int l=0; l<nlanes; l++)
+      fdtd_destroy(lanes[l]);
 
-   free_grid(simulation);
+   if(status)
+   {
+      fprintf(stderr, "FDTD: %s. Abort!\n", fdtd_strerror(status));
+      return EXIT_FAILURE;
+   }
 
    return EXIT_SUCCESS;
 }
+
+
+int main(int argc, char **argv)
+{
+   //watch the live progress of local jobs: ./FDTD --watch [stats_dir [interval]]
+   if(argc >= 2 && strcmp(argv[1], "--watch") == 0)
+      return watch_stats(argc >= 3 ? argv[2] : NULL, argc >= 4 ? strtod(argv[3], NULL) : 1.0);
+
+   //estimate the memory, output sizes and run time without running: ./FDTD --plan input_parameters [budget_in_GB]
+   if(argc >= 3 && strcmp(argv[1], "--plan") == 0)
+   {
+      int status = plan_grid(argv[2], argc >= 4 ? strtod(argv[3], NULL) : 0);
+      if(status)
+         fprintf(stderr, "FDTD: %s. Abort!\n", fdtd_strerror(status));
+      return (status ? EXIT_FAILURE : EXIT_SUCCESS);
+   }
+
+   //run the jobs sent to a Unix-domain socket: ./FDTD --serve socket [budget_in_GB [cache_dir]]
+   if(argc >= 3 && strcmp(argv[1], "--serve") == 0)
+   {
+      int status = serve_jobs(argv[2], argc >= 4 ? strtod(argv[3], NULL) : 0, argc >= 5 ? argv[4] : NULL, run_input);
+      return (status ? EXIT_FAILURE : EXIT_SUCCESS);
+   }
+
+   //submit a job to the server and wait for it: ./FDTD --submit socket input_parameters|--status|--shutdown
+   if(argc == 4 && strcmp(argv[1], "--submit") == 0)
+   {
+      int status;
+      if(strcmp(argv[3], "--status") == 0)
+         status = submit_job(argv[2], "status", NULL);
+      else if(strcmp(argv[3], "--shutdown") == 0)
+         status = submit_job(argv[2], "shutdown", NULL);
+      else
+         status = submit_job(argv[2], "run", argv[3]);
+      return (status ? EXIT_FAILURE : EXIT_SUCCESS);
+   }
+
+   //run every input state and option on small grids: ./FDTD --selftest [dir] (see selftest.h)
+   if(argc <= 3 && argc >= 2 && strcmp(argv[1], "--selftest") == 0)
+      return (run_selftest(argc == 3 ? argv[2] : NULL, run_input) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+   //compare the kernels with the reference kernel on small grids: ./FDTD --validate [kernel ...] (see selftest.h)
+   if(argc >= 2 && strcmp(argv[1], "--validate") == 0)
+      return (run_validation((const char * const *)argv+2, argc-2) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+   if(argc != 2)
+   {
+      fprintf(stderr, "Usage: ./FDTD input_parameters\n");
+      fprintf(stderr, "       ./FDTD --watch [stats_dir [interval]]\n");
+      fprintf(stderr, "       ./FDTD --plan input_parameters [memory_budget_in_GB]\n");
+      fprintf(stderr, "       ./FDTD --serve socket [memory_budget_in_GB [cache_dir]]\n");
+      fprintf(stderr, "       ./FDTD --submit socket input_parameters|--status|--shutdown\n");
+      fprintf(stderr, "       ./FDTD --selftest [dir]\n");
+      fprintf(stderr, "       ./FDTD --validate [kernel ...]\n");
+      exit(EXIT_FAILURE);
+   }
+   
+   printf("FDTD: solving 1+1D delay PDE\n");
+   printf("This code is released under the WTFPL without any warranty.\n");
+   printf("See LICENSE or http://www.wtfpl.net/ for more details.\n");
+   printf("Copyright (C) 2016 Leo Fang\n\n");
+   //printf("For the academic uses, citation to (ref) is strongly encouraged but not required.\n");
+   
+   return run_input(argv[1]);
+}
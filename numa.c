@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#define _GNU_SOURCE //cpu_set_t and sched_setaffinity
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "numa.h"
+#include "profiler.h"
+
+
+//the CPUs of a list such as "0-3,8-11" that are in allowed; returns their number
+static int parse_cpulist(const char * list, const cpu_set_t * allowed, int * cpus, int max)
+{
+   int n = 0;
+   while(*list && *list != '\n')
+   {
+      char * end;
+      int first = strtol(list, &end, 10), last = first;
+      if(end == list)
+         break;
+      if(*end == '-')
+      {
+         list = end+1;
+         last = strtol(list, &end, 10);
+      }
+      for(int cpu=first; cpu<=last && n<max; cpu++)
+         if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, allowed))
+            cpus[n++] = cpu;
+      list = (*end == ',' ? end+1 : end);
+   }
+   return n;
+}
+
+
+static int add_node(numa * placement, const int * cpus, int ncpus)
+{
+   int * copy = malloc(ncpus*sizeof(*copy));
+   if(!copy)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+   memcpy(copy, cpus, ncpus*sizeof(*copy));
+   placement->cpus[placement->nnodes] = copy;
+   placement->ncpus[placement->nnodes] = ncpus;
+   placement->nnodes++;
+   return FDTD_SUCCESS;
+}
+
+
+int create_numa(grid * simulation)
+{
+   numa * placement = calloc(1, sizeof(*placement));
+   if(!placement)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+   simulation->placement = placement;
+
+   cpu_set_t allowed;
+   CPU_ZERO(&allowed);
+   if(sched_getaffinity(0, sizeof(allowed), &allowed))
+      CPU_SET(0, &allowed);
+
+   //the nodes with CPUs that the process may use (nodes of memory only are skipped)
+   int cpus[CPU_SETSIZE], status = FDTD_SUCCESS;
+   for(int node=0; node<NUMA_MAX_NODES && !status; node++)
+   {
+      char path[64], list[4096];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+      FILE * f = fopen(path, "r");
+      if(!f)
+         continue;
+      int ncpus = (fgets(list, sizeof(list), f) ? parse_cpulist(list, &allowed, cpus, CPU_SETSIZE) : 0);
+      fclose(f);
+      if(ncpus)
+         status = add_node(placement, cpus, ncpus);
+   }
+   if(!status && placement->nnodes == 0) //no topology: one node of all allowed CPUs
+   {
+      int ncpus = 0;
+      for(int cpu=0; cpu<CPU_SETSIZE; cpu++)
+         if(CPU_ISSET(cpu, &allowed))
+            cpus[ncpus++] = cpu;
+      status = add_node(placement, cpus, ncpus);
+   }
+   if(status)
+      return status;
+
+   //stripes at least nx columns wide (the light cones read nx-1 columns into the next one),
+   //and of whole pages unless the rows are shorter than a page per thread
+   int page = sysconf(_SC_PAGESIZE)/sizeof(double complex);
+   page = (page > 0 ? page : 256);
+   int width = (simulation->Ntotal+simulation->threads-1)/simulation->threads;
+   width = (width > simulation->nx ? width : simulation->nx);
+   if(width >= page)
+      width = (width+page-1)/page*page;
+   placement->nstripes = (simulation->Ntotal+width-1)/width;
+   if(placement->nstripes < simulation->threads)
+      fprintf(stderr, "%s: Warning: the grid only has room for %d stripes, so numa=1 uses %d threads.\n",
+              __func__, placement->nstripes, placement->nstripes);
+   for(int n=0; n<=placement->nstripes; n++)
+      placement->stripe[n] = (n*width < simulation->Ntotal ? n*width : simulation->Ntotal);
+
+   //the stripes are spread over the nodes in order, and over the CPUs of each node
+   for(int n=0, first=0; n<placement->nstripes; n++)
+   {
+      int node = n*placement->nnodes/placement->nstripes;
+      if(n > 0 && node != placement->node[n-1])
+         first = n;
+      placement->node[n] = node;
+      placement->cpu[n] = placement->cpus[node][(n-first) % placement->ncpus[node]];
+   }
+
+   placement->row_bytes = (simulation->Ntotal*sizeof(double complex)+page*sizeof(double complex)-1) \
+                          /(page*sizeof(double complex))*(page*sizeof(double complex));
+   return FDTD_SUCCESS;
+}
+
+
+void free_numa(numa * placement)
+{
+   if(!placement)
+      return;
+   for(int node=0; node<placement->nnodes; node++)
+      free(placement->cpus[node]);
+   free(placement);
+}
+
+
+int numa_pin(const numa * placement, int n)
+{
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   CPU_SET(placement->cpu[n], &set);
+   return sched_setaffinity(0, sizeof(set), &set); //0: the calling thread
+}
+
+
+struct first_touch
+{
+   grid * simulation;
+   int n; //the stripe
+};
+
+
+//write zeros into stripe n of every row, from a thread on its CPU, so that its pages are placed on that node
+static void * touch_stripe(void * data)
+{
+   struct first_touch * touch = data;
+   grid * simulation = touch->simulation;
+   const numa * placement = simulation->placement;
+   int n = touch->n;
+
+   if(numa_pin(placement, n))
+      fprintf(stderr, "%s: Warning: cannot pin the thread of stripe %d to CPU %d.\n", __func__, n, placement->cpu[n]);
+
+   //the last stripe also owns the padding of the last page
+   size_t first = placement->stripe[n]*sizeof(double complex);
+   size_t last = (n == placement->nstripes-1 ? placement->row_bytes : placement->stripe[n+1]*sizeof(double complex));
+   for(int j=0; j<simulation->Ny; j++)
+      memset((char *)simulation->psi[j]+first, 0, last-first);
+   return NULL;
+}
+
+
+int numa_allocate_psi(grid * simulation)
+{
+   numa * placement = simulation->placement;
+   simulation->psi = calloc(simulation->Ny, sizeof(*simulation->psi));
+   if(!simulation->psi)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+
+   //the pages of a fresh mapping are not placed until they are first written
+   for(int j=0; j<simulation->Ny; j++)
+   {
+      void * row = mmap(NULL, placement->row_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      if(row == MAP_FAILED)
+      {
+         fprintf(stderr, "%s: cannot allocate memory at t=%d*Delta. Abort!\n", __func__, j);
+         return FDTD_ERROR_MEMORY;
+      }
+      simulation->psi[j] = row;
+   }
+
+   //if a thread cannot be started, its stripe is written here (and placed on this node)
+   pthread_t thread[FDTD_MAX_THREADS];
+   struct first_touch touch[FDTD_MAX_THREADS];
+   int started[FDTD_MAX_THREADS];
+   for(int n=0; n<placement->nstripes; n++)
+   {
+      touch[n].simulation = simulation;
+      touch[n].n = n;
+      started[n] = (pthread_create(&thread[n], NULL, touch_stripe, &touch[n]) == 0);
+   }
+   for(int n=0; n<placement->nstripes; n++)
+   {
+      if(started[n])
+         pthread_join(thread[n], NULL);
+      else
+      {
+         fprintf(stderr, "%s: Warning: cannot start the thread of stripe %d, its pages are placed on the node of the main thread.\n", __func__, n);
+         size_t first = placement->stripe[n]*sizeof(double complex);
+         size_t last = (n == placement->nstripes-1 ? placement->row_bytes : placement->stripe[n+1]*sizeof(double complex));
+         for(int j=0; j<simulation->Ny; j++)
+            memset((char *)simulation->psi[j]+first, 0, last-first);
+      }
+   }
+   return FDTD_SUCCESS;
+}
+
+
+void numa_free_psi(grid * simulation)
+{
+   for(int j=0; j<simulation->Ny; j++)
+      if(simulation->psi[j])
+         munmap(simulation->psi[j], simulation->placement->row_bytes);
+   free(simulation->psi);
+}
+
+
+void numa_report(const grid * simulation)
+{
+   const numa * placement = simulation->placement;
+   for(int node=0; node<placement->nnodes; node++)
+   {
+      int threads = 0;
+      double points = 0, elapsed = 0, busy = 0, waiting = 0;
+      char cpus[256] = "";
+      for(int n=0; n<placement->nstripes; n++)
+      {
+         if(placement->node[n] != node)
+            continue;
+         threads++;
+         points += placement->points[n];
+         busy += placement->busy[n];
+         waiting += placement->waiting[n];
+         //the threads of a node run side by side
+         if(placement->busy[n]+placement->waiting[n] > elapsed)
+            elapsed = placement->busy[n]+placement->waiting[n];
+         size_t len = strlen(cpus);
+         snprintf(cpus+len, sizeof(cpus)-len, "%s%d", (len ? "," : ""), placement->cpu[n]);
+      }
+      if(!threads)
+         continue;
+      printf("FDTD: NUMA node %d: %d thread%s on CPU %s, %.3g points, %.3g GB/s (model), %.0f%% of the time waiting\n",
+             node, threads, (threads > 1 ? "s" : ""), cpus, points,
+             (elapsed > 0 ? MARCH_BYTES_PER_POINT*points/elapsed/1e9 : 0.), (busy+waiting > 0 ? 100*waiting/(busy+waiting) : 0.));
+   }
+}
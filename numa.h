@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include "grid.h"
+
+/*
+   NUMA-aware placement of psi and of the threads (scheme=2, numa=1).
+
+   Linux places a page on the node of the thread that first writes it, so the
+   rows of psi that initialize_psi zeroes all land on the node of the main
+   thread, and every thread on another node then reaches them through the
+   interconnect. With numa=1 the columns of psi are split into one stripe per
+   thread instead (whole pages of every row, unless the rows are shorter than a
+   page per thread, and at least nx columns wide), and each thread owns its
+   stripe in all rows: it is pinned to a CPU of its node, and it first writes
+   the stripe when the grid is set up, so that those pages are placed on that
+   node. The march then advances the stripes as a pipeline, each thread row by
+   row through its own columns, so that all writes and most reads (the row
+   below and the delay term) stay on the node; only the light cones, which
+   mirror psi around the qubit, and the edges of the stripes are read from
+   other nodes (see solver.c).
+
+   The topology is read from /sys/devices/system/node (the CPUs of each node,
+   restricted to those the process may run on); without it, or on a single
+   node, the stripes are still placed and pinned the same way. The threads are
+   spread over the nodes in order, so that neighbouring stripes share a node.
+   No library beyond the system calls is needed.
+
+   After the march, numa_report prints for each node its threads, the points
+   they marched, the modelled bandwidth (MARCH_BYTES_PER_POINT per point, see
+   profiler.h) over the time they spent marching, and the share of the time
+   they spent waiting for their neighbours.
+*/
+
+#define NUMA_MAX_NODES 64
+
+struct _numa
+{
+   int nnodes;
+   int * cpus[NUMA_MAX_NODES];  //the CPUs of each node that the process may use
+   int ncpus[NUMA_MAX_NODES];
+   int nstripes;                //one per thread
+   int stripe[FDTD_MAX_THREADS+1]; //stripe n covers the columns [stripe[n], stripe[n+1])
+   int node[FDTD_MAX_THREADS];  //the node of stripe n
+   int cpu[FDTD_MAX_THREADS];   //the CPU that the thread of stripe n is pinned to
+   size_t row_bytes;            //the rows of psi are mapped separately, page-aligned
+   //per stripe, accumulated over the march (each is written by its own thread only)
+   double points[FDTD_MAX_THREADS];
+   double busy[FDTD_MAX_THREADS], waiting[FDTD_MAX_THREADS]; //seconds
+};
+typedef struct _numa numa;
+
+//read the topology and lay out the stripes of the grid (simulation->placement)
+int create_numa(grid * simulation);
+void free_numa(numa * placement);
+
+//allocate the rows of psi, each first written by the thread of its stripes
+int numa_allocate_psi(grid * simulation);
+void numa_free_psi(grid * simulation);
+
+//pin the calling thread to the CPU of stripe n; returns 0 on success
+int numa_pin(const numa * placement, int n);
+
+//print the per-node summary of the march
+void numa_report(const grid * simulation);
+
+#endif
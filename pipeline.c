@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "pipeline.h"
+#include "dynamics.h"
+#include "NM_measure.h"
+#include "cache.h"
+
+
+//the tables of row j and its strip, as prepare_qubit_wavefunction and boundary_condition compute them
+static int prepare_row(grid * simulation, const pipeline * setup, int j)
+{
+   const grid * coarser = setup->coarser;
+   int copy = (coarser && j%2 == 0);
+
+   if(simulation->init_cond == 1)
+   {
+      if(j >= setup->cached_pw)
+         setup->plane_wave[j] = plane_wave_e(j, simulation);
+   }
+   else
+   {
+      if(simulation->identical_photons && j >= setup->cached_e0)
+      {
+         simulation->e0[j] = (copy ? coarser->e0[j/2] : e0(j, simulation));
+         if(isnan(cabs(simulation->e0[j])))
+            return FDTD_ERROR_NUMERIC;
+      }
+      if(!simulation->identical_photons && j >= (setup->cached_e0_1 < setup->cached_e0_2 ? setup->cached_e0_1 : setup->cached_e0_2))
+      {
+         simulation->e0_1[j] = (copy ? coarser->e0_1[j/2] : e0_photon(j, simulation->k1, simulation->alpha1, simulation));
+         simulation->e0_2[j] = (copy ? coarser->e0_2[j/2] : e0_photon(j, simulation->k2, simulation->alpha2, simulation));
+         if(isnan(cabs(simulation->e0_1[j])) || isnan(cabs(simulation->e0_2[j])))
+            return FDTD_ERROR_NUMERIC;
+      }
+      if(j >= setup->cached_e1)
+      {
+         simulation->e1[j] = (copy ? coarser->e1[j/2] : e1(j, simulation));
+         if(isnan(cabs(simulation->e1[j])))
+            return FDTD_ERROR_NUMERIC;
+      }
+   }
+
+   for(int i=0; i<=simulation->nx; i++)
+   {
+      double complex * psi = &simulation->psi[j][i];
+      switch(simulation->init_cond)
+      {
+         case 1: *psi = plane_wave_BC_from_e(setup->plane_wave[j], j, i, simulation); break;
+         case 2: *psi = exponential_BC(j, i, simulation); break;
+         case 3: *psi = two_exponential_BC(j, i, simulation); break;
+      }
+      if(simulation->init_cond == 1 && isnan(cabs(*psi)))
+         return FDTD_ERROR_NUMERIC;
+
+      // in envelope mode the carrier is factored out
+      if(simulation->envelope)
+         *psi /= carrier(j, i, simulation);
+   }
+   return FDTD_SUCCESS;
+}
+
+
+static void * prepare_rows(void * data)
+{
+   grid * simulation = data;
+   pipeline * setup = simulation->setup;
+   for(;;)
+   {
+      if(__atomic_load_n(&setup->status, __ATOMIC_ACQUIRE) || __atomic_load_n(&setup->stop, __ATOMIC_ACQUIRE))
+         break;
+      int j = __atomic_fetch_add(&setup->next, 1, __ATOMIC_SEQ_CST);
+      if(j >= simulation->Ny)
+         break;
+      int status = prepare_row(simulation, setup, j);
+      if(status)
+      {
+         fprintf(stderr, "%s: NaN is produced in the set-up of row j=%i. Abort!\n", __func__, j);
+         __atomic_store_n(&setup->status, status, __ATOMIC_RELEASE);
+         break;
+      }
+      __atomic_store_n(&setup->ready[j], 1, __ATOMIC_RELEASE);
+   }
+   return NULL;
+}
+
+
+static double complex * allocate_table(int Ny)
+{
+   double complex * table = calloc(Ny, sizeof(*table));
+   if(!table)
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+   return table;
+}
+
+
+int start_pipeline(grid * simulation)
+{
+   pipeline * setup = calloc(1, sizeof(*setup));
+   if(!setup)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+   simulation->setup = setup;
+   setup->coarser = simulation->coarser;
+
+   setup->ready = calloc(simulation->Ny, sizeof(*setup->ready));
+   if(!setup->ready)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+
+   //the tables that initialize_e0 and initialize_e1 (or boundary_condition) would fill, with the rows the cache holds
+   if(simulation->init_cond == 1)
+   {
+      if(!(setup->plane_wave = allocate_table(simulation->Ny)))
+         return FDTD_ERROR_MEMORY;
+      setup->cached_pw = cache_load_table(simulation, "pw", simulation->k, 0, setup->plane_wave);
+   }
+   else
+   {
+      if(simulation->identical_photons)
+      {
+         if(!(simulation->e0 = allocate_table(simulation->Ny)))
+            return FDTD_ERROR_MEMORY;
+         setup->cached_e0 = cache_load_table(simulation, "e0", simulation->k, simulation->alpha, simulation->e0);
+      }
+      else
+      {
+         if(!(simulation->e0_1 = allocate_table(simulation->Ny)) || !(simulation->e0_2 = allocate_table(simulation->Ny)))
+            return FDTD_ERROR_MEMORY;
+         setup->cached_e0_1 = cache_load_table(simulation, "e0", simulation->k1, simulation->alpha1, simulation->e0_1);
+         setup->cached_e0_2 = cache_load_table(simulation, "e0", simulation->k2, simulation->alpha2, simulation->e0_2);
+      }
+      if(!(simulation->e1 = allocate_table(simulation->Ny)))
+         return FDTD_ERROR_MEMORY;
+      setup->cached_e1 = cache_load_table(simulation, "e1", 0, 0, simulation->e1);
+   }
+
+   //if a thread cannot be started, the others prepare its rows; if none can, the set-up is done here
+   for(int t=0; t<simulation->pipeline; t++)
+   {
+      if(pthread_create(&setup->thread[setup->nthreads], NULL, prepare_rows, simulation) != 0)
+      {
+         fprintf(stderr, "%s: Warning: cannot start thread %d, the set-up continues with %d threads.\n", __func__, t, setup->nthreads);
+         break;
+      }
+      setup->nthreads++;
+   }
+   if(setup->nthreads == 0)
+      prepare_rows(simulation);
+
+   return FDTD_SUCCESS;
+}
+
+
+int pipeline_wait(grid * simulation, int rows)
+{
+   pipeline * setup = simulation->setup;
+   if(!setup)
+      return FDTD_SUCCESS;
+
+   for(; setup->waited < rows; setup->waited++)
+      while(!__atomic_load_n(&setup->ready[setup->waited], __ATOMIC_ACQUIRE))
+      {
+         int status = __atomic_load_n(&setup->status, __ATOMIC_ACQUIRE);
+         if(status)
+            return status;
+         sched_yield();
+      }
+   return FDTD_SUCCESS;
+}
+
+
+static void join_pipeline(grid * simulation)
+{
+   pipeline * setup = simulation->setup;
+   for(int t=0; t<setup->nthreads; t++)
+      pthread_join(setup->thread[t], NULL);
+   setup->nthreads = 0;
+}
+
+
+int finish_pipeline(grid * simulation)
+{
+   pipeline * setup = simulation->setup;
+   if(!setup)
+      return FDTD_SUCCESS;
+
+   join_pipeline(simulation);
+   int status = setup->status;
+
+   //the cache is not used by a refined grid (see cache.h)
+   if(!status && !setup->coarser)
+   {
+      if(simulation->init_cond == 1)
+         cache_store_table(simulation, "pw", simulation->k, 0, setup->plane_wave, setup->cached_pw);
+      else
+      {
+         if(simulation->identical_photons)
+            cache_store_table(simulation, "e0", simulation->k, simulation->alpha, simulation->e0, setup->cached_e0);
+         else
+         {
+            cache_store_table(simulation, "e0", simulation->k1, simulation->alpha1, simulation->e0_1, setup->cached_e0_1);
+            cache_store_table(simulation, "e0", simulation->k2, simulation->alpha2, simulation->e0_2, setup->cached_e0_2);
+         }
+         cache_store_table(simulation, "e1", 0, 0, simulation->e1, setup->cached_e1);
+      }
+   }
+
+   free_pipeline(simulation);
+   return status;
+}
+
+
+void free_pipeline(grid * simulation)
+{
+   pipeline * setup = simulation->setup;
+   if(!setup)
+      return;
+
+   __atomic_store_n(&setup->stop, 1, __ATOMIC_RELEASE);
+   join_pipeline(simulation);
+   free(setup->plane_wave);
+   free(setup->ready);
+   free(setup);
+   simulation->setup = NULL;
+}
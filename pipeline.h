@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <pthread.h>
+#include "grid.h"
+
+/*
+   Pipelined set-up (pipeline=P, init_cond=1 to 3).
+
+   Besides the rows below it, the march of row j only reads the boundary strip
+   of row j (psi[j][0..nx], x<-a), and the strip of row j only needs the qubit
+   factor of row j: the plane-wave factor (init_cond=1), e1[j] (init_cond=2) or
+   e0[j] (init_cond=3). Neither the march nor the strip reads the tables
+   ahead of the row. So instead of filling the qubit tables and the strip for
+   all Ny rows before the march, with pipeline=P the grid is handed over as
+   soon as psi is allocated, while P threads prepare the rows in order: each
+   takes the next row from a shared counter, computes e0[j] and e1[j] (which
+   the outputs still need), writes the strip straight into psi[j] (psix0 is
+   not allocated), and sets the ready flag of the row with release ordering.
+   fdtd_step waits on the flags of the rows it is about to march, so the
+   march starts after the first row, and the run takes about the longer of
+   the set-up and the march rather than their sum.
+
+   The threads are joined by finish_pipeline, which fdtd_step calls after the
+   last row, and the outputs and the accessors of the tables before they are
+   read; the tables are stored in the cache there (see cache.h). A thread that
+   produces NaN stops the others, and the march returns the error when it
+   reaches that row. The values are those of the sequential set-up, bit for bit.
+
+   A tabulated wavepacket (init_cond=4 and 5) needs the whole strip to find
+   the window of the march, and green=1 reads it before marching, so neither
+   is pipelined.
+*/
+
+struct _pipeline
+{
+   const grid * coarser;        //the tables of the even rows are copied from it (richardson)
+   double complex * plane_wave; //init_cond=1: the qubit factor of each row
+   int cached_e0, cached_e0_1, cached_e0_2, cached_e1, cached_pw; //rows read from the cache
+   int next;                    //the next row to be prepared
+   int status;                  //set by a thread that fails; the others stop
+   int stop;                    //set by free_pipeline
+   char * ready;                //per row, written with release ordering
+   int waited;                  //rows [0, waited) are known to be ready (read by the march only)
+   int nthreads;
+   pthread_t thread[FDTD_MAX_THREADS];
+};
+typedef struct _pipeline pipeline;
+
+//allocate the qubit tables, read what the cache holds and start the threads (simulation->setup)
+int start_pipeline(grid * simulation);
+
+//wait until the rows [0, rows) are ready; returns the error of a thread that failed on one of them
+int pipeline_wait(grid * simulation, int rows);
+
+//wait for all rows, join the threads and store the tables in the cache (nothing to do if not pipelined)
+int finish_pipeline(grid * simulation);
+
+//stop and join the threads without waiting for the remaining rows (free_grid)
+void free_pipeline(grid * simulation);
+
+#endif
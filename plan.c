@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "plan.h"
+#include "fdtd.h"
+#include "solver.h"
+#include "profiler.h"
+#include "g2.h"
+
+#define PLAN_MB (1024.*1024.)
+#define PLAN_TEXT_BYTES  12 //a number in the text outputs ("%.5g ")
+#define PLAN_TABLE_BYTES 17 //a number in the one-column outputs ("%.10g\n")
+
+//the phases of a run, in the order in which they are reported
+enum {PLAN_QUBIT, PLAN_INITIAL, PLAN_BOUNDARY, PLAN_PSI, PLAN_MARCH, PLAN_OUTPUT, PLAN_PHASES};
+static const char * phase_names[PLAN_PHASES] =
+   {"prepare_qubit_wavefunction", "initial_condition", "boundary_condition", "initialize_psi", "march", "output"};
+
+
+static double wall_time(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+//number of items of a comma-separated list (0 if not given)
+static int list_length(const char * list)
+{
+   if(!list)
+      return 0;
+   int length = 1;
+   for(const char * p=list; (p=strchr(p, ',')); p++)
+      length++;
+   return length;
+}
+
+
+//terms summed by the qubit tables and the plane-wave boundary for Ny rows (one per round trip of the delay)
+static double delay_sums(int Ny, int nx)
+{
+   return Ny + 0.5*(double)Ny*Ny/nx;
+}
+
+
+//resident memory (bytes) at the end of each phase of one grid of the given size
+static void grid_memory(const grid * simulation, int nx, int Nx, int Ny, double memory[PLAN_PHASES])
+{
+   int Ntotal = 2*Nx+nx+2;
+   int Tmax = (Ny-1 < Nx-nx/2 ? Ny-1 : Nx-nx/2);
+
+   //e0, e1 (and e0 of each photon if they differ), and the tabulated wavepacket with its norm
+   int init_cond = simulation->init_cond;
+   int tables = (init_cond >= 2 ? 1 + (init_cond != 4) : 0) + (init_cond == 3 && !simulation->identical_photons ? 2 : 0);
+   double qubit = 16.*tables*Ny;
+   if(init_cond == 4 || init_cond == 5)
+   {
+      struct stat file;
+      const char * name = givenValue(simulation->parameters_key_value_pair, "wavepacket_file");
+      if(name && stat(name, &file) == 0)
+         qubit += file.st_size/16 * (16.+8.);
+   }
+
+   double psit0 = 16.*(2*Nx+1);
+   double psix0 = (simulation->pipeline ? 0 : Ny*(16.*(nx+1)+8.)); //the pipelined set-up writes the strip into psi
+   double psi   = Ny*(16.*Ntotal+8.) + (simulation->scheme == 2 && simulation->diagonal_copy && !simulation->reference ? 4*16.*Ny : 0)
+                 + (simulation->tile_rows > 1 ? 4.*Ny : 0);
+   double NM    = (simulation->measure_NM ? (16.+8.)*Tmax : 0);
+   double chi   = (simulation->save_chi ? 16.*(Nx-nx/2+1) : 0) + (simulation->save_g2 ? (16.+4.)*(Nx-nx/2+1) : 0);
+
+   memory[PLAN_QUBIT]    = qubit;
+   memory[PLAN_INITIAL]  = qubit + psit0;
+   memory[PLAN_BOUNDARY] = qubit + psit0 + psix0;
+   memory[PLAN_PSI]      = qubit + psit0 + psix0 + psi;
+   memory[PLAN_MARCH]    = qubit + psi; //the initial row and the strip are freed once copied into psi
+   memory[PLAN_OUTPUT]   = qubit + psi + NM + chi;
+}
+
+
+//seconds per byte of the text outputs, from fprintf into /dev/null
+static double text_seconds_per_byte(void)
+{
+   FILE * f = fopen("/dev/null", "w");
+   if(!f)
+      return 0;
+   double start = wall_time();
+   long bytes = 0;
+   for(int n=0; n<200000; n++)
+      bytes += fprintf(f, "%.5g ", 1e-3*sin(n));
+   double seconds = wall_time() - start;
+   fclose(f);
+   return (bytes > 0 ? seconds/bytes : 0);
+}
+
+
+//time the set-up and the march on a small grid with the same nx, Delta, physics and scheme
+static int calibrate(kvarray_t * parameters, const grid * simulation, grid ** small, double seconds[PLAN_PHASES])
+{
+   *small = NULL;
+   kvarray_t * copy = copyKVs(parameters);
+   if(!copy)
+      return FDTD_ERROR_MEMORY;
+
+   int nx = simulation->nx;
+   int Nx = (simulation->Nx < (nx > 400 ? nx : 400) ? simulation->Nx : (nx > 400 ? nx : 400));
+   int Ny = (simulation->Ny < (4*nx+2 > 800 ? 4*nx+2 : 800) ? simulation->Ny : (4*nx+2 > 800 ? 4*nx+2 : 800));
+
+   //a plain march of this size (the output window, refinements and steady state are left out)
+   char value[32];
+   int status = 0;
+   snprintf(value, sizeof(value), "%d", Nx); status |= addKV(copy, "Nx", value);
+   snprintf(value, sizeof(value), "%d", Ny); status |= addKV(copy, "Ny", value);
+   const char * off[] = {"t_max", "tau_max", "x_max", "strict_grid", "richardson", "richardson_tol", "green", "steady_state_tol", "pipeline"};
+   for(size_t n=0; n<sizeof(off)/sizeof(*off); n++)
+      status |= addKV(copy, off[n], "0");
+   status |= addKV(copy, "cache_dir", "none"); //the tables must be computed to be timed
+   status |= addKV(copy, "profile", "1");
+   if(simulation->green) //green runs have no other output, which the sanity check asks for
+      status |= addKV(copy, "save_chi", "1");
+   if(status)
+   {
+      freeKVs(copy);
+      return FDTD_ERROR_MEMORY;
+   }
+
+   status = initialize_grid_from_kv(copy, "plan", small);
+   if(status)
+      return status;
+
+   profiler_begin((*small)->profiler, "march");
+   status = fdtd_step(*small, Ny);
+   profiler_end((*small)->profiler, 0, 0);
+
+   for(int p=0; p<PLAN_OUTPUT; p++)
+   {
+      seconds[p] = 0;
+      for(int n=0; n<(*small)->profiler->nphases; n++)
+         if(strcmp((*small)->profiler->phases[n].name, phase_names[p]) == 0)
+            seconds[p] += (*small)->profiler->phases[n].seconds;
+   }
+   return status;
+}
+
+
+//print one output file and return its size in bytes
+static double output_file(const char * filename, const char * suffix, double bytes, int nlanes)
+{
+   if(nlanes > 1)
+      printf("   %s.lane*%-24s %12.1f MB each\n", filename, suffix, bytes/PLAN_MB);
+   else
+      printf("   %s%-30s %12.1f MB\n", filename, suffix, bytes/PLAN_MB);
+   return bytes;
+}
+
+
+//read the input file and set up the grid parameters as initialize_grid does, but allocate nothing;
+//lanes are planned with the first item of each lane_* list, and *copy keeps the parameters for calibrate
+static int plan_parameters(const char * filename, kvarray_t ** copy, grid ** simulation, int * nlanes)
+{
+   *copy = NULL;
+   kvarray_t * parameters = readKVs(filename);
+   if(!parameters)
+   {
+      fprintf(stderr, "%s: cannot read the input file %s. Abort!\n", __func__, filename);
+      return FDTD_ERROR_FILE;
+   }
+
+   *nlanes = 1;
+   int status = 0;
+   for(size_t n=0; n<parameters->kvpair_len; n++)
+   {
+      const char * key = parameters->kvpair[n]->key;
+      if(strncmp(key, "lane_", 5) != 0)
+         continue;
+      int length = list_length(parameters->kvpair[n]->value);
+      *nlanes = (length > *nlanes ? length : *nlanes);
+      char item[256];
+      size_t size = strcspn(parameters->kvpair[n]->value, ",");
+      size = (size < sizeof(item) ? size : sizeof(item)-1);
+      memcpy(item, parameters->kvpair[n]->value, size);
+      item[size] = '\0';
+      if(!givenValue(parameters, key+5))
+         status |= addKV(parameters, key+5, item);
+   }
+   *copy = copyKVs(parameters);
+   if(status || !*copy)
+   {
+      freeKVs(parameters);
+      freeKVs(*copy);
+      *copy = NULL;
+      return FDTD_ERROR_MEMORY;
+   }
+
+   status = initialize_grid_parameters(parameters, simulation);
+   if(status)
+   {
+      freeKVs(*copy);
+      *copy = NULL;
+   }
+   return status;
+}
+
+
+//number of tau of the green function (see green.h)
+static int green_taus(const grid * simulation)
+{
+   if(!simulation->green)
+      return 0;
+   int taus = list_length(givenValue(simulation->parameters_key_value_pair, "green_tau"));
+   return (taus == 0 ? 1 : taus);
+}
+
+
+//the impulse responses on the stored columns (see green.h)
+static double green_memory(const grid * simulation)
+{
+   if(!simulation->green)
+      return 0;
+   int N;
+   for(N=1; N<2*(simulation->Ny-1); N<<=1);
+   return 16.*4*green_taus(simulation)*((double)(simulation->minus_a_index+1)*(simulation->Ny-1) + (double)(simulation->nx+1)*N);
+}
+
+
+//peak resident memory of the run, with the memory at the end of each phase if print is set
+static double peak_memory(const grid * simulation, int nlanes, int print)
+{
+   //the lanes are created one after the other, and all of them are kept for the march
+   double memory[PLAN_PHASES], peak = 0;
+   grid_memory(simulation, simulation->nx, simulation->Nx, simulation->Ny, memory);
+   double lanes_before = (nlanes-1)*memory[PLAN_MARCH];
+   if(print)
+      printf("\n   resident memory at the end of each phase:\n");
+   for(int p=0; p<PLAN_PHASES; p++)
+   {
+      double bytes = (p < PLAN_MARCH ? lanes_before + memory[p] : nlanes*memory[p]);
+      if(print)
+         printf("   %-34s %12.1f MB\n", phase_names[p], bytes/PLAN_MB);
+      peak = (bytes > peak ? bytes : peak);
+   }
+   if(simulation->richardson)
+   {
+      //the fine grid is set up and marched next to the coarse one
+      double fine[PLAN_PHASES];
+      grid_memory(simulation, 2*simulation->nx, 2*simulation->Nx, 2*simulation->Ny-1, fine);
+      double bytes = memory[PLAN_MARCH] + fine[PLAN_PSI];
+      if(print)
+         printf("   %-34s %12.1f MB (x4 for each further halving with richardson_tol)\n", "richardson (grid at Delta/2)", bytes/PLAN_MB);
+      peak = (bytes > peak ? bytes : peak);
+   }
+   if(simulation->green)
+   {
+      double bytes = memory[PLAN_MARCH] + green_memory(simulation);
+      if(print)
+         printf("   %-34s %12.1f MB\n", "green", bytes/PLAN_MB);
+      peak = (bytes > peak ? bytes : peak);
+   }
+   if(print)
+      printf("   %-34s %12.1f MB\n", "peak", peak/PLAN_MB);
+   return peak;
+}
+
+
+int plan_memory(const char * filename, double * bytes)
+{
+   kvarray_t * copy;
+   grid * simulation;
+   int nlanes;
+   int status = plan_parameters(filename, &copy, &simulation, &nlanes);
+   if(status)
+      return status;
+   *bytes = peak_memory(simulation, nlanes, 0);
+   free_grid(simulation);
+   freeKVs(copy);
+   return FDTD_SUCCESS;
+}
+
+
+int plan_grid(const char * filename, double budget)
+{
+   kvarray_t * copy;
+   grid * simulation;
+   int nlanes;
+   int status = plan_parameters(filename, &copy, &simulation, &nlanes);
+   if(status)
+      return status;
+   int nx = simulation->nx, Nx = simulation->Nx, Ny = simulation->Ny, Ntotal = simulation->Ntotal;
+   int Tmax = (Ny-1 < Nx-nx/2 ? Ny-1 : Nx-nx/2);
+
+   printf("FDTD: plan for %s (nothing is allocated)\n", filename);
+   printf("   grid: nx=%d, Nx=%d, Ny=%d (%d points per row), scheme=%d", nx, Nx, Ny, Ntotal, simulation->scheme);
+   if(nlanes > 1)
+      printf(", %d lanes", nlanes);
+   printf("\n");
+
+   double memory[PLAN_PHASES];
+   grid_memory(simulation, nx, Nx, Ny, memory);
+   double peak = peak_memory(simulation, nlanes, 1);
+   double green_bytes = green_memory(simulation);
+
+   //outputs (one set per lane)
+   int rows_psi = (Ny+simulation->Tstep)/(simulation->Tstep+1);
+   int rows_chi = Ny/(simulation->Tstep+1)+1;
+   double text_bytes = 0, largest = 0, files = 0;
+   const char * largest_name = NULL;
+   printf("\n   output files (text at about %d bytes per number):\n", PLAN_TEXT_BYTES);
+   //text: written with fprintf; Tstep: thinned out by Tstep
+   struct { int on; const char * suffix; double bytes; int text, Tstep; } outputs[] =
+   {
+      {simulation->save_psi, ".re.out", (double)rows_psi*Ntotal*PLAN_TEXT_BYTES, 1, 1},
+      {simulation->save_psi, ".im.out", (double)rows_psi*Ntotal*PLAN_TEXT_BYTES, 1, 1},
+      {simulation->save_psi_binary, ".bin", (double)rows_psi*(Ntotal-simulation->minus_a_index)*16, 0, 1},
+      {simulation->save_chi, ".abs_chi.out", (double)rows_chi*(Nx-nx/2+1)*PLAN_TEXT_BYTES, 1, 1},
+      {simulation->save_g2, ".g2.bin", sizeof(struct g2_header) + (double)rows_chi*(Nx-nx/2+1)*4, 0, 1},
+      {simulation->save_psi_square_integral, ".psi_square.out", (double)Tmax*PLAN_TABLE_BYTES, 1, 0},
+      {simulation->measure_NM, ".{re,im}_e0.out", 2.*Ny*PLAN_TABLE_BYTES, 1, 0},
+      {simulation->measure_NM, ".{re,im}_e1.out", 2.*Ny*PLAN_TABLE_BYTES, 1, 0},
+      {simulation->measure_NM, ".{re,im}_mu.out, .lambda.out", 3.*Tmax*PLAN_TABLE_BYTES, 1, 0},
+      {simulation->green, ".green.abs_chi.out", (double)rows_chi*green_taus(simulation)*PLAN_TEXT_BYTES, 1, 1},
+      {simulation->green, ".green.bin", green_bytes, 0, 0},
+   };
+   for(size_t n=0; n<sizeof(outputs)/sizeof(*outputs); n++)
+   {
+      if(!outputs[n].on)
+         continue;
+      files += nlanes*output_file(filename, outputs[n].suffix, outputs[n].bytes, nlanes);
+      if(outputs[n].text)
+         text_bytes += nlanes*outputs[n].bytes;
+      if(outputs[n].Tstep && outputs[n].bytes > largest)
+      {
+         largest = outputs[n].bytes;
+         largest_name = outputs[n].suffix;
+      }
+   }
+   printf("   %-34s %12.1f MB\n", "total", files/PLAN_MB);
+
+   //run time, calibrated on a small grid
+   printf("\n   calibrating the run time...\n"); fflush(stdout);
+   double seconds[PLAN_PHASES] = {0};
+   grid * small = NULL;
+   status = calibrate(copy, simulation, &small, seconds);
+   if(!status)
+   {
+      double scale[PLAN_PHASES];
+      double sums = delay_sums(Ny, nx)/delay_sums(small->Ny, nx);
+      scale[PLAN_QUBIT]    = sums;
+      scale[PLAN_INITIAL]  = (double)Nx/small->Nx;
+      scale[PLAN_BOUNDARY] = (simulation->init_cond == 1 ? sums : (double)Ny/small->Ny);
+      scale[PLAN_PSI]      = (double)Ny*Ntotal/((double)small->Ny*small->Ntotal);
+      scale[PLAN_MARCH]    = marched_points(simulation, Ny)/marched_points(small, small->Ny);
+      seconds[PLAN_OUTPUT] = text_bytes*text_seconds_per_byte();
+      scale[PLAN_OUTPUT]   = 1;
+
+      printf("   run time (calibrated on a grid with Nx=%d, Ny=%d):\n", small->Nx, small->Ny);
+      double total = 0;
+      for(int p=0; p<PLAN_PHASES; p++)
+      {
+         double t = seconds[p]*scale[p]*(p == PLAN_OUTPUT ? 1 : nlanes);
+         if(simulation->green && p == PLAN_MARCH)
+            continue; //replaced by the green phase below
+         printf("   %-34s %12.2f s\n", phase_names[p], t);
+         total += t;
+      }
+      if(simulation->richardson)
+      {
+         //four times the points; the qubit tables are only computed on the odd rows
+         double t = 4*seconds[PLAN_MARCH]*scale[PLAN_MARCH] + 4*seconds[PLAN_PSI]*scale[PLAN_PSI]
+                  + 2*seconds[PLAN_BOUNDARY]*scale[PLAN_BOUNDARY] + 3*seconds[PLAN_QUBIT]*scale[PLAN_QUBIT];
+         printf("   %-34s %12.2f s (x4 for each further halving with richardson_tol)\n", "richardson (grid at Delta/2)", t);
+         total += t;
+      }
+      if(simulation->green)
+      {
+         //one march of the grid per unit response, unless green_file holds them already
+         double t = (simulation->minus_a_index+nx+2)*seconds[PLAN_MARCH]*scale[PLAN_MARCH];
+         printf("   %-34s %12.2f s (only if the impulse responses are not stored yet)\n", "green", t);
+         total += t;
+      }
+      if(simulation->pipeline)
+      {
+         //the qubit tables and the strip are prepared by the pipeline threads alongside the march
+         double setup = (seconds[PLAN_QUBIT]*scale[PLAN_QUBIT] + seconds[PLAN_BOUNDARY]*scale[PLAN_BOUNDARY])*nlanes;
+         double march = seconds[PLAN_MARCH]*scale[PLAN_MARCH]*nlanes;
+         double t = (setup/simulation->pipeline < march ? setup/simulation->pipeline : march);
+         printf("   %-34s %12.2f s (at most, with %d threads on spare cores)\n", "pipeline (overlapped set-up)", -t, simulation->pipeline);
+         total -= t;
+      }
+      if(simulation->steady_state_tol > 0)
+         printf("   (the march stops earlier once the steady state is reached)\n");
+      printf("   %-34s %12.2f s\n", "total", total);
+   }
+   fdtd_destroy(small);
+
+   //settings that fit into the budget
+   if(!status && budget > 0)
+   {
+      printf("\n   recommendations for a budget of %g GB:\n", budget);
+      budget *= 1024*PLAN_MB;
+      int fits = 1;
+      if(peak > budget)
+      {
+         fits = 0;
+         //each row costs psi, the strip and the qubit tables; the rest is fixed
+         double one[PLAN_PHASES], two[PLAN_PHASES];
+         grid_memory(simulation, nx, Nx, 1, one);
+         grid_memory(simulation, nx, Nx, 2, two);
+         double row = two[PLAN_PSI] - one[PLAN_PSI];
+         int Ny_fit = (int)((budget - (peak - row*Ny))/row);
+         if(Ny_fit >= 2 && !simulation->richardson && nlanes == 1)
+            printf("   - a shorter window: t_max=%g (Ny=%d)\n", (Ny_fit-1)*simulation->Delta, Ny_fit);
+         //the memory goes with 1/Delta^2
+         double coarser = sqrt(peak/budget);
+         printf("   - a coarser grid: Delta=%g (nx, Nx and Ny divided by %.2f)%s\n", simulation->Delta*coarser, coarser,
+                (simulation->scheme == 2 ? "; scheme=4 keeps the error at the level of the finer grid" : ""));
+         if(!simulation->envelope && simulation->init_cond <= 3)
+            printf("   - envelope=1 if Delta is set by k or w0 rather than by gamma (see README.md)\n");
+         if(nlanes > 1 && memory[PLAN_PSI] < budget)
+            printf("   - at most %d lanes per job\n", (int)((budget - memory[PLAN_PSI])/memory[PLAN_MARCH])+1);
+      }
+      if(largest > budget)
+      {
+         fits = 0;
+         printf("   - Tstep=%d to keep %s%s within the budget\n",
+                (int)ceil(largest*(simulation->Tstep+1)/budget)-1, filename, largest_name);
+      }
+      if(fits)
+         printf("   - the run fits as it is\n");
+   }
+
+   free_grid(simulation);
+   freeKVs(copy);
+   return status;
+}
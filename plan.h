@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __PLAN_H__
+#define __PLAN_H__
+
+#include "grid.h"
+
+/*
+   Dry run (./FDTD --plan input_parameters [memory_budget_in_GB]).
+
+   The input file goes through the same kv path as initialize_grid (parsing,
+   sizing from the output window and the sanity check), but no array of the
+   grid is allocated. From the sizes alone the planner prints
+
+   - the resident memory at the end of each set-up phase, of the march and of
+     the output (psi, the boundary strip, the initial row, the qubit tables,
+     the tabulated wavepacket and the NM buffers, times the number of lanes;
+     the fine grid of richardson and the impulse responses of green included),
+   - the size of each output file (text files at 12 bytes per number, which is
+     typical of "%.5g "), and
+   - the projected run time of each phase.
+
+   The run time is calibrated on the current machine by running the set-up
+   and the march on a small grid with the same nx, Delta, physics and scheme,
+   and scaling each phase with its own cost model: the qubit tables and the
+   plane-wave boundary (init_cond=1) sum over the round trips of the delay,
+   Ny+Ny^2/(2nx) terms, the other phases go with the number of points they
+   touch (for the march, only those in the active window, see
+   solver.c). Writing the text outputs is timed with fprintf into /dev/null.
+   The cache of cache_dir is not used by the calibration, and the projection
+   is that of a run without it (see cache.h).
+
+   If a memory budget is given, settings that fit into it are recommended:
+   a shorter window t_max (Ny), a coarser Delta (with scheme=4 to keep the
+   accuracy), fewer lanes per job, and for each text output a Tstep that
+   keeps it within the budget as well.
+*/
+
+int plan_grid(const char * filename, double budget);
+
+//the peak resident memory (bytes) of the run, without printing the plan
+int plan_memory(const char * filename, double * bytes);
+
+#endif
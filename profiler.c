@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "profiler.h"
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+
+//the order has to match the counters[] layout in profile_phase
+static const char * counter_names[PROFILER_NUM_COUNTERS] = {"cycles", "instructions", "cache_references", "cache_misses"};
+
+
+static double wall_time(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+#ifdef __linux__
+//the counter is inherited by the threads started later (tiles, numa stripes,
+//pipeline), and reading it sums over them; as older kernels refuse inherit
+//together with PERF_FORMAT_GROUP, each counter is opened and read on its own
+static int open_counter(unsigned long long config)
+{
+   struct perf_event_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.type = PERF_TYPE_HARDWARE;
+   attr.size = sizeof(attr);
+   attr.config = config;
+   attr.disabled = 1;
+   attr.inherit = 1;
+   attr.exclude_kernel = 1;
+   attr.exclude_hv = 1;
+
+   //this process, any cpu
+   return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+
+//read the current values of all counters
+static void read_counters(profiler * prof, long long * values)
+{
+   memset(values, 0, PROFILER_NUM_COUNTERS*sizeof(*values));
+#ifdef __linux__
+   if(!prof->counters_available)
+      return;
+
+   for(int n=0; n<PROFILER_NUM_COUNTERS; n++)
+      if(read(prof->fd[n], &values[n], sizeof(values[n])) != (ssize_t)sizeof(values[n]))
+         values[n] = 0;
+#endif
+}
+
+
+profiler * create_profiler(void)
+{
+   profiler * prof = calloc(1, sizeof(*prof));
+   if(!prof)
+   {
+      fprintf(stderr, "%s: cannot allocate memory, profiling is disabled.\n", __func__);
+      return NULL;
+   }
+   for(int n=0; n<PROFILER_NUM_COUNTERS; n++)
+      prof->fd[n] = -1;
+
+#ifdef __linux__
+   const unsigned long long config[PROFILER_NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                              PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES};
+   prof->counters_available = 1;
+   for(int n=0; n<PROFILER_NUM_COUNTERS; n++)
+   {
+      prof->fd[n] = open_counter(config[n]);
+      if(prof->fd[n] < 0)
+      {
+         prof->counters_available = 0;
+         break;
+      }
+   }
+
+   if(prof->counters_available)
+   {
+      for(int n=0; n<PROFILER_NUM_COUNTERS; n++)
+      {
+         ioctl(prof->fd[n], PERF_EVENT_IOC_RESET, 0);
+         ioctl(prof->fd[n], PERF_EVENT_IOC_ENABLE, 0);
+      }
+   }
+   else
+   {
+      for(int n=0; n<PROFILER_NUM_COUNTERS; n++)
+      {
+         if(prof->fd[n] >= 0) close(prof->fd[n]);
+         prof->fd[n] = -1;
+      }
+   }
+#endif
+
+   if(!prof->counters_available)
+      fprintf(stderr, "%s: Warning: hardware counters are not available (check /proc/sys/kernel/perf_event_paranoid), "
+                      "only timings will be reported.\n", __func__);
+
+   return prof;
+}
+
+
+void free_profiler(profiler * prof)
+{
+   if(!prof)
+      return;
+
+   for(int n=0; n<PROFILER_NUM_COUNTERS; n++)
+   {
+      if(prof->fd[n] >= 0) close(prof->fd[n]);
+   }
+   free(prof);
+}
+
+
+void profiler_begin(profiler * prof, const char * name)
+{
+   if(!prof)
+      return;
+
+   if(prof->nphases >= PROFILER_MAX_PHASES)
+   {
+      fprintf(stderr, "%s: Warning: too many phases, %s is not profiled.\n", __func__, name);
+      return;
+   }
+
+   prof->phases[prof->nphases].name = name;
+   read_counters(prof, prof->begin_counters);
+   prof->begin_time = wall_time();
+}
+
+
+//flops and model_bytes are the modeled work of the phase, pass 0 if unknown
+void profiler_end(profiler * prof, double flops, double model_bytes)
+{
+   if(!prof || prof->nphases >= PROFILER_MAX_PHASES)
+      return;
+
+   double end_time = wall_time();
+   long long end_counters[PROFILER_NUM_COUNTERS];
+   read_counters(prof, end_counters);
+
+   profile_phase * phase = &prof->phases[prof->nphases];
+   phase->seconds = end_time - prof->begin_time;
+   for(int n=0; n<PROFILER_NUM_COUNTERS; n++)
+      phase->counters[n] = end_counters[n] - prof->begin_counters[n];
+   phase->flops = flops;
+   phase->model_bytes = model_bytes;
+   prof->nphases++;
+}
+
+
+//measure the attainable peaks of this machine with two short loops:
+//a STREAM-like triad for the memory bandwidth, and independent chains of
+//complex multiply-adds (the operation the march is made of) for the flop rate
+void profiler_calibrate(profiler * prof)
+{
+   if(!prof)
+      return;
+
+   //bandwidth: arrays much larger than the last-level cache
+   const size_t N = 1<<22; //4M doubles = 32MB per array
+   double * a = malloc(N*sizeof(*a));
+   double * b = malloc(N*sizeof(*b));
+   double * c = malloc(N*sizeof(*c));
+   if(!a || !b || !c)
+   {
+      fprintf(stderr, "%s: cannot allocate memory, calibration is skipped.\n", __func__);
+      free(a); free(b); free(c);
+      return;
+   }
+   for(size_t n=0; n<N; n++)
+   {
+      a[n] = 0; b[n] = 1; c[n] = 2;
+   }
+
+   double best = 0;
+   for(int rep=0; rep<5; rep++)
+   {
+      double t0 = wall_time();
+      for(size_t n=0; n<N; n++)
+         a[n] = b[n] + 3.0*c[n];
+      double t1 = wall_time();
+      if(t1 > t0 && 3.0*N*sizeof(double)/(t1-t0) > best)
+         best = 3.0*N*sizeof(double)/(t1-t0);
+   }
+   prof->peak_bandwidth = best/1e9;
+
+   //flop rate: 8 independent accumulators to hide the latency
+   const long M = 1<<23;
+   double complex z[8], w = cexp(0.001*I), s = 1e-9;
+   for(int k=0; k<8; k++)
+      z[k] = a[k] + k*I;
+   double t0 = wall_time();
+   for(long m=0; m<M; m++)
+   {
+      for(int k=0; k<8; k++)
+         z[k] = z[k]*w + s;
+   }
+   double t1 = wall_time();
+   double complex sink = 0;
+   for(int k=0; k<8; k++)
+      sink += z[k];
+   prof->peak_gflops = (t1 > t0 && !isnan(creal(sink)) ? 8.0*8.0*M/(t1-t0)/1e9 : 0); //8 flops per complex multiply-add
+
+   free(a); free(b); free(c);
+}
+
+
+static void print_phase_json(FILE * f, profile_phase * phase, int counters_available, double ridge)
+{
+   fprintf(f, "    {\"name\": \"%s\", \"seconds\": %.6g", phase->name, phase->seconds);
+   if(counters_available)
+   {
+      for(int n=0; n<PROFILER_NUM_COUNTERS; n++)
+         fprintf(f, ", \"%s\": %lld", counter_names[n], phase->counters[n]);
+
+      double dram_bytes = 64.0*phase->counters[3]; //one cache line per last-level miss
+      fprintf(f, ", \"ipc\": %.4g", phase->counters[0] ? (double)phase->counters[1]/phase->counters[0] : 0.);
+      fprintf(f, ", \"dram_bytes\": %.6g", dram_bytes);
+      fprintf(f, ", \"bandwidth_GBs\": %.6g", phase->seconds > 0 ? dram_bytes/phase->seconds/1e9 : 0.);
+   }
+   if(phase->flops > 0)
+   {
+      fprintf(f, ", \"flops\": %.6g, \"gflops\": %.6g", phase->flops, phase->seconds > 0 ? phase->flops/phase->seconds/1e9 : 0.);
+      fprintf(f, ", \"arithmetic_intensity_model\": %.4g", phase->flops/phase->model_bytes);
+      double intensity = phase->flops/phase->model_bytes;
+      if(counters_available && phase->counters[3] > 0)
+      {
+         intensity = phase->flops/(64.0*phase->counters[3]);
+         fprintf(f, ", \"arithmetic_intensity_measured\": %.4g", intensity);
+      }
+      fprintf(f, ", \"bound\": \"%s\"", intensity < ridge ? "memory" : "compute");
+   }
+   fprintf(f, "}");
+}
+
+
+//write all phases to input_filename.profile.json and print a roofline summary of the march
+int save_profile(profiler * prof, grid * simulation, const char * filename)
+{
+   if(!prof)
+      return FDTD_SUCCESS;
+
+   char * str = strdup(filename);
+   str = realloc(str, (strlen(filename)+15)*sizeof(char) );
+   strcat(str, ".profile.json");
+
+   FILE * f = fopen(str, "w");
+   if(!f)
+   {
+      fprintf(stderr, "%s: cannot create %s. Abort!\n", __func__, str);
+      free(str);
+      return FDTD_ERROR_FILE;
+   }
+
+   double ridge = (prof->peak_bandwidth > 0 ? prof->peak_gflops/prof->peak_bandwidth : 0);
+
+   fprintf(f, "{\n");
+   fprintf(f, "  \"input\": \"%s\",\n", filename);
+   fprintf(f, "  \"grid\": {\"nx\": %d, \"Nx\": %d, \"Ntotal\": %d, \"Ny\": %d, \"Delta\": %.10g, \"init_cond\": %d},\n",
+           simulation->nx, simulation->Nx, simulation->Ntotal, simulation->Ny, simulation->Delta, simulation->init_cond);
+   fprintf(f, "  \"counters_available\": %s,\n", prof->counters_available ? "true" : "false");
+   fprintf(f, "  \"machine\": {\"peak_gflops\": %.6g, \"peak_bandwidth_GBs\": %.6g, \"ridge_flop_per_byte\": %.4g},\n",
+           prof->peak_gflops, prof->peak_bandwidth, ridge);
+   fprintf(f, "  \"model\": {\"march_flops_per_point\": %d, \"march_bytes_per_point\": %d},\n",
+           MARCH_FLOPS_PER_POINT, MARCH_BYTES_PER_POINT);
+   fprintf(f, "  \"phases\": [\n");
+   for(int n=0; n<prof->nphases; n++)
+   {
+      print_phase_json(f, &prof->phases[n], prof->counters_available, ridge);
+      fprintf(f, "%s\n", n<prof->nphases-1 ? "," : "");
+   }
+   fprintf(f, "  ]\n}\n");
+   close_output_file(f, simulation);
+
+   //roofline summary on screen
+   printf("FDTD: profile written to %s\n", str);
+   printf("      machine: %.3g GFLOP/s peak, %.3g GB/s peak, ridge point %.3g flop/byte\n",
+          prof->peak_gflops, prof->peak_bandwidth, ridge);
+   for(int n=0; n<prof->nphases; n++)
+   {
+      profile_phase * phase = &prof->phases[n];
+      printf("      %-28s %10.4f s", phase->name, phase->seconds);
+      if(prof->counters_available)
+         printf("  IPC %.2f  %.3g GB/s", phase->counters[0] ? (double)phase->counters[1]/phase->counters[0] : 0.,
+                phase->seconds > 0 ? 64.0*phase->counters[3]/phase->seconds/1e9 : 0.);
+      if(phase->flops > 0)
+      {
+         double intensity = phase->flops/phase->model_bytes;
+         if(prof->counters_available && phase->counters[3] > 0)
+            intensity = phase->flops/(64.0*phase->counters[3]);
+         double gflops = (phase->seconds > 0 ? phase->flops/phase->seconds/1e9 : 0);
+         double roof = (intensity*prof->peak_bandwidth < prof->peak_gflops ? intensity*prof->peak_bandwidth : prof->peak_gflops);
+         printf("  %.3g GFLOP/s, AI %.3g flop/byte (%s-bound, %.0f%% of roof)", gflops, intensity,
+                intensity < ridge ? "memory" : "compute", roof > 0 ? 100.*gflops/roof : 0.);
+      }
+      printf("\n");
+   }
+
+   free(str);
+   return FDTD_SUCCESS;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "grid.h"
+
+/*
+   Opt-in profiling mode (set profile=1 in the input file).
+
+   Each phase of the program (the set-up steps in initialize_grid, the march
+   in main.c, the march of each refined grid of richardson and the output) is
+   wrapped by profiler_begin/profiler_end, which read the hardware counters
+   (cycles, instructions, cache references and cache misses) through the
+   perf_event_open syscall. The counters are inherited by the threads that the
+   march and the set-up start (threads, numa, pipeline), so they cover the
+   work of the whole process. No external tool is needed; if the counters
+   are not accessible (e.g. perf_event_paranoid is too strict, or the OS is
+   not Linux) only the wall time is recorded.
+
+   At the end of the run the machine peaks (complex flop rate and memory
+   bandwidth) are measured with two short calibration loops, and the march is
+   placed on a roofline: its arithmetic intensity (from a flop/byte model of
+   the stencil and from the measured cache misses) is compared against the
+   ridge point peak_flops/peak_bandwidth. Everything is written to the file
+   input_filename.profile.json so that it can be tracked across builds.
+*/
+
+#define PROFILER_MAX_PHASES 16
+#define PROFILER_NUM_COUNTERS 4  //cycles, instructions, cache references, cache misses
+
+//flop and byte model of the box-scheme march, per grid point in the bulk
+//where the delay term and all four light-cone terms are active; the numbers
+//count a complex multiplication as 6 flops, a complex addition as 2 flops,
+//and the compulsory traffic as one write plus one new 16-byte element from
+//each row touched by the stencil
+#define MARCH_FLOPS_PER_POINT 79
+#define MARCH_BYTES_PER_POINT 192
+
+struct _profile_phase
+{
+   const char * name;
+   double seconds;
+   long long counters[PROFILER_NUM_COUNTERS];
+   double flops;      //modeled flop count of the phase (0 if no model is available)
+   double model_bytes;//modeled memory traffic of the phase (0 if no model is available)
+};
+typedef struct _profile_phase profile_phase;
+
+struct _profiler
+{
+   int counters_available; //whether perf_event_open succeeded
+   int fd[PROFILER_NUM_COUNTERS];
+   int nphases;
+   profile_phase phases[PROFILER_MAX_PHASES];
+   double begin_time;
+   long long begin_counters[PROFILER_NUM_COUNTERS];
+
+   //measured machine peaks
+   double peak_gflops;
+   double peak_bandwidth; //in GB/s
+};
+typedef struct _profiler profiler;
+
+profiler * create_profiler(void);
+void free_profiler(profiler * prof);
+void profiler_begin(profiler * prof, const char * name);
+void profiler_end(profiler * prof, double flops, double model_bytes);
+void profiler_calibrate(profiler * prof);
+int save_profile(profiler * prof, grid * simulation, const char * filename);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <string.h>
+#include "richardson.h"
+#include "fdtd.h"
+#include "solver.h"
+#include "profiler.h"
+
+
+//the parameters of simulation with the spacing halved; NULL if out of memory
+static kvarray_t * refined_parameters(const grid * simulation)
+{
+   kvarray_t * parameters = simulation->parameters_key_value_pair;
+   kvarray_t * refined = createKVs();
+   if(!refined)
+      return NULL;
+
+   //the grid size (and the output window that may fix it) is replaced, and the fine grid does not profile
+   const char * skip[] = {"nx", "Nx", "Ny", "Delta", "richardson", "richardson_tol", "profile",
+                          "t_max", "tau_max", "x_max"};
+   int status = 0;
+   for(size_t n=0; n<parameters->kvpair_len; n++)
+   {
+      int copy = 1;
+      for(size_t m=0; m<sizeof(skip)/sizeof(*skip); m++)
+         if(strcmp(parameters->kvpair[n]->key, skip[m]) == 0)
+            copy = 0;
+      if(copy)
+         status |= addKV(refined, parameters->kvpair[n]->key, parameters->kvpair[n]->value);
+   }
+
+   char value[32];
+   snprintf(value, sizeof(value), "%d", 2*simulation->nx);      status |= addKV(refined, "nx", value);
+   snprintf(value, sizeof(value), "%d", 2*simulation->Nx);      status |= addKV(refined, "Nx", value);
+   snprintf(value, sizeof(value), "%d", 2*simulation->Ny-1);    status |= addKV(refined, "Ny", value);
+   snprintf(value, sizeof(value), "%.17g", simulation->Delta/2);status |= addKV(refined, "Delta", value);
+   if(status)
+   {
+      freeKVs(refined);
+      return NULL;
+   }
+   return refined;
+}
+
+
+//max over x of the estimated error |psi_fine - psi_coarse|/(2^p-1) in row j of the coarse grid
+static double row_error(const grid * coarse, const grid * fine, int j)
+{
+   double R = (1 << coarse->scheme) - 1;
+   double error = 0;
+   for(int i=coarse->nx+1; i<coarse->Ntotal; i++)
+   {
+      //x=(i-origin_index)*Delta in both grids
+      double e = cabs(fine->psi[2*j][2*i-1] - coarse->psi[j][i])/R;
+      if(e > error)
+         error = e;
+   }
+   return error;
+}
+
+
+static int save_richardson_error(const grid * coarse, const grid * fine, const char * filename)
+{
+   char * str = malloc(strlen(filename)+20);
+   if(!str)
+      return FDTD_ERROR_MEMORY;
+   sprintf(str, "%s.richardson.out", filename);
+
+   FILE * f = fopen(str, "w");
+   if(!f)
+   {
+      fprintf(stderr, "%s: cannot open %s. Abort!\n", __func__, str);
+      free(str);
+      return FDTD_ERROR_FILE;
+   }
+
+   fprintf(f, "# Delta=%.17g scheme=%d\n# t   estimated max error of psi\n", coarse->Delta, coarse->scheme);
+   for(int j=0; j<coarse->Ny; j+=(coarse->Tstep+1))
+      fprintf(f, "%.10g %.6e\n", j*coarse->Delta, row_error(coarse, fine, j));
+
+   fclose(f);
+   free(str);
+   return FDTD_SUCCESS;
+}
+
+
+//*simulation must be completely marched; on return it holds the extrapolated psi,
+//and it may be replaced by a finer grid if richardson_tol is set
+int richardson_extrapolate(grid ** simulation, const char * filename)
+{
+   grid * coarse = *simulation;
+   grid * fine = NULL;
+   if(fdtd_rows_done(coarse) != fdtd_rows_total(coarse))
+      return FDTD_ERROR_STATE;
+
+   double error = 0;
+   for(int refinement=0; ; refinement++)
+   {
+      printf("FDTD: Richardson extrapolation, solving at Delta=%g...\n", coarse->Delta/2);
+      kvarray_t * parameters = refined_parameters(coarse);
+      if(!parameters)
+         return FDTD_ERROR_MEMORY;
+      int status = initialize_refined_grid(parameters, filename, coarse, &fine);
+      if(!status)
+      {
+         //about 8 times the work of the coarse grid per halving
+         profiler_begin(coarse->profiler, "richardson march");
+         status = fdtd_step(fine, fdtd_rows_total(fine));
+         double points = marched_points(fine, fdtd_rows_done(fine));
+         profiler_end(coarse->profiler, MARCH_FLOPS_PER_POINT*points, MARCH_BYTES_PER_POINT*points);
+      }
+      if(status)
+      {
+         free_grid(fine);
+         return status;
+      }
+
+      error = 0;
+      for(int j=0; j<coarse->Ny; j++)
+      {
+         double e = row_error(coarse, fine, j);
+         if(e > error)
+            error = e;
+      }
+      printf("FDTD: estimated error of psi at Delta=%g: %.3e\n", fine->Delta, error);
+
+      if(coarse->richardson_tol <= 0 || error <= coarse->richardson_tol)
+         break;
+      if(refinement == RICHARDSON_MAX_REFINEMENTS)
+      {
+         fprintf(stderr, "%s: Warning: richardson_tol=%g is not reached after %d refinements.\n",
+                 __func__, coarse->richardson_tol, RICHARDSON_MAX_REFINEMENTS);
+         break;
+      }
+
+      //the fine grid becomes the coarse one, inheriting the options of the original grid
+      fine->richardson = coarse->richardson;
+      fine->richardson_tol = coarse->richardson_tol;
+      fine->profiler = coarse->profiler; coarse->profiler = NULL;
+      free_grid(coarse);
+      coarse = *simulation = fine;
+      fine = NULL;
+   }
+
+   int status = save_richardson_error(coarse, fine, filename);
+
+   double R = (1 << coarse->scheme) - 1;
+   for(int j=0; j<coarse->Ny && !status; j++)
+      for(int i=coarse->nx+1; i<coarse->Ntotal; i++)
+      {
+         double complex psi_fine = fine->psi[2*j][2*i-1];
+         coarse->psi[j][i] = psi_fine + (psi_fine - coarse->psi[j][i])/R;
+      }
+
+   free_grid(fine);
+   return status;
+}
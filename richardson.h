@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __RICHARDSON_H__
+#define __RICHARDSON_H__
+
+#include "grid.h"
+
+/*
+   Richardson-extrapolation mode (set richardson=1 in the input file).
+
+   The same physical problem is solved on a second grid with half the spacing
+   (nx, Nx doubled, Ny -> 2Ny-1); its qubit tables e0/e1 are copied from the
+   coarse grid on the even rows instead of being recomputed. With p the order
+   of the scheme (2 or 4), psi on the coarse grid is then replaced by
+
+      psi_extrapolated = psi_fine + (psi_fine - psi_coarse)/(2^p - 1),
+
+   and |psi_fine - psi_coarse|/(2^p - 1), the estimated error of psi_fine, is
+   written for each saved row to input_filename.richardson.out. As chi is
+   linear in psi, the saved chi is extrapolated as well.
+
+   If richardson_tol>0, the spacing is halved again (the fine grid becoming the
+   coarse one) until the estimated error is below richardson_tol, so that the
+   output is on the coarsest grid Delta/2^n meeting the tolerance; at most
+   RICHARDSON_MAX_REFINEMENTS halvings are made.
+*/
+
+#define RICHARDSON_MAX_REFINEMENTS 4
+
+int richardson_extrapolate(grid ** simulation, const char * filename);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include "selftest.h"
+#include "fdtd.h"
+#include "cache.h"
+#include "NM_measure.h"
+
+
+//the grid shared by all cases: Ntotal=90, Ny=100
+static const char common[] = "nx=8\nNx=40\nNy=100\nDelta=0.05\nw0=3\ngamma=1\n";
+
+static const struct
+{
+   const char * name;
+   const char * lines;
+   int no_cache; //the run must not add a table to the cache
+} cases[] =
+{
+   {"plane_wave",        "init_cond=1\nk=3\nsave_chi=1\nsave_psi=1\nsave_psi_binary=1\nTstep=4\n"},
+   {"plane_wave_env",    "init_cond=1\nk=3\nsave_chi=1\nsave_psi=1\nenvelope=1\n"},
+   {"plane_wave_steady", "init_cond=1\nk=3\nsave_chi=1\nsteady_state_tol=1e-3\nsave_g2=1\n"},
+   {"single",            "init_cond=2\nk=2.5\nalpha=1\nsave_chi=1\nsave_psi_square_integral=1\nmeasure_NM=1\n"},
+   {"single_scheme4",    "init_cond=2\nk=2.5\nalpha=1\nsave_chi=1\nmeasure_NM=1\nscheme=4\n"},
+   {"single_no_copy",    "init_cond=2\nk=2.5\nalpha=1\nsave_chi=1\nmeasure_NM=1\ndiagonal_copy=0\n"},
+   {"single_lanes",      "init_cond=2\nlane_k=2.5,3.5\nalpha=1\nsave_chi=1\n"},
+   {"single_richardson", "init_cond=2\nk=2.5\nalpha=1\nsave_chi=1\nrichardson=1\n"},
+   {"single_green",      "init_cond=2\nk=2.5\nalpha=1\ngreen=1\ngreen_tau=0,10\n"},
+   {"single_pipeline",   "init_cond=2\nk=2.5\nalpha=1\nsave_chi=1\nmeasure_NM=1\npipeline=2\n"},
+   {"single_no_cache",   "init_cond=2\nk=2.7\nalpha=1\nsave_chi=1\ncache_dir=none\n", 1},
+   {"two_identical",     "init_cond=3\nidentical_photons=1\nk=2.5\nalpha=1\nsave_chi=1\nsave_psi=1\nsave_psi_square_integral=1\n"},
+   {"two_identical_mt",  "init_cond=3\nidentical_photons=1\nk=2.5\nalpha=1\nsave_chi=1\ntile_rows=4\ntile_columns=16\nthreads=2\nsave_g2=1\n"},
+   {"two_different",     "init_cond=3\nidentical_photons=0\nk1=2.5\nalpha1=1\nk2=3.5\nalpha2=0.5\nsave_chi=1\nsave_psi_square_integral=1\n"},
+   {"tabulated_single",  "init_cond=4\nsave_chi=1\nsave_psi_square_integral=1\n"},
+   {"tabulated_two",     "init_cond=5\nidentical_photons=1\nk0=3\nsave_chi=1\nsave_psi=1\nenvelope=1\nsave_g2=1\n"},
+};
+
+
+//a decaying exponential wavepacket, phi(-a-n*dx) = exp(-(ik+1/2)n*dx) for n=0,...,399, or if smooth
+//a gaussian one, exp(-ikx-2(x-5/2)^2) with x=n*dx, which is 4e-6 at -a so that psi has no jump at its front
+static int write_wavepacket(const char * filename, double dx, double k, int smooth)
+{
+   FILE * f = fopen(filename, "wb");
+   if(!f)
+   {
+      fprintf(stderr, "%s: cannot open %s. Abort!\n", __func__, filename);
+      return 1;
+   }
+   for(int n=0; n<400; n++)
+   {
+      double x = n*dx;
+      double complex sample = (smooth ? cexp(-k*I*x-2*(x-2.5)*(x-2.5)) : cexp(-(k*I+0.5)*x));
+      fwrite(&sample, sizeof(sample), 1, f);
+   }
+   fclose(f);
+   return 0;
+}
+
+
+//number of entries of a directory (0 if it does not exist), except those whose
+//name starts with outputs (if not NULL)
+static int count_files(const char * dir, const char * outputs)
+{
+   DIR * d = opendir(dir);
+   int count = 0;
+   for(struct dirent * e; d && (e = readdir(d));)
+      count += !(outputs && strncmp(e->d_name, outputs, strlen(outputs)) == 0);
+   if(d)
+      closedir(d);
+   return count;
+}
+
+
+int run_selftest(const char * dir, selftest_run run)
+{
+   char home[PATH_MAX], path[PATH_MAX+64], wavepacket[PATH_MAX+64], cache[PATH_MAX+64];
+   char temp[] = "/tmp/fdtd_selftest.XXXXXX";
+   if(!dir && !(dir = mkdtemp(temp)))
+   {
+      fprintf(stderr, "%s: cannot create a directory under /tmp. Abort!\n", __func__);
+      return 1;
+   }
+   if(!realpath(dir, home))
+   {
+      fprintf(stderr, "%s: cannot find %s. Abort!\n", __func__, dir);
+      return 1;
+   }
+   dir = home;
+   snprintf(wavepacket, sizeof(wavepacket), "%s/wavepacket.bin", dir);
+   if(write_wavepacket(wavepacket, 0.025, 3, 0))
+      return 1;
+
+   //the cases run in dir, so that a relative path of theirs ends up there too
+   int cwd = open(".", O_RDONLY);
+   if(cwd < 0 || chdir(dir) != 0)
+   {
+      fprintf(stderr, "%s: cannot change to %s. Abort!\n", __func__, dir);
+      if(cwd >= 0)
+         close(cwd);
+      return 1;
+   }
+   snprintf(cache, sizeof(cache), "%s/cache", dir);
+   cache_set_default_dir(cache); //as the job server does
+
+   int ncases = sizeof(cases)/sizeof(*cases), failed = 0;
+   for(int n=0; n<ncases; n++)
+   {
+      snprintf(path, sizeof(path), "%s/%s", dir, cases[n].name);
+      FILE * f = fopen(path, "w");
+      if(!f)
+      {
+         fprintf(stderr, "%s: cannot open %s. Abort!\n", __func__, path);
+         failed += ncases-n; //the cases not run
+         break;
+      }
+      fputs(common, f);
+      fputs(cases[n].lines, f);
+      fprintf(f, "wavepacket_file=%s\nwavepacket_dx=0.025\n", wavepacket);
+      fclose(f);
+
+      //besides its outputs, a run without cache leaves dir and the cache as they were
+      int files = count_files(cache, NULL) + count_files(dir, cases[n].name);
+      int status = run(path);
+      if(!status && cases[n].no_cache && count_files(cache, NULL) + count_files(dir, cases[n].name) != files)
+      {
+         fprintf(stderr, "%s: %s stored a table although it uses no cache.\n", __func__, cases[n].name);
+         status = 1;
+      }
+      printf("FDTD: self test %-18s %s\n", cases[n].name, (status ? "FAILED" : "ok"));
+      failed += (status != 0);
+   }
+
+   cache_set_default_dir(NULL);
+   if(fchdir(cwd) != 0)
+      fprintf(stderr, "%s: Warning: cannot change back to the working directory.\n", __func__);
+   close(cwd);
+   printf("FDTD: %d of %d self tests failed (inputs and outputs in %s)\n", failed, ncases, dir);
+   return failed;
+}
+
+
+/*
+   Cross-validation of the kernels (./FDTD --validate [kernel ...]).
+
+   Every input state is marched on a small grid by the reference kernel
+   (reference=1, see solver.c) and by each selected kernel, and the two are
+   compared in memory: psi in all rows, chi in all rows, the norm of
+   save_psi_square_integral and, for a single photon, the NM measures. The
+   differences are relative to the largest value of the reference; a kernel
+   fails if one exceeds its tolerance. The kernels that only reorder the work
+   agree to rounding (in fact bit for bit). The envelope and the fourth-order
+   scheme discretize differently and agree only to the truncation error, which
+   does not shrink with Delta near a jump of psi (the front of an exponential
+   wavepacket), so they are compared on the tabulated states, whose wavepacket
+   is smooth, and on a grid 8 times finer; the jump where the excited qubit of
+   a single photon starts to emit leaves 1e-3 there. The steady state is
+   compared on resonance (2k = w0), where it sets in by row 700 of 1000, and
+   agrees to its steady_state_tol. A wrong weight or phase of a few percent
+   in any of them exceeds the tolerances.
+*/
+static const char validate_grid[] = "nx=8 Nx=60 Ny=240 Delta=0.05 w0=1 gamma=1 save_chi=1";
+
+static const struct
+{
+   const char * name;
+   const char * keys;
+} states[] =
+{
+   {"plane_wave",       "init_cond=1 k=0.8"},
+   {"single",           "init_cond=2 k=0.8 alpha=1"},
+   {"two_identical",    "init_cond=3 identical_photons=1 k=0.8 alpha=1"},
+   {"two_different",    "init_cond=3 identical_photons=0 k1=0.8 alpha1=1 k2=1.2 alpha2=0.5"},
+   {"tabulated_single", "init_cond=4"},
+   {"tabulated_two",    "init_cond=5 identical_photons=1"},
+};
+
+static const struct
+{
+   const char * name;
+   const char * keys;
+   double tolerance;
+   int init_conds;     //bit n is set if the kernel applies to init_cond=n (0: all)
+   const char * grid;  //keys that replace those of validate_grid, for the kernel and its reference
+} kernels[] =
+{
+   {"box",          "",                                      1e-13, 0,             NULL},
+   {"no_copy",      "diagonal_copy=0",                       1e-13, 0,             NULL},
+   {"tiled",        "tile_rows=4 tile_columns=24",           1e-13, 0,             NULL},
+   {"threads",      "tile_rows=4 tile_columns=24 threads=3", 1e-13, 0,             NULL},
+   {"numa",         "numa=1 threads=3",                      1e-13, 0,             NULL},
+   {"envelope",     "envelope=1",                            2e-3,  1<<4 | 1<<5,   "nx=64 Nx=480 Ny=1920 Delta=0.00625"},
+   {"steady_state", "steady_state_tol=1e-4",                 1e-3,  1<<1,          "w0=3 k=1.5 Ny=1000"},
+   {"scheme4",      "scheme=4",                              2e-3,  1<<4 | 1<<5,   "nx=64 Nx=480 Ny=1920 Delta=0.00625"},
+};
+
+
+//the grid of the input state with the keys of the grid and of the kernel (or the reference kernel if keys is NULL)
+static int create_validation_grid(int state, const char * grid_keys, const char * keys, const char * wavepacket, grid ** simulation)
+{
+   *simulation = NULL;
+   kvarray_t * kv = createKVs();
+   if(!kv)
+      return FDTD_ERROR_MEMORY;
+
+   char line[512];
+   snprintf(line, sizeof(line), "%s %s %s %s wavepacket_file=%s wavepacket_dx=0.025", validate_grid,
+            states[state].keys, (grid_keys ? grid_keys : ""), (keys ? keys : "reference=1"), wavepacket);
+   int status = FDTD_SUCCESS;
+   for(char * key = strtok(line, " "); key && !status; key = strtok(NULL, " "))
+   {
+      char * value = strchr(key, '=');
+      *value++ = '\0';
+      if(addKV(kv, key, value))
+         status = FDTD_ERROR_MEMORY;
+   }
+
+   if(!status)
+      status = fdtd_create_from_kv(kv, simulation);
+   if(!status)
+      status = fdtd_step(*simulation, fdtd_rows_total(*simulation));
+   freeKVs(kv);
+   return status;
+}
+
+
+struct difference
+{
+   double abs;         //largest difference
+   double diff2, ref2; //sums of the squares of the differences and of the reference
+};
+
+
+static void compare(struct difference * d, double complex reference, double complex value)
+{
+   if(isnan(cabs(reference)) && isnan(cabs(value))) //e.g. the norm of a plane wave
+      return;
+   double diff = cabs(value-reference);
+   d->abs = (diff > d->abs || isnan(diff) ? diff : d->abs);
+   d->diff2 += diff*diff;
+   d->ref2 += cabs(reference)*cabs(reference);
+}
+
+
+//the difference relative to the reference in the 2-norm: the largest difference says little
+//for the kernels that discretize differently, as psi jumps at the wavefront of a wavepacket
+static double relative(const struct difference * d)
+{
+   return (d->ref2 > 0 ? sqrt(d->diff2/d->ref2) : sqrt(d->diff2));
+}
+
+
+//psi, chi, norm and mu of the two grids; returns a status
+static int compare_grids(grid * reference, grid * simulation, struct difference d[4])
+{
+   memset(d, 0, 4*sizeof(*d));
+   fdtd_layout layout;
+   fdtd_get_layout(reference, &layout);
+
+   for(int j=0; j<layout.Ny; j++)
+   {
+      double complex * a = fdtd_psi_row(reference, j), * b = fdtd_psi_row(simulation, j);
+      for(int i=0; a && b && i<layout.Ntotal; i++)
+         compare(&d[0], a[i], b[i]);
+   }
+
+   double complex * chi = malloc(2*layout.chi_length*sizeof(*chi));
+   if(!chi)
+      return FDTD_ERROR_MEMORY;
+   for(int j=0; j<layout.Ny; j++)
+   {
+      fdtd_chi_row(reference, j, chi);
+      fdtd_chi_row(simulation, j, chi+layout.chi_length);
+      for(int i=0; i<layout.chi_length; i++)
+         compare(&d[1], chi[i], chi[i+layout.chi_length]);
+   }
+   free(chi);
+
+   for(int j=0; j<layout.Ny && j<=layout.Nx-layout.nx/2; j++)
+      compare(&d[2], fdtd_psi_square_integral(reference, j), fdtd_psi_square_integral(simulation, j));
+
+   //the NM measures of a single photon, over the rows of calculate_NM_measure
+   if(reference->init_cond == 2)
+      for(int j=0; j<layout.Ny-1 && j<layout.Nx-layout.nx/2; j++)
+      {
+         compare(&d[3], lambda(j, reference), lambda(j, simulation));
+         compare(&d[3], mu(j, reference), mu(j, simulation));
+      }
+
+   return FDTD_SUCCESS;
+}
+
+
+int run_validation(const char * const * names, int nnames)
+{
+   //the selected kernels, or all of them
+   int nkernels = sizeof(kernels)/sizeof(*kernels), selected[sizeof(kernels)/sizeof(*kernels)];
+   for(int k=0; k<nkernels; k++)
+      selected[k] = (nnames == 0);
+   for(int n=0; n<nnames; n++)
+   {
+      int k;
+      for(k=0; k<nkernels && strcmp(names[n], kernels[k].name); k++);
+      if(k == nkernels)
+      {
+         fprintf(stderr, "%s: unknown kernel %s (available:", __func__, names[n]);
+         for(k=0; k<nkernels; k++)
+            fprintf(stderr, " %s", kernels[k].name);
+         fprintf(stderr, "). Abort!\n");
+         return 1;
+      }
+      selected[k] = 1;
+   }
+
+   char dir[] = "/tmp/fdtd_validate.XXXXXX", wavepacket[64];
+   if(!mkdtemp(dir))
+   {
+      fprintf(stderr, "%s: cannot create a directory under /tmp. Abort!\n", __func__);
+      return 1;
+   }
+   snprintf(wavepacket, sizeof(wavepacket), "%s/wavepacket.bin", dir);
+   if(write_wavepacket(wavepacket, 0.025, 1, 1))
+      return 1;
+
+   int nstates = sizeof(states)/sizeof(*states), failed = 0, compared = 0;
+   char result[sizeof(states)/sizeof(*states)][sizeof(kernels)/sizeof(*kernels)][160];
+   memset(result, 0, sizeof(result));
+   for(int s=0; s<nstates; s++)
+   {
+      int init_cond = atoi(strstr(states[s].keys, "init_cond=")+10);
+      grid * reference = NULL;
+      const char * reference_grid = NULL;
+      int status = FDTD_SUCCESS;
+      for(int k=0; k<nkernels; k++)
+      {
+         if(!selected[k] || (kernels[k].init_conds && !(kernels[k].init_conds >> init_cond & 1)))
+            continue;
+
+         //the reference on the grid of the kernel (the kernels on the same grid share it)
+         if(!reference || strcmp(kernels[k].grid ? kernels[k].grid : "", reference_grid ? reference_grid : ""))
+         {
+            fdtd_destroy(reference);
+            reference_grid = kernels[k].grid;
+            status = create_validation_grid(s, reference_grid, NULL, wavepacket, &reference);
+         }
+
+         grid * simulation = NULL;
+         struct difference d[4];
+         int kstatus = status, reached = 1;
+         if(!kstatus)
+            kstatus = create_validation_grid(s, kernels[k].grid, kernels[k].keys, wavepacket, &simulation);
+         if(!kstatus)
+            kstatus = compare_grids(reference, simulation, d);
+         if(!kstatus) //otherwise the steady state is not tested
+            reached = (simulation->steady_state_tol == 0 || simulation->steady_state_row > 0);
+         fdtd_destroy(simulation);
+
+         int ok = !kstatus && reached;
+         for(int q=0; q<4 && ok; q++)
+            ok = (relative(&d[q]) <= kernels[k].tolerance);
+         if(kstatus)
+            snprintf(result[s][k], sizeof(result[s][k]), "%s", fdtd_strerror(kstatus));
+         else if(!reached)
+            snprintf(result[s][k], sizeof(result[s][k]), "the steady state is not reached");
+         else
+            snprintf(result[s][k], sizeof(result[s][k]), "psi %.1e/%.1e chi %.1e/%.1e norm %.1e/%.1e NM %.1e/%.1e",
+                     d[0].abs, relative(&d[0]), d[1].abs, relative(&d[1]), d[2].abs, relative(&d[2]), d[3].abs, relative(&d[3]));
+         strcat(result[s][k], (ok ? "  ok" : "  FAILED"));
+         failed += !ok;
+         compared++;
+      }
+      fdtd_destroy(reference);
+   }
+   remove(wavepacket);
+   remove(dir);
+
+   //the progress of the runs is printed in-between, so the table comes last
+   printf("\nFDTD: differences from the reference kernel (max absolute/relative):\n");
+   for(int s=0; s<nstates; s++)
+      for(int k=0; k<nkernels; k++)
+         if(result[s][k][0])
+            printf("%-16s %-12s %s (tolerance %.2g)\n", states[s].name, kernels[k].name, result[s][k], kernels[k].tolerance);
+   printf("FDTD: %d of %d comparisons failed\n", failed, compared);
+   return failed;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __SELFTEST_H__
+#define __SELFTEST_H__
+
+/*
+   Self test over small grids (./FDTD --selftest [dir]).
+
+   A set of input files on a grid of a few thousand points covers every input
+   state (init_cond=1 to 5, with identical and different photons) and the
+   options that take a path of their own through the set-up, the march or the
+   outputs: envelope, scheme=4, diagonal_copy=0, tiles and threads, lanes,
+   richardson, green, steady_state_tol, measure_NM, pipeline and save_g2. The
+   input files are written into dir (a new directory under /tmp if not given),
+   together with a tabulated wavepacket for init_cond=4 and 5, and each is run
+   as "./FDTD input" would, with the outputs next to it. The qubit tables are
+   cached in dir/cache, the default cache_dir of the job server, except by the
+   case that opts out of it with cache_dir=none. A case fails if the run
+   fails, e.g. on NaN, or if it opts out of the cache and yet adds a table to
+   it.
+
+   It is meant for the checked build (make debug), in which the helpers check
+   their bounds (FDTD_CHECKED) and the address and undefined-behaviour
+   sanitizers watch every access, and which runs it; a few seconds suffice.
+*/
+
+//runs one input file as ./FDTD does, and returns its exit status
+typedef int (*selftest_run)(const char * input);
+
+//returns the number of failed cases
+int run_selftest(const char * dir, selftest_run run);
+
+/*
+   Cross-validation of the kernels against the reference (./FDTD --validate
+   [kernel ...]).
+
+   The box scheme has grown several kernels that compute the same psi by other
+   routes, and reference=1 keeps the point-by-point loop of the original code
+   as their yardstick. Each input state is marched on a small grid by the
+   reference and by each of the given kernels (all if none is given: box,
+   no_copy, tiled, threads, numa, envelope, steady_state, scheme4, see
+   selftest.c), and the largest absolute and relative differences of psi, chi,
+   the norm of psi and the NM measures are reported. A kernel fails if they
+   exceed its tolerance. It takes a few seconds, and a new kernel is added to
+   the table in selftest.c with its tolerance and, if it discretizes
+   differently, the finer grid on which it is compared.
+*/
+//returns the number of failed comparisons
+int run_validation(const char * const * names, int nnames);
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "server.h"
+#include "fdtd.h"
+#include "cache.h"
+#include "plan.h"
+
+#define SERVER_MAX_JOBS 256
+#define SERVER_LINE 4096
+#define SERVER_MB (1024.*1024.)
+
+struct server_job_entry
+{
+   char * input;
+   int client;    //the connection of the submitter, answered when the job is done
+   pid_t pid;     //0 while queued
+   double memory; //estimated peak resident memory (bytes)
+   double start;
+};
+
+
+static double wall_time(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+static int socket_address(const char * path, struct sockaddr_un * address)
+{
+   if(strlen(path) >= sizeof(address->sun_path))
+   {
+      fprintf(stderr, "%s: the socket path %s is too long. Abort!\n", __func__, path);
+      return FDTD_ERROR_INPUT;
+   }
+   memset(address, 0, sizeof(*address));
+   address->sun_family = AF_UNIX;
+   strcpy(address->sun_path, path);
+   return FDTD_SUCCESS;
+}
+
+
+//a connected socket, or -1
+static int connect_to(const struct sockaddr_un * address)
+{
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(fd >= 0 && connect(fd, (const struct sockaddr *)address, sizeof(*address)) != 0)
+   {
+      close(fd);
+      fd = -1;
+   }
+   return fd;
+}
+
+
+//one line without the newline; -1 if the connection is closed before anything is read
+static int read_line(int fd, char * line, size_t size)
+{
+   size_t n = 0;
+   ssize_t r = 0;
+   while(n+1 < size)
+   {
+      r = read(fd, line+n, 1);
+      if(r < 0 && errno == EINTR)
+         continue;
+      if(r <= 0 || line[n] == '\n')
+         break;
+      n++;
+   }
+   line[n] = '\0';
+   return (n == 0 && r <= 0 ? -1 : (int)n);
+}
+
+
+//the forked job: the messages go to input.log, the outputs next to the input file
+static pid_t start_job(struct server_job_entry * jobs, int njobs, int n, int listener, server_job run)
+{
+   fflush(stdout); fflush(stderr);
+   pid_t pid = fork();
+   if(pid != 0)
+      return pid;
+
+   close(listener);
+   for(int m=0; m<njobs; m++)
+      close(jobs[m].client);
+   char * log = malloc(strlen(jobs[n].input)+8);
+   if(log)
+   {
+      sprintf(log, "%s.log", jobs[n].input);
+      int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(fd >= 0)
+      {
+         dup2(fd, STDOUT_FILENO);
+         dup2(fd, STDERR_FILENO);
+         close(fd);
+      }
+      free(log);
+   }
+   int status = run(jobs[n].input);
+   fflush(stdout); fflush(stderr);
+   _exit(status);
+}
+
+
+//answer the submitter of a finished job and report it in the log of the server
+static void finish_job(struct server_job_entry * job, int wstatus, const struct rusage * usage)
+{
+   double seconds = wall_time() - job->start;
+   double cpu = usage->ru_utime.tv_sec + 1e-6*usage->ru_utime.tv_usec + usage->ru_stime.tv_sec + 1e-6*usage->ru_stime.tv_usec;
+   char line[SERVER_LINE];
+   if(WIFEXITED(wstatus))
+      snprintf(line, sizeof(line), "done exit=%d seconds=%.2f cpu=%.2f max_rss=%.1fMB log=%s.log",
+               WEXITSTATUS(wstatus), seconds, cpu, usage->ru_maxrss/1024., job->input);
+   else
+      snprintf(line, sizeof(line), "failed signal=%d seconds=%.2f cpu=%.2f max_rss=%.1fMB log=%s.log",
+               (WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : 0), seconds, cpu, usage->ru_maxrss/1024., job->input);
+   dprintf(job->client, "%s\n", line); //the submitter may be gone, which is fine
+   printf("FDTD: %s: %s\n", job->input, line); fflush(stdout);
+   close(job->client);
+   free(job->input);
+}
+
+
+int serve_jobs(const char * socket_path, double budget, const char * cache_dir, server_job run)
+{
+   struct sockaddr_un address;
+   int status = socket_address(socket_path, &address);
+   if(status)
+      return status;
+
+   //a socket left behind by a server that is gone is replaced, a live one is not
+   struct stat st;
+   if(stat(socket_path, &st) == 0)
+   {
+      int fd = (S_ISSOCK(st.st_mode) ? connect_to(&address) : -1);
+      if(!S_ISSOCK(st.st_mode) || fd >= 0)
+      {
+         fprintf(stderr, "%s: %s is in use. Abort!\n", __func__, socket_path);
+         if(fd >= 0)
+            close(fd);
+         return FDTD_ERROR_FILE;
+      }
+      unlink(socket_path);
+   }
+
+   int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+   if(listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+   {
+      fprintf(stderr, "%s: cannot listen on %s (%s). Abort!\n", __func__, socket_path, strerror(errno));
+      if(listener >= 0)
+         close(listener);
+      return FDTD_ERROR_FILE;
+   }
+   signal(SIGPIPE, SIG_IGN); //a submitter that goes away must not stop the server
+   cache_set_default_dir(cache_dir);
+
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   cpus = (cpus < 1 ? 1 : cpus);
+   budget *= 1024*SERVER_MB;
+   printf("FDTD: serving jobs on %s (%ld at a time", socket_path, cpus);
+   if(budget > 0)
+      printf(", memory budget %.1f MB", budget/SERVER_MB);
+   if(cache_dir)
+      printf(", tables cached in %s", cache_dir);
+   printf(")\n"); fflush(stdout);
+
+   struct server_job_entry jobs[SERVER_MAX_JOBS];
+   int njobs = 0, running = 0, stopping = 0;
+   double used = 0;
+   while(!stopping || njobs > 0)
+   {
+      struct pollfd p = {listener, POLLIN, 0};
+      if(!stopping && poll(&p, 1, 100) > 0 && (p.revents & POLLIN))
+      {
+         int client = accept(listener, NULL, NULL);
+         char line[SERVER_LINE];
+         struct timeval timeout = {2, 0};
+         if(client >= 0 && (setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0
+                            || read_line(client, line, sizeof(line)) < 0))
+         {
+            close(client);
+            client = -1;
+         }
+         if(client >= 0 && strncmp(line, "run ", 4) == 0)
+         {
+            const char * input = line+4;
+            double memory = 0;
+            int refused = 1;
+            if(njobs == SERVER_MAX_JOBS)
+               dprintf(client, "refused: %d jobs are queued or running\n", njobs);
+            else if(input[0] != '/')
+               dprintf(client, "refused: the path of the input file must be absolute\n");
+            else if((status = plan_memory(input, &memory)))
+               dprintf(client, "refused: %s\n", fdtd_strerror(status));
+            else if(budget > 0 && memory > budget)
+               dprintf(client, "refused: the job needs %.1f MB, the budget is %.1f MB\n", memory/SERVER_MB, budget/SERVER_MB);
+            else if(!(jobs[njobs].input = strdup(input)))
+               dprintf(client, "refused: %s\n", fdtd_strerror(FDTD_ERROR_MEMORY));
+            else
+            {
+               jobs[njobs].client = client;
+               jobs[njobs].pid = 0;
+               jobs[njobs].memory = memory;
+               njobs++;
+               refused = 0;
+               dprintf(client, "queued %.1fMB\n", memory/SERVER_MB);
+            }
+            if(refused)
+               close(client);
+         }
+         else if(client >= 0 && strcmp(line, "status") == 0)
+         {
+            for(int n=0; n<njobs; n++)
+               if(jobs[n].pid)
+                  dprintf(client, "running %s %.1fMB %.0fs\n", jobs[n].input, jobs[n].memory/SERVER_MB, wall_time()-jobs[n].start);
+               else
+                  dprintf(client, "queued %s %.1fMB\n", jobs[n].input, jobs[n].memory/SERVER_MB);
+            dprintf(client, "end\n");
+            close(client);
+         }
+         else if(client >= 0 && strcmp(line, "shutdown") == 0)
+         {
+            stopping = 1;
+            dprintf(client, "ok\n");
+            close(client);
+            printf("FDTD: shutting down after %d queued or running jobs\n", njobs); fflush(stdout);
+         }
+         else if(client >= 0)
+         {
+            dprintf(client, "refused: unknown request\n");
+            close(client);
+         }
+      }
+      else if(stopping)
+         poll(NULL, 0, 100);
+
+      //collect the finished jobs
+      int wstatus;
+      struct rusage usage;
+      pid_t pid;
+      while((pid = wait4(-1, &wstatus, WNOHANG, &usage)) > 0)
+         for(int n=0; n<njobs; n++)
+            if(jobs[n].pid == pid)
+            {
+               finish_job(&jobs[n], wstatus, &usage);
+               running--;
+               used -= jobs[n].memory;
+               memmove(&jobs[n], &jobs[n+1], (njobs-n-1)*sizeof(*jobs));
+               njobs--;
+               break;
+            }
+
+      //start the queued jobs in the order of submission
+      for(int n=0; n<njobs; n++)
+      {
+         if(jobs[n].pid)
+            continue;
+         if(running >= cpus || (budget > 0 && used + jobs[n].memory > budget))
+            break;
+         pid = start_job(jobs, njobs, n, listener, run);
+         if(pid < 0)
+         {
+            dprintf(jobs[n].client, "failed: cannot start the job (%s)\n", strerror(errno));
+            close(jobs[n].client);
+            free(jobs[n].input);
+            memmove(&jobs[n], &jobs[n+1], (njobs-n-1)*sizeof(*jobs));
+            njobs--;
+            n--;
+            continue;
+         }
+         jobs[n].pid = pid;
+         jobs[n].start = wall_time();
+         running++;
+         used += jobs[n].memory;
+      }
+   }
+
+   close(listener);
+   unlink(socket_path);
+   return FDTD_SUCCESS;
+}
+
+
+int submit_job(const char * socket_path, const char * request, const char * input)
+{
+   struct sockaddr_un address;
+   if(socket_address(socket_path, &address))
+      return FDTD_ERROR_INPUT;
+   int fd = connect_to(&address);
+   if(fd < 0)
+   {
+      fprintf(stderr, "%s: cannot connect to the server at %s (%s). Abort!\n", __func__, socket_path, strerror(errno));
+      return FDTD_ERROR_FILE;
+   }
+
+   if(input)
+   {
+      char * path = realpath(input, NULL);
+      if(!path)
+      {
+         fprintf(stderr, "%s: cannot find the input file %s. Abort!\n", __func__, input);
+         close(fd);
+         return FDTD_ERROR_FILE;
+      }
+      dprintf(fd, "%s %s\n", request, path);
+      free(path);
+   }
+   else
+      dprintf(fd, "%s\n", request);
+
+   //the answers, until the server closes the connection
+   char line[SERVER_LINE];
+   int ok = 0;
+   while(read_line(fd, line, sizeof(line)) >= 0)
+   {
+      printf("%s\n", line); fflush(stdout);
+      ok = (strncmp(line, "done exit=0 ", 12) == 0 || strcmp(line, "end") == 0 || strcmp(line, "ok") == 0);
+   }
+   close(fd);
+   return (ok ? FDTD_SUCCESS : FDTD_ERROR_STATE);
+}
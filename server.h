@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+/*
+   Local job server (./FDTD --serve socket [memory_budget_in_GB [cache_dir]]).
+
+   The server listens on a Unix-domain socket and runs the input files it is
+   sent, each exactly as "./FDTD input_parameters" would, with the outputs
+   next to the input file and the messages of the job in input_parameters.log.
+   Jobs are submitted with "./FDTD --submit socket input_parameters", which
+   waits for the job and prints one line when it is queued and one when it is
+   done (exit status, wall and cpu seconds, peak resident memory); a whole
+   sweep is submitted by starting one client per input file in the background.
+
+   The protocol is one request line per connection:
+
+      run /absolute/path/to/input   ->  "queued <MB>" and later "done ..."
+                                        (or "refused ..." right away)
+      status                        ->  one line per job, then "end"
+      shutdown                      ->  "ok"; the queued and running jobs are
+                                        finished before the server exits
+
+   Each job is run in a process forked from the server, so a failing job
+   cannot take the server down and its memory is returned when it ends. The
+   jobs share the qubit tables stored in cache_dir (see cache.h; jobs that do
+   not give their own cache_dir use it), but otherwise each job reads its
+   input file, loads its tables and allocates its grids as
+   "./FDTD input_parameters" with the same cache_dir would. Before a job is
+   started its peak memory is estimated as --plan does (see plan.h); jobs are
+   started in the order they are submitted, as many at a time as there are
+   CPUs and as fit into the memory budget together (no limit if it is 0), and
+   a job that does not fit into the budget on its own is refused.
+*/
+
+//runs one input file as ./FDTD does, and returns its exit status
+typedef int (*server_job)(const char * input);
+
+int serve_jobs(const char * socket_path, double budget, const char * cache_dir, server_job run);
+
+//request is "run", "status" or "shutdown"; input is only used by "run"
+int submit_job(const char * socket_path, const char * request, const char * input);
+
+#endif
@@ -0,0 +1,1179 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "solver.h"
+#include "dynamics.h"
+#include "stencil.h"
+#include "numa.h"
+
+
+/*
+   The active window of row j.
+
+   Both schemes keep psi at zero on the node right next to the light cone
+   t=x-a from the mirror image, and (for t<2a) on the node right next to the
+   light cone t=x+a from the qubit. No term of either scheme reaches across
+   these lines before the light cones themselves do, so psi is exactly zero
+   ahead of the 2nd light cone (i>j+plus_a_index) and, in tile B1 (j<nx),
+   in-between the two (j+minus_a_index<i<=plus_a_index). Neither region is
+   visited by the march, and the rows are not written there either, so the
+   pages of psi that only cover them (as in the first Nx rows, for rows larger
+   than a page) are never touched. Behind the data psi is zero as well, which
+   is accounted for by window_start (see initialize_psi).
+*/
+static int active_window_end(const grid * simulation, int j)
+{
+    int last = j+simulation->plus_a_index;
+    return (last < simulation->Ntotal-1 ? last : simulation->Ntotal-1);
+}
+
+
+//window_start is that of the strip (nx+1) before the grid is allocated, e.g. in plan.c
+double marched_points(const grid * simulation, int rows)
+{
+    int first = (simulation->window_start > simulation->nx+1 ? simulation->window_start : simulation->nx+1);
+    double points = 0;
+    for(int j=1; j<rows; j++)
+    {
+        int last = active_window_end(simulation, j);
+        if(last >= first)
+            points += last - first + 1;
+        if(j < simulation->nx && first <= j+simulation->minus_a_index+1)
+            points -= simulation->nx - j; //the gap in tile B1
+    }
+    return points;
+}
+
+
+/*
+   Diagonal copies for the light cones (scheme=2, diagonal_copy=1).
+
+   The four light-cone terms of row j read bar_average at the row
+   r = j-i+minus_a_index (or +plus_a_index) and at a column that decreases
+   with i as well: they walk backwards along the diagonals c-r = minus_a_index+1-j
+   and plus_a_index+1-j of psi (and their neighbours c-1), one row of psi per
+   grid point, which no prefetcher follows. Instead, the march keeps these
+   four diagonals in contiguous arrays, stored in the order of decreasing r, so
+   that the terms read forward unit-stride streams. The diagonals of row j+1
+   are those of row j shifted by one column, so per row only the two new
+   neighbours are gathered from psi (and the other two are extended by the row
+   just computed), and psi is read along a diagonal twice per row instead of
+   eight times. The sums are those of bar_average, bit for bit.
+*/
+static void gather_diagonal(const grid * simulation, int d, int rlo, int rhi, double complex * copy)
+{
+    for(int r=rlo; r<=rhi; r++)
+        copy[simulation->Ny-1-r] = simulation->psi[r][r+d];
+}
+
+
+static void update_cone_diagonals(grid * simulation, int j, int last)
+{
+    //the rows that the light cones of row j reach (see march_row_box)
+    int rlo = (j+simulation->minus_a_index-last > 0 ? j+simulation->minus_a_index-last : 0);
+    int d[2] = {simulation->minus_a_index+1-j, simulation->plus_a_index+1-j};
+
+    for(int f=0; f<2; f++)
+    {
+        double complex ** copy = simulation->cone_diagonal + 2*f;
+        if(simulation->cone_diagonal_row == j-1)
+        {
+            //the diagonal d of row j is the neighbour d-1 of row j-1, which holds the rows up to j-2
+            double complex * swap = copy[0];
+            copy[0] = copy[1];
+            copy[1] = swap;
+            gather_diagonal(simulation, d[f], j-1, j-1, copy[0]);
+        }
+        else
+            gather_diagonal(simulation, d[f], rlo, j-1, copy[0]);
+        gather_diagonal(simulation, d[f]-1, rlo, j-1, copy[1]);
+    }
+    simulation->cone_diagonal_row = j;
+}
+
+
+/*
+   The stencil plan in row j.
+
+   The march gathers the terms of the plan (see stencil.h) a block of columns
+   at a time, one term after the other, into a small buffer, which the
+   recurrence along the row then only has to add up, in the order of the
+   plan; this is possible as the terms only read the rows below row j. The
+   source points of a term are set up once per row, as streams over the
+   columns: the two rows of a square_average in a fixed row, the two diagonal
+   copies of a light cone, or otherwise the rows of psi along the diagonal
+   that a light cone walks. Where a term is off, the buffer holds -0, which
+   adds exactly nothing. The sums are those of square_average and bar_average
+   and the values those of adding the terms point by point, bit for bit. The
+   bounds are not checked here, as the plan is verified when it is built
+   (except in the checked build, which checks them once per row).
+*/
+#define TERM_BLOCK 256 //columns gathered at a time
+
+struct term_gather
+{
+    int first, last;   //the columns of row j where the term is on
+    int light_cone;    //the column where the source row is 0, where the term is halved
+    int square;        //square_average: lower and upper are the rows r-1 and r, shifted by the column
+    const double complex * lower, * upper; //...or the two diagonal copies, shifted by the column
+    double complex * const * rows;         //...or psi+r at i=0, and the source column is column-i
+    int column;
+    double sign, weight;
+    int phased;
+    double complex phase;
+};
+
+
+//the term of the plan in the columns [first, last] of row j; returns 0 if its sources lie outside of the grid,
+//which is only checked in the checked build (create_stencil has verified the plan for all the rows)
+static int gather_term(const grid * simulation, const stencil_term * term, int j, int first, int last, int use_copies, struct term_gather * g)
+{
+    g->sign = term->sign;
+    g->weight = term->weight;
+    g->phased = term->phased;
+    g->phase = term->phase;
+    g->rows = NULL;
+    g->square = (term->average == STENCIL_SQUARE);
+
+    //the source row is 0 on the light cone, where row_step = -1
+    int r0 = j+term->row;
+    g->light_cone = (term->row_step ? r0 : -1);
+    if(!stencil_term_columns(term, j, first, last, &g->first, &g->last))
+        return 1;
+#ifdef FDTD_CHECKED
+    if(!stencil_term_inside(simulation, term, j, g->first, g->last))
+        return 0;
+#endif
+
+    if(g->square) //in a fixed row, column_step = 1
+    {
+        g->lower = simulation->psi[r0-1]+term->column;
+        g->upper = simulation->psi[r0]+term->column;
+    }
+    else if(use_copies && term->diagonal >= 0)
+    {
+        g->lower = simulation->cone_diagonal[term->diagonal]+simulation->Ny-1-r0;
+        g->upper = simulation->cone_diagonal[term->diagonal+1]+simulation->Ny-1-r0;
+    }
+    else //along a diagonal, row_step = column_step = -1
+    {
+        g->rows = simulation->psi+r0;
+        g->column = term->column;
+    }
+    return 1;
+}
+
+
+//the contributions of a term to the columns [i0, i1], in c[i-i0]
+static void gather_contributions(const struct term_gather * g, int i0, int i1, double complex * c)
+{
+    const double complex off = -0.0*(1.0+1.0*I);
+    int lo = (g->first > i0 ? g->first : i0), hi = (g->last < i1 ? g->last : i1);
+    for(int i=i0; i<lo && i<=i1; i++)
+        c[i-i0] = off;
+    for(int i=(hi+1 > i0 ? hi+1 : i0); i<=i1; i++)
+        c[i-i0] = off;
+
+    //sign*weight*average is -(weight*average) or weight*average, and the factor 1 off the light cone is left out
+    double weight = g->sign*g->weight;
+    if(g->rows) //a row of psi per point
+        for(int i=lo; i<=hi; i++)
+            c[i-i0] = weight*((g->rows[-i][g->column-i]+g->rows[-i][g->column-i-1])/2.);
+    else if(g->square)
+        for(int i=lo; i<=hi; i++)
+        {
+            double complex average = 0;
+            average += g->lower[i-1];
+            average += g->lower[i];
+            average += g->upper[i-1];
+            average += g->upper[i];
+            c[i-i0] = weight*(average/4.);
+        }
+    else
+        for(int i=lo; i<=hi; i++)
+            c[i-i0] = weight*((g->lower[i]+g->upper[i])/2.);
+
+    if(g->light_cone >= lo && g->light_cone <= hi)
+        c[g->light_cone-i0] *= 0.5;
+    if(g->phased)
+        for(int i=lo; i<=hi; i++)
+            c[i-i0] *= g->phase;
+}
+
+
+//second-order box scheme (scheme=2) on the columns [first, last] of row j, which must lie in the
+//active window and must not straddle the gap of tile B1; the light cones are read from the diagonal
+//copies if they are up to date for row j (see update_cone_diagonals), from psi otherwise;
+//returns the sum of the values for the NaN check. init_cond (0 if there is no two-photon input),
+//identical_photons and envelope are constants in each of the kernels below
+static inline __attribute__((always_inline))
+double complex march_columns_box(grid * simulation, int j, int first, int last, int use_copies,
+                                 const int init_cond, const int identical_photons, const int envelope)
+{
+    const stencil * plan = simulation->stencil;
+    int nterms = plan->nterms;
+    int nx = simulation->nx, minus_a = simulation->minus_a_index, origin = simulation->origin_index;
+    double Delta = simulation->Delta, Gamma = simulation->Gamma;
+
+    //no other pointer reaches row j: the terms only read the rows below it
+    double complex * restrict row = simulation->psi[j];
+    const double complex * below = simulation->psi[j-1];
+
+    // W = (i*w0+Gamma/2)
+    double complex W = simulation->w0*I+0.5*Gamma;
+
+    //envelope mode: psi = exp(i*k0*(x-2t)) * envelope, so that the march sees W-i*k0
+    //(the delayed terms pick up the phases of the carrier in the plan)
+    if(envelope)
+        W -= I*simulation->k0;
+    double complex diagonal_factor = 1./Delta-0.25*W, side_factor = 0.25*W, prefactor = 1./Delta+0.25*W;
+
+    struct term_gather gather[STENCIL_MAX_TERMS];
+    for(int t=0; t<nterms; t++)
+        if(!gather_term(simulation, &plan->term[t], j, first, last, use_copies, &gather[t]))
+        {
+            fprintf(stderr, "%s: a term of the stencil plan reaches beyond the grid in row j=%i. Abort!\n", __func__, j);
+            return NAN;
+        }
+
+    //NaN and Inf propagate into the sum, so one check per row is enough
+    double complex row_sum = 0;
+    double complex contribution[STENCIL_MAX_TERMS][TERM_BLOCK];
+
+    for(int i0=first; i0<=last; i0+=TERM_BLOCK)
+    {
+        int i1 = (i0+TERM_BLOCK-1 < last ? i0+TERM_BLOCK-1 : last);
+        for(int t=0; t<nterms; t++)
+            gather_contributions(&gather[t], i0, i1, contribution[t]);
+
+        for(int i=i0; i<=i1; i++) //start from x=-Nx*Delta
+        {
+            //free propagation (decay included)
+            double complex value = diagonal_factor*below[i-1] - side_factor*(below[i]+row[i-1]);
+
+            //delayed and light-cone terms
+            for(int t=0; t<nterms; t++)
+                value += contribution[t][i-i0];
+
+            //two-photon input: 2*( chi(x-t,-a-t, 0)-chi(x-t,a-t,0) )
+            if( init_cond && j-i>=-minus_a ) //it's nonzero only when t-x-a>=0
+            {
+                double on_light_cone = (j-i == -minus_a?0.5:1.0);
+
+                //envelope mode: remove the carrier at the center of square
+                double complex center_phase = (envelope ? conj(carrier(j-0.5, i-0.5, simulation)) : 1);
+
+                //shift +0.5 due to Taylor expansion at the center of square
+                double complex source = sqrt(Gamma) * on_light_cone \
+                                        * two_photon_input_mode(init_cond, identical_photons, (i-origin)-j, -nx/2-j+0.5, simulation);
+                value += (envelope ? source*center_phase : source);
+
+                if(j>nx)
+                {
+                    source = sqrt(Gamma) * on_light_cone \
+                             * two_photon_input_mode(init_cond, identical_photons, (i-origin)-j, nx/2-j+0.5, simulation);
+                    value -= (envelope ? source*center_phase : source);
+                }
+            }
+
+            //prefactor
+            value /= prefactor;
+            row[i] = value;
+            row_sum += value;
+        }
+    }
+
+    return row_sum;
+}
+
+
+/*
+   Kernels of the box scheme, one per form of the two-photon input (see
+   stencil.h) and with or without the envelope. Each is march_columns_box
+   compiled with these as constants, so that the loop over the columns has no
+   checks of the mode left and the input is evaluated without a switch at
+   every point. The kernel is chosen once per row from the plan.
+*/
+typedef double complex (*box_kernel)(grid * simulation, int j, int first, int last, int use_copies);
+
+#define BOX_KERNEL(name, init_cond, identical_photons, envelope)                                   \
+    static double complex name(grid * simulation, int j, int first, int last, int use_copies)     \
+    {                                                                                              \
+        return march_columns_box(simulation, j, first, last, use_copies, init_cond, identical_photons, envelope); \
+    }
+
+BOX_KERNEL(box_no_input,                   0, 1, 0)
+BOX_KERNEL(box_no_input_envelope,          0, 1, 1)
+BOX_KERNEL(box_plane_waves,                1, 1, 0)
+BOX_KERNEL(box_plane_waves_envelope,       1, 1, 1)
+BOX_KERNEL(box_exponential,                3, 1, 0)
+BOX_KERNEL(box_exponential_envelope,       3, 1, 1)
+BOX_KERNEL(box_two_exponentials,           3, 0, 0)
+BOX_KERNEL(box_two_exponentials_envelope,  3, 0, 1)
+BOX_KERNEL(box_tabulated,                  5, 1, 0)
+BOX_KERNEL(box_tabulated_envelope,         5, 1, 1)
+#undef BOX_KERNEL
+
+static const box_kernel box_kernels[STENCIL_SOURCES][2] =
+{
+    [STENCIL_NO_INPUT]         = {box_no_input,         box_no_input_envelope},
+    [STENCIL_PLANE_WAVES]      = {box_plane_waves,      box_plane_waves_envelope},
+    [STENCIL_EXPONENTIAL]      = {box_exponential,      box_exponential_envelope},
+    [STENCIL_TWO_EXPONENTIALS] = {box_two_exponentials, box_two_exponentials_envelope},
+    [STENCIL_TABULATED]        = {box_tabulated,        box_tabulated_envelope}
+};
+
+
+static box_kernel select_box_kernel(const grid * simulation)
+{
+    return box_kernels[simulation->stencil->source][simulation->stencil->envelope ? 1 : 0];
+}
+
+
+//the box scheme on the columns [first, last] of row j, which must lie in the active window
+static double complex march_segment_box(grid * simulation, int j, int first, int last, int use_copies, box_kernel kernel)
+{
+    //points (i) right next to the 1st light cone and in tile B1,
+    //and (ii) right next to the 2nd light cone
+    //should be strictly zero under any circumstances, as is everything in-between
+    //the light cones in tile B1 (see active_window_end); psi is already zero initailized there
+    int gap_first = j+simulation->minus_a_index+1, gap_last = simulation->plus_a_index;
+    if(j >= simulation->nx || simulation->window_start > gap_first || first > gap_last || last < gap_first)
+        return kernel(simulation, j, first, last, use_copies);
+
+    double complex row_sum = 0;
+    if(first < gap_first)
+        row_sum += kernel(simulation, j, first, gap_first-1, use_copies);
+    if(last > gap_last)
+        row_sum += kernel(simulation, j, gap_last+1, last, use_copies);
+    return row_sum;
+}
+
+
+static int march_row_box(grid * simulation, int j)
+{
+    int last = active_window_end(simulation, j);
+    if(simulation->cone_diagonal[0])
+        update_cone_diagonals(simulation, j, last);
+
+    double complex row_sum = march_segment_box(simulation, j, simulation->window_start, last, simulation->cone_diagonal[0] != NULL,
+                                               select_box_kernel(simulation));
+    if(!isfinite(creal(row_sum)) || !isfinite(cimag(row_sum)))
+    {
+        fprintf(stderr, "%s: NaN or Inf is produced in row j=%i. Abort!\n", __func__, j);
+        return FDTD_ERROR_NUMERIC;
+    }
+
+    return FDTD_SUCCESS;
+}
+
+
+/*
+   Reference kernel of the box scheme (reference=1).
+
+   The point-by-point loop of the original code, kept as the yardstick of the
+   kernels above (see run_validation in selftest.h): every column from the end
+   of the boundary strip to the right end of the grid is visited, including
+   those that stay zero, and every term is evaluated through square_average
+   and bar_average at every point. It is several times slower than the
+   plan-gathered kernels.
+*/
+static int march_row_reference(grid * simulation, int j)
+{
+    // W = (i*w0+Gamma/2)
+    double complex W = simulation->w0*I+0.5*simulation->Gamma;
+    double complex row_sum = 0;
+
+    for(int i=simulation->nx+1; i<simulation->Ntotal; i++) //start from x=-Nx*Delta
+    {
+        //points (i) right next to the 1st light cone and in tile B1,
+        //and (ii) right next to the 2nd light cone
+        //should be strictly zero under any circumstances
+        if( ((j < simulation->nx) && (i==j+simulation->minus_a_index+1))
+            || (i==j+simulation->plus_a_index+1) )
+            continue; //do nothing, as psi is already zero initailized
+
+        //free propagation (decay included)
+        simulation->psi[j][i] = (1./simulation->Delta-0.25*W)*simulation->psi[j-1][i-1]   \
+                                -0.25*W*(simulation->psi[j-1][i]+simulation->psi[j][i-1]);
+
+        //delay term: psi(x-2a, t-2a)theta(t-2a)
+        if(j>simulation->nx)
+            simulation->psi[j][i] += 0.5*simulation->Gamma*square_average(j-simulation->nx, i-simulation->nx, simulation);
+
+        //left light cone No.1: psi(-x-2a, t-x-a)theta(x+a)theta(t-x-a)
+        if( (i>simulation->minus_a_index) && (j-i>=-simulation->minus_a_index) )
+        {
+            double on_light_cone = (j-i == -simulation->minus_a_index?0.5:1.0);
+            simulation->psi[j][i] -= 0.5*simulation->Gamma*bar_average(j-(i-simulation->origin_index)-simulation->nx/2, \
+                                     2*simulation->origin_index-i-simulation->nx+1, simulation)*on_light_cone;
+        }
+
+        //left light cone No.2: -psi(-x, t-x-a)theta(x+a)theta(t-x-a)
+        if( (i>simulation->minus_a_index) && (j-i>=-simulation->minus_a_index) )
+        {
+            double on_light_cone = (j-i == -simulation->minus_a_index?0.5:1.0);
+            simulation->psi[j][i] += 0.5*simulation->Gamma*bar_average(j-(i-simulation->origin_index)-simulation->nx/2, \
+                                     2*simulation->origin_index-i+1, simulation)*on_light_cone;
+        }
+
+        //right light cone No.1: psi(2a-x, t-x+a)theta(x-a)theta(t-x+a)
+        if( (i>simulation->plus_a_index) && (j-i>=-simulation->plus_a_index) )
+        {
+            double on_light_cone = (j-i == -simulation->plus_a_index?0.5:1.0);
+            simulation->psi[j][i] -= 0.5*simulation->Gamma*bar_average(j-(i-simulation->origin_index)+simulation->nx/2, \
+                                     2*simulation->origin_index-i+simulation->nx+1, simulation)*on_light_cone;
+        }
+
+        //right light cone No.2: -psi(-x, t-x+a)theta(x-a)theta(t-x+a)
+        if( (i>simulation->plus_a_index) && (j-i>=-simulation->plus_a_index) )
+        {
+            double on_light_cone = (j-i == -simulation->plus_a_index?0.5:1.0);
+            simulation->psi[j][i] += 0.5*simulation->Gamma*bar_average(j-(i-simulation->origin_index)+simulation->nx/2, \
+                                     2*simulation->origin_index-i+1, simulation)*on_light_cone;
+        }
+
+        //two-photon input: 2*( chi(x-t,-a-t, 0)-chi(x-t,a-t,0) )
+        if( (simulation->init_cond == 1 || simulation->init_cond == 3 || simulation->init_cond == 5) \
+            && j-i>=-simulation->minus_a_index ) //it's nonzero only when t-x-a>=0
+        {
+            double on_light_cone = (j-i == -simulation->minus_a_index?0.5:1.0);
+
+            //shift +0.5 due to Taylor expansion at the center of square
+            simulation->psi[j][i] += sqrt(simulation->Gamma) * on_light_cone \
+                                     * two_photon_input((i-simulation->origin_index)-j, -simulation->nx/2-j+0.5, simulation);
+
+            if(j>simulation->nx)
+            {
+                simulation->psi[j][i] -= sqrt(simulation->Gamma) * on_light_cone \
+                                         * two_photon_input((i-simulation->origin_index)-j, simulation->nx/2-j+0.5, simulation);
+            }
+        }
+
+        //prefactor
+        simulation->psi[j][i] /= (1./simulation->Delta+0.25*W);
+        row_sum += simulation->psi[j][i];
+    }
+
+    if(!isfinite(creal(row_sum)) || !isfinite(cimag(row_sum)))
+    {
+        fprintf(stderr, "%s: NaN or Inf is produced in row j=%i. Abort!\n", __func__, j);
+        return FDTD_ERROR_NUMERIC;
+    }
+
+    return FDTD_SUCCESS;
+}
+
+
+/*
+   Tiled march (scheme=2, tile_rows >= 2), in parallel if threads > 1.
+
+   A row of psi spans Ntotal points, so for long rows psi[j-1] has left the
+   cache by the time row j comes back to it. The tiled march instead advances a
+   block of tile_rows rows together, in parallelograms tile_columns wide: in
+   step x, row j0+h of the block computes the columns
+   [x-h*nx, x-h*nx+tile_columns), so that each row trails the one below it by
+   nx columns, and the working set of about
+   tile_rows*(tile_columns+tile_rows*nx) points stays in L2. This is what the
+   dependencies allow: besides its left neighbour and points to the left in the
+   rows below, psi[j][i] only reads ahead of column i through the left light
+   cone No.2, which reaches nx+1-2d columns ahead in row j-d (d>=1). The delay
+   term streams forward through rows j-nx, which the prefetcher follows; the
+   light cones are read from psi, as the diagonal copies are kept for one row
+   at a time.
+
+   The blocks are taken in order by the threads. Within each step, a block
+   waits until the last row of the previous block is nx columns ahead of it,
+   which is published in row_progress with release/acquire ordering (as the
+   sequence of stats.c); by induction all earlier rows are then far enough
+   ahead as well. A thread never gives up a block, even on NaN, so that no
+   other one waits forever. The values are those of the row-by-row march, bit
+   for bit.
+*/
+struct tile_queue
+{
+    grid * simulation;
+    int j0, j1;     //the rows [j0, j1) are marched
+    int next_block; //the next block to be taken
+    int status;
+};
+
+
+static int march_block(grid * simulation, int b0, int b1, int wait)
+{
+    int lag = simulation->nx, width = simulation->tile_columns;
+    box_kernel kernel = select_box_kernel(simulation);
+    double complex row_sum[FDTD_MAX_TILE_ROWS] = {0};
+    int end = active_window_end(simulation, b1-1);
+
+    for(int x=simulation->window_start; x-(b1-1-b0)*lag <= end; x+=width)
+    {
+        for(int j=b0; j<b1; j++)
+        {
+            int last = active_window_end(simulation, j);
+            int first = x-(j-b0)*lag;
+            last = (first+width-1 < last ? first+width-1 : last);
+            first = (first > simulation->window_start ? first : simulation->window_start);
+
+            if(j == b0 && wait)
+            {
+                int below = active_window_end(simulation, j-1);
+                int needed = (last+lag < below ? last+lag : below);
+                while(__atomic_load_n(&simulation->row_progress[j-1], __ATOMIC_ACQUIRE) < needed)
+                    sched_yield();
+            }
+            if(first <= last)
+                row_sum[j-b0] += march_segment_box(simulation, j, first, last, 0, kernel);
+            if(j == b1-1)
+                __atomic_store_n(&simulation->row_progress[j], last, __ATOMIC_RELEASE);
+        }
+    }
+
+    for(int j=b0; j<b1; j++)
+        if(!isfinite(creal(row_sum[j-b0])) || !isfinite(cimag(row_sum[j-b0])))
+        {
+            fprintf(stderr, "%s: NaN or Inf is produced in row j=%i. Abort!\n", __func__, j);
+            return FDTD_ERROR_NUMERIC;
+        }
+    return FDTD_SUCCESS;
+}
+
+
+static void * march_blocks(void * data)
+{
+    struct tile_queue * queue = data;
+    grid * simulation = queue->simulation;
+    for(;;)
+    {
+        int b0 = queue->j0 + simulation->tile_rows*__atomic_fetch_add(&queue->next_block, 1, __ATOMIC_SEQ_CST);
+        if(b0 >= queue->j1)
+            break;
+        int b1 = (b0+simulation->tile_rows < queue->j1 ? b0+simulation->tile_rows : queue->j1);
+        int status = march_block(simulation, b0, b1, b0 > queue->j0);
+        if(status)
+            __atomic_store_n(&queue->status, status, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+
+static int march_rows_tiled(grid * simulation, int j0, int j1)
+{
+    for(int j=j0; j<j1; j++)
+        simulation->row_progress[j] = -1;
+    struct tile_queue queue = {simulation, j0, j1, 0, FDTD_SUCCESS};
+
+    //the calling thread takes blocks as well; if a thread cannot be started, the others take its blocks
+    int blocks = (j1-j0+simulation->tile_rows-1)/simulation->tile_rows;
+    int threads = (simulation->threads < blocks ? simulation->threads : blocks);
+    pthread_t thread[FDTD_MAX_THREADS];
+    int started = 0;
+    for(int t=1; t<threads; t++)
+    {
+        if(pthread_create(&thread[started], NULL, march_blocks, &queue) != 0)
+        {
+            fprintf(stderr, "%s: Warning: cannot start thread %d, the march continues with %d threads.\n", __func__, t, started+1);
+            break;
+        }
+        started++;
+    }
+    march_blocks(&queue);
+    for(int t=0; t<started; t++)
+        pthread_join(thread[t], NULL);
+
+    //the diagonal copies are not kept up to date by the tiles
+    simulation->cone_diagonal_row = -1;
+    return queue.status;
+}
+
+
+/*
+   Striped march (scheme=2, numa=1), one thread per stripe of columns.
+
+   Each thread marches its own stripe of columns (see numa.h) row by row, on
+   the CPU it is pinned to, so that it writes only the pages that it placed
+   on its node. Row j of a stripe needs row j of the stripe on its left
+   (its left neighbour and, by induction, all that lies further left in
+   the rows below), and the first nx columns of row j-1 of the stripe on its
+   right, which the left light cone No.2 reads ahead of the stripe; all other
+   terms read behind column i. So the stripes advance as a pipeline, each one
+   row behind the one on its left, which publishes its progress once after
+   the first nx columns of a row and once at its end, as a single counter
+   row*(Ntotal+1)+column+1 with release/acquire ordering. The light cones are
+   read from psi, as in the tiled march. A thread never gives up a row, even
+   on NaN, so that no other one waits forever; if a thread cannot be started
+   the rows are marched row by row instead. The values are those of the
+   row-by-row march, bit for bit.
+*/
+struct stripe_progress
+{
+    long long value;
+    char pad[64-sizeof(long long)]; //one cache line per stripe
+};
+
+struct stripe_queue
+{
+    grid * simulation;
+    int j0, j1;
+    int n;         //the next stripe to be taken by a thread
+    int stop;      //set if a thread could not be started
+    int status;
+    struct stripe_progress progress[FDTD_MAX_THREADS];
+};
+
+
+static double seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+static long long stripe_position(const grid * simulation, int j, int column)
+{
+    return (long long)j*(simulation->Ntotal+1) + column+1;
+}
+
+
+//wait until stripe n has reached the position; returns 0 if the march is stopped
+static int wait_for_stripe(struct stripe_queue * queue, int n, long long position)
+{
+    while(__atomic_load_n(&queue->progress[n].value, __ATOMIC_ACQUIRE) < position)
+    {
+        if(__atomic_load_n(&queue->stop, __ATOMIC_ACQUIRE))
+            return 0;
+        sched_yield();
+    }
+    return 1;
+}
+
+
+static void * march_stripe(void * data)
+{
+    struct stripe_queue * queue = data;
+    grid * simulation = queue->simulation;
+    numa * placement = simulation->placement;
+    int n = __atomic_fetch_add(&queue->n, 1, __ATOMIC_SEQ_CST);
+    numa_pin(placement, n); //a thread that cannot be pinned still marches its stripe
+
+    int nx = simulation->nx, right = (n+1 < placement->nstripes);
+    box_kernel kernel = select_box_kernel(simulation);
+    double busy = 0, waiting = 0, start = seconds();
+    for(int j=queue->j0; j<queue->j1; j++)
+    {
+        int first = (placement->stripe[n] > simulation->window_start ? placement->stripe[n] : simulation->window_start);
+        int last = active_window_end(simulation, j);
+        last = (placement->stripe[n+1]-1 < last ? placement->stripe[n+1]-1 : last);
+
+        double t = seconds();
+        busy += t-start;
+        if(n > 0 && !wait_for_stripe(queue, n-1, stripe_position(simulation, j+1, -1)))
+            break;
+        if(first <= last && right && !wait_for_stripe(queue, n+1, stripe_position(simulation, j-1, placement->stripe[n+1]+nx-1)))
+            break;
+        start = seconds();
+        waiting += start-t;
+
+        double complex row_sum = 0;
+        if(first <= last)
+        {
+            int head = (first+nx-1 < last ? first+nx-1 : last);
+            row_sum += march_segment_box(simulation, j, first, head, 0, kernel);
+            __atomic_store_n(&queue->progress[n].value, stripe_position(simulation, j, head), __ATOMIC_RELEASE);
+            if(head < last)
+                row_sum += march_segment_box(simulation, j, head+1, last, 0, kernel);
+            placement->points[n] += last-first+1;
+        }
+        __atomic_store_n(&queue->progress[n].value, stripe_position(simulation, j+1, -1), __ATOMIC_RELEASE);
+
+        if(!isfinite(creal(row_sum)) || !isfinite(cimag(row_sum)))
+        {
+            fprintf(stderr, "%s: NaN or Inf is produced in row j=%i. Abort!\n", __func__, j);
+            __atomic_store_n(&queue->status, FDTD_ERROR_NUMERIC, __ATOMIC_SEQ_CST);
+        }
+    }
+    busy += seconds()-start;
+    placement->busy[n] += busy;
+    placement->waiting[n] += waiting;
+    return NULL;
+}
+
+
+static int march_rows_striped(grid * simulation, int j0, int j1)
+{
+    numa * placement = simulation->placement;
+    struct stripe_queue * queue = calloc(1, sizeof(*queue));
+    if(!queue)
+    {
+        fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+        return FDTD_ERROR_MEMORY;
+    }
+    queue->simulation = simulation;
+    queue->j0 = j0;
+    queue->j1 = j1;
+    queue->status = FDTD_SUCCESS;
+    for(int n=0; n<placement->nstripes; n++)
+        queue->progress[n].value = stripe_position(simulation, j0, -1);
+
+    //the calling thread only waits, so that it is not pinned
+    pthread_t thread[FDTD_MAX_THREADS];
+    int started = 0;
+    for(int n=0; n<placement->nstripes; n++)
+    {
+        if(pthread_create(&thread[started], NULL, march_stripe, queue) != 0)
+        {
+            fprintf(stderr, "%s: Warning: cannot start the thread of stripe %d, the rows are marched one by one.\n", __func__, n);
+            __atomic_store_n(&queue->stop, 1, __ATOMIC_RELEASE);
+            break;
+        }
+        started++;
+    }
+    for(int t=0; t<started; t++)
+        pthread_join(thread[t], NULL);
+
+    int status = queue->status;
+    free(queue);
+    simulation->cone_diagonal_row = -1;
+    for(int j=j0; j<j1 && !status && started < placement->nstripes; j++)
+        status = march_row_box(simulation, j);
+    return status;
+}
+
+
+/*
+   Fourth-order scheme (scheme=4).
+
+   Along the characteristic from psi[j-1][i-1] to psi[j][i] the delay PDE reads
+   d(psi)/ds = -W*psi + S(s), where S collects the delay, light-cone and source
+   terms, all of which are known from earlier rows. It is integrated exactly
+   for the exponential and to fourth order for S:
+
+      psi[j][i] = exp(-W*Delta) psi[j-1][i-1] + Delta*(b0*S(0) + bm*S(1/2) + b1*S(1)),
+
+   where b are the weights of exp(-W*Delta*(1-u)) against the quadratic
+   Lagrange basis at u=0, 1/2, 1 (Simpson's rule if W=0). S is evaluated on
+   the step, so the step functions theta(x+a), theta(x-a) and theta(t-2a) take
+   their one-sided values at nodes lying on x=+-a or t=2a, and the light cones
+   keep the weight 1/2 (the nodes on a light cone hold the average of the two
+   limits, as in the box scheme).
+
+   The values of psi at the midpoint images are obtained by cubic interpolation:
+   along diagonals for the delay term and along rows for the light-cone terms.
+   The stencils never straddle the lines where psi is not smooth: the kinks at
+   x=-a, a, 3a and t=0, 2a, 4a, and (in a row) the kinks along the
+   characteristics t=x+3a and t=x+5a, which start from the corners (-a,2a) and
+   (-a,4a), and the light cones t=x+a and t=x-a, whose averaged nodes are left
+   out. Near such lines the stencil is shifted to one side, e.g.
+   (5,15,-5,1)/16 instead of (-1,9,9,-1)/16. Where a light cone leaves fewer
+   than four nodes (near the corners x=-a and x=a at small t), the node on the
+   light cone enters with the one-sided limit, i.e. twice the average minus
+   the limit extrapolated from the other side.
+*/
+
+
+//int_0^1 exp(-z*(1-u)) L(u) du for the quadratic Lagrange basis L at u=0, 1/2, 1
+static void exponential_weights(double complex z, double complex b[3])
+{
+    //J[m] = int_0^1 exp(-z*(1-u)) u^m du
+    double complex J[3];
+    if(cabs(z) < 1.)
+    {
+        //J[m] = sum_n (-z)^n m!/(m+n+1)!, to avoid the cancellation in the recursion below
+        for(int m=0; m<3; m++)
+        {
+            double complex term = 1./(m+1);
+            J[m] = term;
+            for(int n=1; n<60 && cabs(term) > 1e-18*cabs(J[m]); n++)
+            {
+                term *= -z/(m+n+1);
+                J[m] += term;
+            }
+        }
+    }
+    else
+    {
+        //J[m] = (1 - m*J[m-1])/z
+        J[0] = (1.-cexp(-z))/z;
+        J[1] = (1.-J[0])/z;
+        J[2] = (1.-2.*J[1])/z;
+    }
+
+    b[0] = 2.*J[2] - 3.*J[1] + J[0];
+    b[1] = 4.*J[1] - 4.*J[2];
+    b[2] = 2.*J[2] - J[1];
+}
+
+
+//the value at m from the values v[k] at the integer positions n0+k, k=0..npts-1 (npts<=4)
+static double complex lagrange(const double complex * v, int n0, int npts, double m)
+{
+    double complex sum = 0;
+    for(int k=0; k<npts; k++)
+    {
+        double weight = 1.;
+        for(int l=0; l<npts; l++)
+            if(l != k)
+                weight *= (m-(n0+l))/(double)(k-l);
+        sum += weight*v[k];
+    }
+    return sum;
+}
+
+
+//choose up to 4 consecutive nodes within [lo, hi], as centered around m as possible
+static int choose_stencil(double m, int lo, int hi, int * n0)
+{
+    int npts = (hi-lo+1 < 4 ? hi-lo+1 : 4);
+    int start = (int)floor(m) - 1;
+    if(start > hi-npts+1) start = hi-npts+1;
+    if(start < lo) start = lo;
+    *n0 = start;
+    return npts;
+}
+
+
+//narrow [lo, hi] to the side of the barrier b that contains the segment [m0, m0+1]
+static void apply_barrier(int b, int m0, int * lo, int * hi)
+{
+    if(b <= m0 && b > *lo) *lo = b;
+    if(b >= m0+1 && b < *hi) *hi = b;
+}
+
+
+//psi at the point (r0+m, c0+m) on a diagonal, 0<=m<=1; rows above rmax are not ready
+static double complex interpolate_diagonal(grid * simulation, int r0, int c0, double m, int rmax)
+{
+    int lo = (r0 > c0 ? -c0 : -r0);
+    int hi = (rmax-r0 < simulation->Ntotal-1-c0 ? rmax-r0 : simulation->Ntotal-1-c0);
+    int nx = simulation->nx;
+    apply_barrier(nx-r0, 0, &lo, &hi);
+    apply_barrier(2*nx-r0, 0, &lo, &hi);
+    apply_barrier(simulation->minus_a_index-c0, 0, &lo, &hi);
+    apply_barrier(simulation->plus_a_index-c0, 0, &lo, &hi);
+    apply_barrier(simulation->plus_a_index+nx-c0, 0, &lo, &hi);
+
+    if(m == floor(m) && m >= lo && m <= hi)
+        return simulation->psi[r0+(int)m][c0+(int)m];
+
+    int n0, npts = choose_stencil(m, lo, hi, &n0);
+    double complex v[4];
+    for(int k=0; k<npts; k++)
+        v[k] = simulation->psi[r0+n0+k][c0+n0+k];
+    return lagrange(v, n0, npts, m);
+}
+
+
+//the limit of psi at the light-cone node (r, cone) from the side dir (-1: smaller
+//columns, +1: larger columns); the node holds the average of the two limits, so
+//the other limit is extrapolated from up to three nodes on the other side
+static double complex cone_limit(grid * simulation, int r, int cone, int dir)
+{
+    int lo, hi;
+    if(dir < 0)
+    {
+        lo = cone+1;
+        hi = (cone+3 < simulation->Ntotal-1 ? cone+3 : simulation->Ntotal-1);
+    }
+    else
+    {
+        lo = (cone-3 > 0 ? cone-3 : 0);
+        hi = cone-1;
+    }
+    int barrier[3] = {simulation->minus_a_index, simulation->plus_a_index, simulation->plus_a_index+simulation->nx};
+    for(int n=0; n<3; n++)
+    {
+        if(dir < 0 && barrier[n] > cone && barrier[n] < hi) hi = barrier[n];
+        if(dir > 0 && barrier[n] < cone && barrier[n] > lo) lo = barrier[n];
+    }
+    if(hi < lo)
+        return simulation->psi[r][cone];
+
+    double complex other = lagrange(simulation->psi[r]+lo, lo, hi-lo+1, cone);
+    return 2.*simulation->psi[r][cone] - other;
+}
+
+
+//psi at the column c in row r, c0-1<=c<=c0
+static double complex interpolate_row(grid * simulation, int r, int c0, double c)
+{
+    int lo = 0, hi = simulation->Ntotal-1;
+    apply_barrier(simulation->minus_a_index, c0-1, &lo, &hi);
+    apply_barrier(simulation->plus_a_index, c0-1, &lo, &hi);
+    apply_barrier(simulation->plus_a_index+simulation->nx, c0-1, &lo, &hi);
+    //the characteristics t=x+3a and t=x+5a from the corners (-a,2a) and (-a,4a)
+    apply_barrier(r+simulation->minus_a_index-simulation->nx, c0-1, &lo, &hi);
+    apply_barrier(r+simulation->minus_a_index-2*simulation->nx, c0-1, &lo, &hi);
+
+    //psi jumps across the light cones, and the nodes on them hold the average;
+    //if that leaves fewer than 4 nodes, the stencil is extended to a light cone
+    //with the limit from the segment's side
+    int cone[2] = {r+simulation->minus_a_index, r+simulation->plus_a_index};
+    int lo_cone = 0, hi_cone = 0;
+    for(int n=0; n<2; n++)
+    {
+        if(cone[n] <= c0-1 && cone[n] >= lo) { lo = cone[n]+1; lo_cone = 1; }
+        if(cone[n] >= c0 && cone[n] <= hi) { hi = cone[n]-1; hi_cone = 1; }
+    }
+    if(hi-lo+1 >= 4)
+        lo_cone = hi_cone = 0;
+    double complex lo_limit = 0, hi_limit = 0;
+    if(lo_cone) lo_limit = cone_limit(simulation, r, --lo, +1);
+    if(hi_cone) hi_limit = cone_limit(simulation, r, ++hi, -1);
+
+    if(c == floor(c) && c >= lo && c <= hi)
+    {
+        if(lo_cone && c == lo) return lo_limit;
+        if(hi_cone && c == hi) return hi_limit;
+        return simulation->psi[r][(int)c];
+    }
+
+    int n0, npts = choose_stencil(c, lo, hi, &n0);
+    double complex v[4];
+    for(int k=0; k<npts; k++)
+    {
+        v[k] = simulation->psi[r][n0+k];
+        if(lo_cone && n0+k == lo) v[k] = lo_limit;
+        if(hi_cone && n0+k == hi) v[k] = hi_limit;
+    }
+    return lagrange(v, n0, npts, c);
+}
+
+
+//S at the point u (0, 1/2 or 1) of the step from psi[j-1][i-1] to psi[j][i]
+static double complex step_source(grid * simulation, int j, int i, double u,
+                                  double complex plus_phase, double complex minus_phase)
+{
+    int nx = simulation->nx;
+    int o = simulation->origin_index;
+    double Gamma = simulation->Gamma;
+    double complex S = 0;
+
+    //delay term: psi(x-2a, t-2a)theta(t-2a)
+    if(j>nx)
+    {
+        double complex delay = interpolate_diagonal(simulation, j-1-nx, i-1-nx, u, j-1);
+        S += 0.5*Gamma*(simulation->envelope ? delay*plus_phase : delay);
+    }
+
+    //left light cones: [psi(-x-2a, t-x-a) - psi(-x, t-x-a)]theta(x+a)theta(t-x-a)
+    if( (i>simulation->minus_a_index) && (j-i>=-simulation->minus_a_index) )
+    {
+        double on_light_cone = (j-i == -simulation->minus_a_index?0.5:1.0);
+        int r = j-i+simulation->minus_a_index;
+        double complex cone2 = interpolate_row(simulation, r, 2*o-i+1, 2*o-i+1-u);
+        S -= 0.5*Gamma*on_light_cone*interpolate_row(simulation, r, 2*o-i+1-nx, 2*o-i+1-nx-u);
+        S += 0.5*Gamma*on_light_cone*(simulation->envelope ? cone2*plus_phase : cone2);
+    }
+
+    //right light cones: [psi(2a-x, t-x+a) - psi(-x, t-x+a)]theta(x-a)theta(t-x+a)
+    if( (i>simulation->plus_a_index) && (j-i>=-simulation->plus_a_index) )
+    {
+        double on_light_cone = (j-i == -simulation->plus_a_index?0.5:1.0);
+        int r = j-i+simulation->plus_a_index;
+        double complex cone2 = interpolate_row(simulation, r, 2*o-i+1, 2*o-i+1-u);
+        S -= 0.5*Gamma*on_light_cone*interpolate_row(simulation, r, 2*o-i+1+nx, 2*o-i+1+nx-u);
+        S += 0.5*Gamma*on_light_cone*(simulation->envelope ? cone2*minus_phase : cone2);
+    }
+
+    //two-photon input: 2*( chi(x-t,-a-t, 0)-chi(x-t,a-t,0) )
+    if( (simulation->init_cond == 1 || simulation->init_cond == 3 || simulation->init_cond == 5) && j-i>=-simulation->minus_a_index )
+    {
+        double on_light_cone = (j-i == -simulation->minus_a_index?0.5:1.0);
+        double t = j-1+u, x = i-1+u-o; //in units of Delta
+        double complex source = two_photon_input(x-t, -nx/2-t, simulation);
+        if(j>nx)
+            source -= two_photon_input(x-t, nx/2-t, simulation);
+        if(simulation->envelope)
+            source *= conj(carrier(j-1+u, i-1+u, simulation));
+        S += sqrt(Gamma)*on_light_cone*source;
+    }
+
+    return S;
+}
+
+
+static int march_row_fourth_order(grid * simulation, int j)
+{
+    double complex W = simulation->w0*I+0.5*simulation->Gamma;
+    double complex plus_phase = 1, minus_phase = 1;
+    if(simulation->envelope)
+    {
+        W -= I*simulation->k0;
+        plus_phase = cexp(I*simulation->k0*simulation->nx*simulation->Delta);
+        minus_phase = conj(plus_phase);
+    }
+
+    double complex b[3];
+    exponential_weights(W*simulation->Delta, b);
+    double complex decay = cexp(-W*simulation->Delta);
+    double complex row_sum = 0;
+
+    for(int i=simulation->window_start, last=active_window_end(simulation, j); i<=last; i++)
+    {
+        //ahead of the light cones psi is zero (see active_window_end)
+        if( (j < simulation->nx) && (i==j+simulation->minus_a_index+1) )
+        {
+            i = simulation->plus_a_index;
+            continue;
+        }
+
+        double complex S = b[0]*step_source(simulation, j, i, 0.0, plus_phase, minus_phase)
+                         + b[1]*step_source(simulation, j, i, 0.5, plus_phase, minus_phase)
+                         + b[2]*step_source(simulation, j, i, 1.0, plus_phase, minus_phase);
+        simulation->psi[j][i] = decay*simulation->psi[j-1][i-1] + simulation->Delta*S;
+        row_sum += simulation->psi[j][i];
+    }
+
+    if(!isfinite(creal(row_sum)) || !isfinite(cimag(row_sum)))
+    {
+        fprintf(stderr, "%s: NaN or Inf is produced in row j=%i. Abort!\n", __func__, j);
+        return FDTD_ERROR_NUMERIC;
+    }
+
+    return FDTD_SUCCESS;
+}
+
+
+/*
+   Steady state of the plane wave (init_cond=1, steady_state_tol > 0).
+
+   The plane wave drives psi at the single frequency 2k forever, so once the
+   transients have decayed psi(x,t) = exp(-2ikt) F(x), and the discrete rows
+   obey psi[j] = rho*psi[j-1] with rho = exp(-2ik*Delta) exactly (both schemes
+   are invariant under shifts in t for t>2a, and the source and the boundary
+   strip carry the factor exp(-2ik*Delta) per row). After each row that the
+   front has left (i > j+plus_a_index is outside the grid) the relative rate of
+   change in this co-moving frame
+
+      r_j = ||psi[j] - rho*psi[j-1]|| / (Delta*||psi[j]||)
+
+   is measured over the marched columns; once r_j < steady_state_tol holds for
+   nx+1 consecutive rows, i.e. for a full round trip 2a of the delay, all later
+   rows are extrapolated as rho*psi[j-1] instead of being marched, which costs
+   one multiplication per point. In envelope mode the rows hold the envelope,
+   and rho is taken relative to the carrier.
+*/
+static double complex steady_state_factor(const grid * simulation)
+{
+    double k = simulation->k - (simulation->envelope ? simulation->k0 : 0);
+    return cexp(-2.*I*k*simulation->Delta);
+}
+
+
+static void monitor_steady_state(grid * simulation, int j)
+{
+    if(j-1+simulation->plus_a_index < simulation->Ntotal-1) //the front is still in row j-1
+        return;
+
+    double complex rho = steady_state_factor(simulation);
+    double change = 0, norm = 0;
+    for(int i=simulation->window_start; i<simulation->Ntotal; i++)
+    {
+        double complex d = simulation->psi[j][i] - rho*simulation->psi[j-1][i];
+        change += creal(d)*creal(d) + cimag(d)*cimag(d);
+        norm += creal(simulation->psi[j][i])*creal(simulation->psi[j][i]) + cimag(simulation->psi[j][i])*cimag(simulation->psi[j][i]);
+    }
+
+    double tol = simulation->steady_state_tol*simulation->Delta;
+    simulation->steady_rows = (change < tol*tol*norm ? simulation->steady_rows+1 : 0);
+    if(simulation->steady_rows > simulation->nx)
+        simulation->steady_state_row = j+1;
+}
+
+
+static int extrapolate_row(grid * simulation, int j)
+{
+    double complex rho = steady_state_factor(simulation);
+    for(int i=simulation->window_start; i<simulation->Ntotal; i++)
+        simulation->psi[j][i] = rho*simulation->psi[j-1][i];
+    return FDTD_SUCCESS;
+}
+
+
+int march_row(grid * simulation, int j)
+{
+    if(simulation->steady_state_row && j >= simulation->steady_state_row)
+        return extrapolate_row(simulation, j);
+
+    int status;
+    if(simulation->scheme == 4)
+        status = march_row_fourth_order(simulation, j);
+    else
+        status = (simulation->reference ? march_row_reference(simulation, j) : march_row_box(simulation, j));
+    if(!status && simulation->steady_state_tol > 0)
+        monitor_steady_state(simulation, j);
+    return status;
+}
+
+
+static int tiled(const grid * simulation)
+{
+    return (simulation->tile_rows > 1 && simulation->scheme == 2 && simulation->steady_state_tol == 0);
+}
+
+
+static int striped(const grid * simulation)
+{
+    return (simulation->placement && simulation->scheme == 2 && simulation->steady_state_tol == 0);
+}
+
+
+int march_batch(const grid * simulation)
+{
+    //a few blocks per thread, so that the threads are busy between the calls;
+    //the stripes fill and drain their pipeline once per call
+    if(striped(simulation))
+        return 64*simulation->placement->nstripes;
+    return (tiled(simulation) ? 4*simulation->tile_rows*simulation->threads : 1);
+}
+
+
+int march_rows(grid * simulation, int j0, int nrows)
+{
+    if(striped(simulation))
+        return march_rows_striped(simulation, j0, j0+nrows);
+    if(tiled(simulation))
+        return march_rows_tiled(simulation, j0, j0+nrows);
+
+    for(int j=j0; j<j0+nrows; j++)
+    {
+        int status = march_row(simulation, j);
+        if(status)
+            return status;
+    }
+    return FDTD_SUCCESS;
+}
+
+
+//envelope mode: multiply the carrier back into all rows once the march is complete
+void restore_carrier(grid * simulation)
+{
+    if(!simulation->envelope || simulation->carrier_restored)
+        return;
+
+    for(int j=0; j<simulation->psi_y_size; j++)
+    {
+        //carrier(j, i+1) = carrier(j, i) * exp(i*k0*Delta); the recursion is restarted
+        //every 64 points to keep the accumulated rounding error at the level of machine precision
+        double complex step = cexp(I*simulation->k0*simulation->Delta);
+        double complex factor = 1;
+        for(int i=0; i<simulation->Ntotal; i++)
+        {
+            factor = (i%64 ? factor*step : carrier(j, i, simulation));
+            simulation->psi[j][i] *= factor;
+        }
+    }
+    simulation->carrier_restored = 1;
+}
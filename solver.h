@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __SOLVER_H__
+#define __SOLVER_H__
+
+#include "grid.h"
+
+// compute row j (t=j*Delta) of psi from the rows below it with the box scheme
+// (scheme=2) or the fourth-order scheme along the characteristics (scheme=4);
+// returns FDTD_ERROR_NUMERIC if NaN or Inf is produced anywhere in the row;
+// with steady_state_tol > 0 the rows after the steady state is reached are
+// extrapolated instead (see grid->steady_state_row)
+int march_row(grid * simulation, int j);
+
+// compute the rows [j0, j0+nrows) of psi, in tiles if tile_rows >= 2 (see solver.c);
+// march_batch is the number of rows per call that keeps the tiles and the threads busy
+int march_rows(grid * simulation, int j0, int nrows);
+int march_batch(const grid * simulation);
+
+// number of points visited by the march in the rows [1, rows), i.e. the active
+// windows without the gap of tile B1 (see solver.c), for the flop and byte
+// models of the profiler and the plan
+double marched_points(const grid * simulation, int rows);
+
+// envelope mode: turn the envelope stored in psi back into psi (called when the march is complete)
+void restore_carrier(grid * simulation);
+
+#endif
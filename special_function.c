@@ -35,7 +35,7 @@ double complex incomplete_gamma(int n, double complex x)
    if(n<=0)
    {
       fprintf(stderr, "Error in %s: n must >= 1. Abort!\n", __func__);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
 
    //gamma(n>=1, x=0)=0, no need to do real computation
@@ -48,7 +48,7 @@ double complex incomplete_gamma(int n, double complex x)
       {
 //         printf("Poincare expansion used...\n");
          x = -x; //make x>0
-         double complex prefactor = pow(-1, n)*cexp(x-lgamma(n));
+         double complex prefactor = pow(-1, n)*cexp(x-log_gamma(n));
          double complex temp = 0.;
          double complex sum = 0.;
 
@@ -70,13 +70,13 @@ double complex incomplete_gamma(int n, double complex x)
       {
 //         printf("Series expansion for gamma* used...\n");
          x = -x; //make x>0
-         double complex prefactor = pow(-1, n)*cexp(n*clog(x)-lgamma(n));
+         double complex prefactor = pow(-1, n)*cexp(n*clog(x)-log_gamma(n));
          double complex temp = 0.;
          double complex sum = 0.;
 
          for(int i=0; ; i++)
          {
-            temp = cexp(i*clog(x)-lgamma(i+1))/(n+i);
+            temp = cexp(i*clog(x)-log_gamma(i+1))/(n+i);
             sum += temp;
 
             if(cabs(temp) < cabs(sum)*DBL_EPSILON) //stop the sum when temp is significantly smaller than sum
@@ -93,7 +93,7 @@ double complex incomplete_gamma(int n, double complex x)
 //   else if( cabs(x)>=n+1 || (-50 <= creal(x) && creal(x) < 0) )
    {//compute the infinite sum
 //      printf("series expansion used...\n");
-      double complex prefactor = cexp(n*clog(x)-x-lgamma(n)); //exp(-x)*x^n/(n-1)!
+      double complex prefactor = cexp(n*clog(x)-x-log_gamma(n)); //exp(-x)*x^n/(n-1)!
       double complex sum = 1.0/n;
       double complex temp = 1.0/n;
       for(int i=1; ; i++)
@@ -116,7 +116,7 @@ double complex incomplete_gamma(int n, double complex x)
    {//use the continued fraction frac=(a1/b1+)(a2/b2+)(a3/b3+)...
     //the notation follows Ch.5.2 of Numerical Recipes 3rd Ed.
 //      printf("continued fraction used...\n");
-      double complex prefactor = cexp(n*clog(x)-x-lgamma(n)); //exp(-x)*x^n/(n-1)!
+      double complex prefactor = cexp(n*clog(x)-x-log_gamma(n)); //exp(-x)*x^n/(n-1)!
       double complex b = x+1.0-n;        //b1
       double complex c = INFINITY;       //C1
       double complex d = 1 / b;          //D1=a1/b1
@@ -151,7 +151,7 @@ double complex incomplete_gamma(int n, double complex x)
    }
 
    fprintf(stderr, "%s: NaN is produced (at n=%i and x=%.6f+%.6fI). Abort!\n", __func__, n, creal(x), cimag(x));
-   exit(EXIT_FAILURE);
+   return NAN;
 }
 
 
@@ -162,7 +162,7 @@ double Pochhammer(double a, int n)
    if(n < 0)
    {
       fprintf(stderr, "%s: negative argument in n=%i. Abort!\n", __func__, n);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
 
    if(n == 0)
@@ -182,7 +182,7 @@ double complex incomplete_gamma_e(int n, double complex x, double complex y)
    if(n<=0)
    {
       fprintf(stderr, "Error in %s: n must >= 1. Abort!\n", __func__);
-      exit(EXIT_FAILURE);
+      return NAN;
    }
 
    //gamma(n>=1, x=0)=0, no need to do real computation
@@ -195,7 +195,7 @@ double complex incomplete_gamma_e(int n, double complex x, double complex y)
       {
 //         printf("Poincare expansion used...\n");
          x = -x; //make x>0
-         double complex prefactor = pow(-1, n)*cexp(x+y-lgamma(n));
+         double complex prefactor = pow(-1, n)*cexp(x+y-log_gamma(n));
          double complex temp = 0.;
          double complex sum = 0.;
 
@@ -217,13 +217,13 @@ double complex incomplete_gamma_e(int n, double complex x, double complex y)
       {
 //         printf("Series expansion for gamma* used...\n");
          x = -x; //make x>0
-         double complex prefactor = pow(-1, n)*cexp(y+n*clog(x)-lgamma(n));
+         double complex prefactor = pow(-1, n)*cexp(y+n*clog(x)-log_gamma(n));
          double complex temp = 0.;
          double complex sum = 0.;
 
          for(int i=0; ; i++)
          {
-            temp = cexp(i*clog(x)-lgamma(i+1))/(n+i);
+            temp = cexp(i*clog(x)-log_gamma(i+1))/(n+i);
             sum += temp;
 
             if(cabs(temp) < cabs(sum)*DBL_EPSILON) //stop the sum when temp is significantly smaller than sum
@@ -240,7 +240,7 @@ double complex incomplete_gamma_e(int n, double complex x, double complex y)
 //   else if( cabs(x)>=n+1 || (-50 <= creal(x) && creal(x) < 0) )
    {//compute the infinite sum
 //      printf("series expansion used...\n");
-      double complex prefactor = cexp(n*clog(x)-x-lgamma(n)+y); //exp(-x)*x^n/(n-1)!
+      double complex prefactor = cexp(n*clog(x)-x-log_gamma(n)+y); //exp(-x)*x^n/(n-1)!
       double complex sum = 1.0/n;
       double complex temp = 1.0/n;
       for(int i=1; ; i++)
@@ -263,7 +263,7 @@ double complex incomplete_gamma_e(int n, double complex x, double complex y)
    {//use the continued fraction frac=(a1/b1+)(a2/b2+)(a3/b3+)...
     //the notation follows Ch.5.2 of Numerical Recipes 3rd Ed.
 //      printf("continued fraction used...\n");
-      double complex prefactor = cexp(n*clog(x)-x-lgamma(n)); //exp(-x)*x^n/(n-1)!
+      double complex prefactor = cexp(n*clog(x)-x-log_gamma(n)); //exp(-x)*x^n/(n-1)!
       double complex b = x+1.0-n;        //b1
       double complex c = INFINITY;       //C1
       double complex d = 1 / b;          //D1=a1/b1
@@ -298,5 +298,5 @@ double complex incomplete_gamma_e(int n, double complex x, double complex y)
    }
 
    fprintf(stderr, "%s: NaN is produced (at n=%i and x=%.6f+%.6fI). Abort!\n", __func__, n, creal(x), cimag(x));
-   exit(EXIT_FAILURE);
+   return NAN;
 }
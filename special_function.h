@@ -18,6 +18,15 @@
 //#include <math.h>
 #include <float.h> //for DBL_EPSILON ~ 2.2E-16
 
+//lgamma without setting the global signgam, so that the qubit tables can be computed by
+//several threads at once (see pipeline.h)
+static inline double log_gamma(double x)
+{
+   int sign;
+   return lgamma_r(x, &sign);
+}
+
+//on invalid arguments or failed convergence these functions print a message and return NaN
 double complex incomplete_gamma(int n, double complex x);
 double complex incomplete_gamma_e(int n, double complex x, double complex y);
 double Pochhammer(double a, int n);
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+
+
+const char * stats_phase_names[STATS_NUM_PHASES] = {"qubit", "initial", "boundary", "psi", "march", "output", "done"};
+
+
+static double epoch_time(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+//resident memory of this process (0 if unknown)
+static int64_t resident_bytes(void)
+{
+   int64_t bytes = 0;
+#ifdef __linux__
+   FILE * f = fopen("/proc/self/statm", "r");
+   if(f)
+   {
+      long size, resident;
+      if(fscanf(f, "%ld %ld", &size, &resident) == 2)
+         bytes = (int64_t)resident * sysconf(_SC_PAGESIZE);
+      fclose(f);
+   }
+#endif
+   return bytes;
+}
+
+
+//sequence lock: the writer is the only process modifying the block
+static void begin_write(stats_block * block)
+{
+   __atomic_store_n(&block->sequence, block->sequence+1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+static void end_write(stats_block * block)
+{
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+   __atomic_store_n(&block->sequence, block->sequence+1, __ATOMIC_RELAXED);
+}
+
+
+//copy a consistent snapshot of block into out; return 0 if the block is not readable
+static int read_block(const stats_block * block, stats_block * out)
+{
+   for(int attempt=0; attempt<1000; attempt++)
+   {
+      uint64_t before = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+      if(before & 1)
+         continue;
+      memcpy(out, (const void *)block, sizeof(*out));
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if(__atomic_load_n(&block->sequence, __ATOMIC_RELAXED) == before)
+         return (out->magic == STATS_MAGIC && out->version == STATS_VERSION);
+   }
+   return 0;
+}
+
+
+//the grids of this process that published stats so far; it numbers their files
+static int stats_count;
+
+
+static const char * default_stats_dir(void)
+{
+   struct stat st;
+   if(stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode))
+      return "/dev/shm";
+   return "/tmp";
+}
+
+
+stats * create_stats(const char * dir, const char * filename)
+{
+   if(!dir)
+      dir = default_stats_dir();
+
+   stats * s = calloc(1, sizeof(*s));
+   if(!s || !(s->path = malloc(strlen(dir)+64)))
+   {
+      fprintf(stderr, "%s: cannot allocate memory, live stats are disabled.\n", __func__);
+      free(s);
+      return NULL;
+   }
+   //several grids of one process each have their own file (see fdtd.h)
+   sprintf(s->path, "%s/FDTD.%ld.%d.stats", dir, (long)getpid(), __atomic_fetch_add(&stats_count, 1, __ATOMIC_RELAXED));
+
+   int fd = open(s->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if(fd < 0 || ftruncate(fd, sizeof(stats_block)))
+   {
+      fprintf(stderr, "%s: cannot create %s (%s), live stats are disabled.\n", __func__, s->path, strerror(errno));
+      if(fd >= 0)
+      {
+         close(fd);
+         unlink(s->path);
+      }
+      free(s->path);
+      free(s);
+      return NULL;
+   }
+   s->block = mmap(NULL, sizeof(stats_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if(s->block == MAP_FAILED)
+   {
+      fprintf(stderr, "%s: cannot map %s (%s), live stats are disabled.\n", __func__, s->path, strerror(errno));
+      unlink(s->path);
+      free(s->path);
+      free(s);
+      return NULL;
+   }
+
+   stats_block * block = s->block;
+   begin_write(block);
+   block->pid = getpid();
+   block->phase = STATS_PHASE_QUBIT;
+   block->start_time = block->update_time = epoch_time();
+   strncpy(block->input, filename, STATS_INPUT_LENGTH-1);
+   block->version = STATS_VERSION;
+   block->magic = STATS_MAGIC;
+   end_write(block);
+
+   s->stride = 1;
+   s->last_time = block->start_time;
+   return s;
+}
+
+
+void free_stats(stats * s)
+{
+   if(!s)
+      return;
+
+   stats_set_phase(s, STATS_PHASE_DONE, 0);
+   munmap(s->block, sizeof(stats_block));
+   unlink(s->path);
+   free(s->path);
+   free(s);
+}
+
+
+void stats_set_phase(stats * s, int phase, int64_t rows_total)
+{
+   if(!s)
+      return;
+
+   stats_block * block = s->block;
+   begin_write(block);
+   block->phase = phase;
+   block->row = 0;
+   block->rows_total = rows_total;
+   block->rows_per_second = 0;
+   block->bytes_in_use = resident_bytes();
+   block->update_time = epoch_time();
+   end_write(block);
+
+   s->stride = 1;
+   s->last_row = 0;
+   s->last_time = block->update_time;
+}
+
+
+//this is called from the hot loops, so nothing is done unless stride rows have passed
+void stats_update(stats * s, int64_t row)
+{
+   if(!s || row - s->last_row < s->stride)
+      return;
+
+   double now = epoch_time();
+   double elapsed = now - s->last_time;
+
+   //adapt the stride so that the block is refreshed ~STATS_UPDATE_RATE times per second
+   if(elapsed < 0.5/STATS_UPDATE_RATE && s->stride < (1<<20))
+      s->stride *= 2;
+   else if(elapsed > 2.0/STATS_UPDATE_RATE && s->stride > 1)
+      s->stride /= 2;
+
+   stats_block * block = s->block;
+   begin_write(block);
+   block->row = row;
+   if(elapsed > 0)
+      block->rows_per_second = (row - s->last_row)/elapsed;
+   block->bytes_in_use = resident_bytes();
+   block->update_time = now;
+   end_write(block);
+
+   s->last_row = row;
+   s->last_time = now;
+}
+
+
+void stats_add_bytes_written(stats * s, int64_t bytes)
+{
+   if(!s)
+      return;
+
+   stats_block * block = s->block;
+   begin_write(block);
+   block->bytes_written += bytes;
+   block->update_time = epoch_time();
+   end_write(block);
+}
+
+
+static void print_bytes(double bytes)
+{
+   const char * unit[] = {"B", "KB", "MB", "GB", "TB"};
+   int n = 0;
+   while(bytes >= 1024 && n < 4)
+   {
+      bytes /= 1024; n++;
+   }
+   printf("%7.1f%-2s ", bytes, unit[n]);
+}
+
+
+//print a table of all jobs publishing in dir every interval seconds (once if interval<=0)
+int watch_stats(const char * dir, double interval)
+{
+   if(!dir)
+      dir = default_stats_dir();
+
+   do
+   {
+      DIR * d = opendir(dir);
+      if(!d)
+      {
+         fprintf(stderr, "%s: cannot open %s (%s). Abort!\n", __func__, dir, strerror(errno));
+         return EXIT_FAILURE;
+      }
+
+      if(interval > 0)
+         printf("\033[H\033[2J"); //clear the screen
+      printf("%-12s %-8s %21s %6s %10s %9s %9s %9s %s\n", "grid", "phase", "row/total", "%", "rows/s", "ETA(s)", "memory", "written", "input");
+
+      struct dirent * entry;
+      while( (entry = readdir(d)) )
+      {
+         size_t length = strlen(entry->d_name);
+         if(length <= 11 || strncmp(entry->d_name, "FDTD.", 5) || strcmp(entry->d_name+length-6, ".stats"))
+            continue;
+
+         char * path = malloc(strlen(dir)+strlen(entry->d_name)+2);
+         if(!path)
+            continue;
+         sprintf(path, "%s/%s", dir, entry->d_name);
+         int fd = open(path, O_RDONLY);
+         free(path);
+         if(fd < 0)
+            continue;
+         stats_block * block = mmap(NULL, sizeof(stats_block), PROT_READ, MAP_SHARED, fd, 0);
+         close(fd);
+         if(block == MAP_FAILED)
+            continue;
+
+         stats_block snapshot;
+         if(read_block(block, &snapshot))
+         {
+            int alive = (kill((pid_t)snapshot.pid, 0) == 0 || errno == EPERM);
+            int phase = (snapshot.phase >= 0 && snapshot.phase < STATS_NUM_PHASES ? snapshot.phase : STATS_PHASE_DONE);
+            double percent = (snapshot.rows_total > 0 ? 100.*snapshot.row/snapshot.rows_total : 0);
+            double eta = (snapshot.rows_per_second > 0 ? (snapshot.rows_total-snapshot.row)/snapshot.rows_per_second : 0);
+
+            //the grid is named pid.n after its file, FDTD.<pid>.<n>.stats
+            char grid_name[32];
+            snprintf(grid_name, sizeof(grid_name), "%.*s", (int)(length-11), entry->d_name+5);
+            printf("%-12s %-8s %10ld/%-10ld %5.1f%% %10.1f %9.0f ", grid_name, alive ? stats_phase_names[phase] : "dead",
+                   (long)snapshot.row, (long)snapshot.rows_total, percent, snapshot.rows_per_second, eta);
+            print_bytes(snapshot.bytes_in_use);
+            print_bytes(snapshot.bytes_written);
+            printf("%s\n", snapshot.input);
+         }
+         munmap(block, sizeof(stats_block));
+      }
+      closedir(d);
+      fflush(stdout);
+
+      if(interval > 0)
+         usleep((useconds_t)(interval*1e6));
+   } while(interval > 0);
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include "grid.h"
+
+/*
+   Live progress and metrics of a running job (set stats=1 in the input file).
+
+   Each grid publishes a small, fixed-layout block in an mmap'ed file
+   stats_dir/FDTD.<pid>.<n>.stats, where n numbers the grids of the process
+   (stats_dir defaults to /dev/shm, or /tmp if /dev/shm does not exist), so
+   that any number of local jobs can be watched with "./FDTD --watch
+   [stats_dir]" without attaching to them, one line per grid; this replaces
+   the "\r" progress prints which are lost in Condor logs.
+
+   The block is written lock-free with a sequence lock: the writer makes the
+   sequence number odd, updates the fields, and makes it even again; a reader
+   retries until it sees the same even number before and after copying. The
+   writer is rate-limited to a few updates per second, so calling stats_update
+   for every row of the march costs one integer comparison almost always.
+
+   The layout may only be extended at the end; bump STATS_VERSION if the
+   meaning of an existing field changes.
+*/
+
+#define STATS_MAGIC   0x44544446u //"FDTD"
+#define STATS_VERSION 1
+#define STATS_INPUT_LENGTH 256
+
+enum stats_phase
+{
+   STATS_PHASE_QUBIT = 0,  //prepare_qubit_wavefunction
+   STATS_PHASE_INITIAL,    //initial_condition
+   STATS_PHASE_BOUNDARY,   //boundary_condition
+   STATS_PHASE_PSI,        //initialize_psi
+   STATS_PHASE_MARCH,      //the main loop
+   STATS_PHASE_OUTPUT,     //writing results to files
+   STATS_PHASE_DONE,
+   STATS_NUM_PHASES
+};
+
+struct _stats_block
+{
+   uint32_t magic;
+   uint32_t version;
+   uint64_t sequence;       //odd while the writer is updating
+   int64_t  pid;
+   int32_t  phase;          //enum stats_phase
+   int32_t  reserved;
+   int64_t  row;            //current row of the phase
+   int64_t  rows_total;     //total number of rows of the phase
+   double   rows_per_second;
+   int64_t  bytes_in_use;   //resident memory of the process
+   int64_t  bytes_written;  //output written so far
+   double   start_time;     //seconds since the epoch
+   double   update_time;    //seconds since the epoch
+   char     input[STATS_INPUT_LENGTH];
+};
+typedef struct _stats_block stats_block;
+
+struct _stats
+{
+   stats_block * block; //the mmap'ed region
+   char * path;
+   int stride;          //rows between two updates, adapted to ~STATS_UPDATE_RATE updates per second
+   int64_t last_row;
+   double last_time;
+};
+typedef struct _stats stats;
+
+#define STATS_UPDATE_RATE 4.0
+
+stats * create_stats(const char * dir, const char * filename);
+void free_stats(stats * s);
+void stats_set_phase(stats * s, int phase, int64_t rows_total);
+void stats_update(stats * s, int64_t row);
+void stats_add_bytes_written(stats * s, int64_t bytes);
+int watch_stats(const char * dir, double interval);
+
+extern const char * stats_phase_names[STATS_NUM_PHASES];
+
+#endif
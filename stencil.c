@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "stencil.h"
+
+
+static void add_term(stencil * plan, int average, int row, int row_step, int column, int column_step,
+                     int first_column, int min_row, double sign, double weight, int phased, double complex phase, int diagonal)
+{
+   stencil_term * term = &plan->term[plan->nterms++];
+   term->average = average;
+   term->row = row;
+   term->row_step = row_step;
+   term->column = column;
+   term->column_step = column_step;
+   term->first_column = first_column;
+   term->min_row = min_row;
+   term->sign = sign;
+   term->weight = weight;
+   term->phased = phased;
+   term->phase = phase;
+   term->diagonal = diagonal;
+}
+
+
+int stencil_term_columns(const stencil_term * term, int j, int first, int last, int * lo, int * hi)
+{
+   *lo = (term->first_column > first ? term->first_column : first);
+
+   //the source row j+row+row_step*i is at least min_row
+   int r0 = j+term->row;
+   if(term->row_step == 0)
+      *hi = (r0 >= term->min_row ? last : first-1);
+   else //row_step < 0
+   {
+      int end = (r0-term->min_row)/(-term->row_step);
+      *hi = (end < last ? end : last);
+   }
+   return (*lo <= *hi);
+}
+
+
+int stencil_term_inside(const grid * simulation, const stencil_term * term, int j, int lo, int hi)
+{
+   //both are affine in i, so they are extreme at the ends
+   int r_lo = j+term->row+term->row_step*lo, r_hi = j+term->row+term->row_step*hi;
+   int c_lo = term->column+term->column_step*lo, c_hi = term->column+term->column_step*hi;
+   int r_min = (r_lo < r_hi ? r_lo : r_hi), r_max = (r_lo > r_hi ? r_lo : r_hi);
+   int c_min = (c_lo < c_hi ? c_lo : c_hi), c_max = (c_lo > c_hi ? c_lo : c_hi);
+
+   if(term->average == STENCIL_SQUARE) //the row below is read as well
+      r_min--;
+   return (r_min >= 0 && r_max < j && c_min >= 1 && c_max <= simulation->Ntotal-1);
+}
+
+
+int create_stencil(grid * simulation)
+{
+   stencil * plan = malloc(sizeof(*plan));
+   if(!plan)
+   {
+      fprintf(stderr, "%s: cannot allocate memory. Abort!\n", __func__);
+      return FDTD_ERROR_MEMORY;
+   }
+   simulation->stencil = plan;
+   plan->nterms = 0;
+   plan->envelope = simulation->envelope;
+   switch(simulation->init_cond)
+   {
+      case 1: plan->source = STENCIL_PLANE_WAVES; break;
+      case 3: plan->source = (simulation->identical_photons ? STENCIL_EXPONENTIAL : STENCIL_TWO_EXPONENTIALS); break;
+      case 5: plan->source = STENCIL_TABULATED; break;
+      default: plan->source = STENCIL_NO_INPUT;
+   }
+
+   int nx = simulation->nx;
+   int a = simulation->minus_a_index, b = simulation->plus_a_index, o = simulation->origin_index;
+   double weight = 0.5*simulation->Gamma;
+
+   //envelope mode: the delayed terms pick up the constant phases of the carrier between the two points:
+   //exp(2i*k0*a) for psi(x-2a, t-2a) and psi(-x, t-x-a), exp(-2i*k0*a) for psi(-x, t-x+a)
+   int phased = simulation->envelope;
+   double complex plus_phase = (phased ? cexp(I*simulation->k0*nx*simulation->Delta) : 1);
+   double complex minus_phase = conj(plus_phase);
+
+   //delay term: psi(x-2a, t-2a)theta(t-2a)
+   add_term(plan, STENCIL_SQUARE, -nx, 0, -nx, 1, 0, 1, +1, weight, phased, plus_phase, -1);
+
+   //left light cone No.1: psi(-x-2a, t-x-a)theta(x+a)theta(t-x-a)
+   add_term(plan, STENCIL_BAR, a, -1, 2*a+1, -1, a+1, 0, -1, weight, 0, 1, 0);
+
+   //left light cone No.2: -psi(-x, t-x-a)theta(x+a)theta(t-x-a)
+   add_term(plan, STENCIL_BAR, a, -1, 2*o+1, -1, a+1, 0, +1, weight, phased, plus_phase, 2);
+
+   //right light cone No.1: psi(2a-x, t-x+a)theta(x-a)theta(t-x+a)
+   add_term(plan, STENCIL_BAR, b, -1, 2*b+1, -1, b+1, 0, -1, weight, 0, 1, 2);
+
+   //right light cone No.2: -psi(-x, t-x+a)theta(x-a)theta(t-x+a)
+   add_term(plan, STENCIL_BAR, b, -1, 2*o+1, -1, b+1, 0, +1, weight, phased, minus_phase, 0);
+
+   //the march visits the columns [window_start, j+plus_a_index] of each row (or fewer, see solver.c)
+   for(int j=1; j<simulation->Ny; j++)
+   {
+      int last = (j+b < simulation->Ntotal-1 ? j+b : simulation->Ntotal-1);
+      for(int t=0; t<plan->nterms; t++)
+      {
+         int lo, hi;
+         if(stencil_term_columns(&plan->term[t], j, simulation->window_start, last, &lo, &hi)
+            && !stencil_term_inside(simulation, &plan->term[t], j, lo, hi))
+         {
+            fprintf(stderr, "%s: term %d of the stencil plan reaches outside the grid in row j=%i. Abort!\n", __func__, t, j);
+            return FDTD_ERROR_INPUT;
+         }
+      }
+   }
+
+   return FDTD_SUCCESS;
+}
+
+
+void free_stencil(stencil * plan)
+{
+   free(plan);
+}
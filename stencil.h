@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+ *
+ * This program is free software. It comes without any warranty,
+ * to the extent permitted by applicable law. You can redistribute
+ * it and/or modify it under the terms of the WTFPL, Version 2, as
+ * published by Sam Hocevar. See the accompanying LICENSE file or
+ * http://www.wtfpl.net/ for more details.
+ */
+
+#ifndef __STENCIL_H__
+#define __STENCIL_H__
+
+#include "grid.h"
+
+/*
+   Stencil plan of the box scheme (scheme=2).
+
+   Besides the free propagation and the two-photon input, psi[j][i] collects
+   the delayed and light-cone terms of the delay PDE, each a constant multiple
+   of psi averaged around an earlier point (a = minus_a_index, b = plus_a_index,
+   o = origin_index):
+
+      delay:         +Gamma/2 square_average(j-nx, i-nx)        if j > nx
+      left No.1:     -Gamma/2 bar_average(j-i+a, 2a+1-i)        if i > a, j-i+a >= 0
+      left No.2:     +Gamma/2 bar_average(j-i+a, 2o+1-i)        if i > a, j-i+a >= 0
+      right No.1:    -Gamma/2 bar_average(j-i+b, 2b+1-i)        if i > b, j-i+b >= 0
+      right No.2:    +Gamma/2 bar_average(j-i+b, 2o+1-i)        if i > b, j-i+b >= 0
+
+   The plan lists these terms once per grid, in the order in which the march
+   adds them, so that the march only gathers and accumulates them. The source
+   point of each term is affine in (j, i), so a term stores its offsets and
+   the column where it starts once, rather than in a table per column that
+   would be as large as a row of psi. A term is off where its source row is
+   below min_row and is halved where the source row is 0 (the node on the
+   light cone holds the average of the two limits). In envelope mode, the
+   terms whose two points differ in the phase of the carrier are multiplied by
+   that (constant) phase. The light-cone terms can be read from the diagonal
+   copies of psi (see solver.c).
+
+   A new delayed or light-cone contribution is added in create_stencil,
+   without touching the march. The plan is verified once when it is built:
+   the sources of every term lie in the rows below and within the grid at
+   every point the march visits, so the march reads them without checking
+   the bounds (the checked build, make debug, checks them in every row as
+   well).
+
+   The two-photon input is not a multiple of psi, but a function of the
+   initial state whose form is fixed per grid; the plan records which one it
+   is, and the march runs a kernel compiled for it (see solver.c).
+*/
+
+#define STENCIL_MAX_TERMS 8
+
+enum stencil_average
+{
+   STENCIL_SQUARE, //square_average: 4 points
+   STENCIL_BAR     //bar_average: 2 points in a row
+};
+
+enum stencil_source
+{
+   STENCIL_NO_INPUT,         //single photon (init_cond=2 and 4)
+   STENCIL_PLANE_WAVES,      //init_cond=1
+   STENCIL_EXPONENTIAL,      //init_cond=3 with identical photons
+   STENCIL_TWO_EXPONENTIALS, //init_cond=3 with different photons
+   STENCIL_TABULATED,        //init_cond=5
+   STENCIL_SOURCES
+};
+
+struct _stencil_term
+{
+   int average;              //enum stencil_average
+   int row, row_step;        //the source row is j+row+row_step*i
+   int column, column_step;  //the source column is column+column_step*i
+   int first_column;         //the term is off in the columns to the left of this one
+   int min_row;              //... and where the source row is below this one
+   double sign;              //+1 or -1
+   double weight;            //Gamma/2
+   int phased;               //whether or not the term is multiplied by phase
+   double complex phase;
+   int diagonal;             //the pair of diagonal copies (cone_diagonal+diagonal) that holds the source, or -1
+};
+typedef struct _stencil_term stencil_term;
+
+struct _stencil
+{
+   int source;   //enum stencil_source: the two-photon input
+   int envelope; //whether or not psi is marched as an envelope
+   int nterms;
+   stencil_term term[STENCIL_MAX_TERMS];
+};
+typedef struct _stencil stencil;
+
+//build the plan of the grid (simulation->stencil) and verify that its sources lie in the
+//grid for every row and every column that the march visits
+int create_stencil(grid * simulation);
+void free_stencil(stencil * plan);
+
+//the columns [lo, hi] of [first, last] in row j where the term is on; 0 if there are none
+int stencil_term_columns(const stencil_term * term, int j, int first, int last, int * lo, int * hi);
+
+//whether the sources of the term in the columns [lo, hi] of row j lie in the rows below j and in
+//the columns 1..Ntotal-1 (square_average and bar_average also read the column to the left)
+int stencil_term_inside(const grid * simulation, const stencil_term * term, int j, int lo, int hi);
+
+#endif
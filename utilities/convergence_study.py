@@ -0,0 +1,110 @@
+# Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+#
+# This program is free software. It comes without any warranty,
+# to the extent permitted by applicable law. You can redistribute
+# it and/or modify it under the terms of the WTFPL, Version 2, as
+# published by Sam Hocevar. See the accompanying LICENSE file or
+# http://www.wtfpl.net/ for more details.
+
+# Convergence study of the box scheme (scheme=2) and the fourth-order scheme 
+# (scheme=4): the same physical problem is solved on grids Delta, Delta/2, ...,
+# the wavefunction psi(x>=-a, t) is compared on the points of the coarsest grid 
+# against a scheme=4 run on a grid finer than all of them, and the observed 
+# order, the run time and the cost of reaching a given error are reported.
+#
+# usage: python convergence_study.py [path_to_FDTD [work_dir]]
+
+import sys, os, time, subprocess
+import numpy
+from math import pi, log
+
+
+########################################
+#      Put input parameters below      #
+########################################
+
+# physical parameters (in units of 1/Gamma)
+a = 0.5           # qubit-mirror distance (2a = nx*Delta)
+L = 3.0           # half of the spatial domain (Nx*Delta)
+T = 6.0           # duration ((Ny-1)*Delta)
+w0 = 3.0          # qubit frequency
+k = 3.0           # incident frequency
+alpha = 0.5       # exponential tail of the single-photon wavepacket
+init_cond = 2
+
+# grids: Delta = Delta0/2^n for n in levels; the reference uses Delta0/2^reference_level
+Delta0 = 0.1
+levels = range(0, 4)
+reference_level = 5
+
+# error targets for the cost comparison
+targets = [1e-3, 1e-4, 1e-5]
+
+
+########################################
+#     Do Not Touch the Code Below!     #
+########################################
+
+FDTD = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), os.pardir, "FDTD"))
+work_dir = sys.argv[2] if len(sys.argv) > 2 else "convergence_study"
+if not os.path.isdir(work_dir):
+    os.makedirs(work_dir)
+
+nx0, Nx0, Ny0 = int(round(2*a/Delta0)), int(round(L/Delta0)), int(round(T/Delta0))+1
+
+
+def run(scheme, level):
+    """solve on the grid Delta0/2^level; return psi(x>=-a, t) sampled on the coarsest grid, and the run time"""
+    s = 2**level
+    nx, Nx, Ny, Delta = nx0*s, Nx0*s, (Ny0-1)*s+1, Delta0/s
+    name = os.path.join(work_dir, "scheme%i_level%i" % (scheme, level))
+    f = open(name, "w")
+    for key, value in [("nx", nx), ("Nx", Nx), ("Ny", Ny), ("Delta", "%.17g" % Delta), ("w0", "%.17g" % w0),
+                       ("k", "%.17g" % k), ("gamma", 1.0), ("alpha", alpha), ("init_cond", init_cond),
+                       ("scheme", scheme), ("save_psi_binary", 1), ("Tstep", s-1)]:
+        f.write("%s=%s\n" % (key, value))
+    f.close()
+
+    start = time.time()
+    subprocess.check_call([FDTD, name], stdout=open(os.devnull, "w"))
+    seconds = time.time() - start
+
+    # each row of the binary file starts at x=-a and has Nx+nx/2+1 points
+    psi = numpy.fromfile(name + ".bin", dtype=numpy.complex128).reshape(-1, Nx+nx//2+1)
+    return psi[:, ::s], seconds
+
+
+# the nodes on the light cones hold the average of the jump, which the two schemes
+# treat differently at t=0, so they are left out of the comparison
+rows, cols = numpy.indices((Ny0, Nx0+nx0//2+1))
+off_light_cone = (cols != rows) & (cols != rows+nx0)
+
+reference, seconds = run(4, reference_level)
+print("reference: scheme=4, Delta=%g (%.1f s)\n" % (Delta0/2**reference_level, seconds))
+
+results = {}
+for scheme in [2, 4]:
+    print("scheme=%i" % scheme)
+    print("%10s %12s %8s %10s" % ("Delta", "max error", "order", "time (s)"))
+    previous = None
+    results[scheme] = []
+    for level in levels:
+        psi, seconds = run(scheme, level)
+        error = numpy.abs(psi - reference)[off_light_cone].max()
+        order = log(previous/error, 2) if previous else float("nan")
+        print("%10g %12.3e %8.2f %10.3f" % (Delta0/2**level, error, order, seconds))
+        results[scheme].append((error, seconds))
+        previous = error
+    print("")
+
+# the cost at a fixed error, from the power law fitted to the two finest grids
+print("estimated cost to reach a given error (s):")
+print("%10s %12s %12s %10s" % ("error", "scheme=2", "scheme=4", "speed-up"))
+for target in targets:
+    cost = []
+    for scheme in [2, 4]:
+        (e1, t1), (e2, t2) = results[scheme][-2], results[scheme][-1]
+        p = log(e1/e2, 2)                     # observed order
+        q = log(t2/t1, 2) if t1 > 0 else 2.   # cost exponent (2 for a 2D grid)
+        cost.append(t2 * (e2/target)**(q/p) if p > 0 else float("inf"))
+    print("%10.0e %12.4g %12.4g %10.1f" % (target, cost[0], cost[1], cost[0]/cost[1]))
@@ -0,0 +1,201 @@
+# Copyright (C) 2016 Leo Fang <leofang@phy.duke.edu>
+#
+# This program is free software. It comes without any warranty,
+# to the extent permitted by applicable law. You can redistribute
+# it and/or modify it under the terms of the WTFPL, Version 2, as
+# published by Sam Hocevar. See the accompanying LICENSE file or
+# http://www.wtfpl.net/ for more details.
+
+"""ctypes driver for libfdtd.so: run a simulation and read its state in memory.
+
+The rows of psi and the qubit tables e0/e1 are returned as NumPy arrays that
+share memory with the solver (no copy, no text files), so they change when the
+simulation is stepped and must not be used after the simulation is closed.
+Rows of chi are computed on the fly into a NumPy array.
+
+    from fdtd import Simulation
+    sim = Simulation(nx=20, Nx=100, Ny=300, Delta=0.05, w0=pi, gamma=0.3,
+                     init_cond=1, k=pi, save_chi=1)   # or Simulation("input")
+    sim.step(100)              # march 100 rows
+    row = sim.psi(50)          # complex128 view of psi[50][:]
+    chi = sim.chi(100)         # chi(a+Delta, a+Delta+tau, t=100*Delta)
+    sim.step()                 # march to the end
+    sim.close()
+
+The library is looked up in $FDTD_LIBRARY, then next to this folder (the
+repository root, after running make).
+"""
+
+import os
+import ctypes
+import numpy
+
+_status_names = ["success", "invalid input parameters", "out of memory",
+                 "file cannot be read or written", "NaN is produced",
+                 "invalid request for the current state"]
+
+
+class FDTDError(RuntimeError):
+    def __init__(self, status):
+        RuntimeError.__init__(self, _status_names[status] if 0 <= status < len(_status_names) else "unknown error")
+        self.status = status
+
+
+class _Layout(ctypes.Structure):
+    # must match fdtd_layout in fdtd.h
+    _fields_ = [("nx", ctypes.c_int), ("Nx", ctypes.c_int), ("Ny", ctypes.c_int), ("Ntotal", ctypes.c_int),
+                ("minus_a_index", ctypes.c_int), ("origin_index", ctypes.c_int), ("plus_a_index", ctypes.c_int),
+                ("chi_length", ctypes.c_int), ("Delta", ctypes.c_double)]
+
+
+# called after each row; return True to stop the march
+OBSERVER = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_void_p, ctypes.c_int, ctypes.c_void_p)
+
+
+def _load_library():
+    path = os.environ.get("FDTD_LIBRARY",
+                          os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir, "libfdtd.so"))
+    lib = ctypes.CDLL(path)
+    p, i, d = ctypes.c_void_p, ctypes.c_int, ctypes.c_double
+    for name, restype, argtypes in [
+            ("fdtd_create_from_file", i, [ctypes.c_char_p, ctypes.POINTER(p)]),
+            ("fdtd_create_from_kv", i, [p, ctypes.POINTER(p)]),
+            ("createKVs", p, []),
+            ("addKV", i, [p, ctypes.c_char_p, ctypes.c_char_p]),
+            ("freeKVs", None, [p]),
+            ("fdtd_step", i, [p, i]),
+            ("fdtd_rows_done", i, [p]),
+            ("fdtd_rows_total", i, [p]),
+            ("fdtd_register_observer", i, [p, OBSERVER, p]),
+            ("fdtd_save", i, [p, ctypes.c_char_p]),
+            ("fdtd_destroy", None, [p]),
+            ("fdtd_get_layout", None, [p, ctypes.POINTER(_Layout)]),
+            ("fdtd_psi_row", p, [p, i]),
+            ("fdtd_e0", p, [p, i]),
+            ("fdtd_e1", p, [p]),
+            ("fdtd_chi_row", i, [p, i, p]),
+            ("fdtd_psi_square_integral", d, [p, i])]:
+        f = getattr(lib, name)
+        f.restype = restype
+        f.argtypes = argtypes
+    return lib
+
+
+_lib = None
+
+
+def _check(status):
+    if status:
+        raise FDTDError(status)
+
+
+class Simulation(object):
+    def __init__(self, filename=None, **parameters):
+        global _lib
+        if _lib is None:
+            _lib = _load_library()
+
+        self._grid = ctypes.c_void_p()
+        self._observers = []  # keep the callbacks alive
+        if filename is not None:
+            _check(_lib.fdtd_create_from_file(filename.encode(), ctypes.byref(self._grid)))
+        else:
+            kv = _lib.createKVs()
+            if not kv:
+                raise FDTDError(2)
+            try:
+                for key, value in parameters.items():
+                    _check(_lib.addKV(kv, key.encode(), repr(value).encode()))
+                _check(_lib.fdtd_create_from_kv(kv, ctypes.byref(self._grid)))
+            finally:
+                _lib.freeKVs(kv)
+
+        self.layout = _Layout()
+        _lib.fdtd_get_layout(self._grid, ctypes.byref(self.layout))
+
+    def close(self):
+        if self._grid:
+            _lib.fdtd_destroy(self._grid)
+            self._grid = ctypes.c_void_p()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __del__(self):
+        if _lib is not None:
+            self.close()
+
+    def step(self, nrows=None):
+        """march nrows further rows (default: to the end); returns the number of rows done"""
+        if nrows is None:
+            nrows = self.layout.Ny
+        _check(_lib.fdtd_step(self._grid, nrows))
+        return self.rows_done
+
+    @property
+    def rows_done(self):
+        return _lib.fdtd_rows_done(self._grid)
+
+    def add_observer(self, function):
+        """call function(simulation, j) after row j is computed; a true return value stops the march"""
+        callback = OBSERVER(lambda grid, j, data: 1 if function(self, j) else 0)
+        _check(_lib.fdtd_register_observer(self._grid, callback, None))
+        self._observers.append(callback)
+
+    def save(self, filename):
+        """write the same output files as the FDTD executable"""
+        _check(_lib.fdtd_save(self._grid, filename.encode()))
+
+    def _view(self, address, length):
+        if not address:
+            return None
+        buffer = (ctypes.c_double * (2*length)).from_address(address)
+        array = numpy.ctypeslib.as_array(buffer).view(numpy.complex128)
+        array.flags.writeable = False
+        return array
+
+    def psi(self, j):
+        """zero-copy view of row j of psi (x from -(Nx+nx+1)*Delta, Ntotal points)"""
+        if not 0 <= j < self.layout.Ny:
+            raise IndexError(j)
+        return self._view(_lib.fdtd_psi_row(self._grid, j), self.layout.Ntotal)
+
+    def e0(self, photon=0):
+        """zero-copy view of e0 (photon=1 or 2 for two different photons); None if not used"""
+        return self._view(_lib.fdtd_e0(self._grid, photon), self.layout.Ny)
+
+    def e1(self):
+        """zero-copy view of e1; None if not used"""
+        return self._view(_lib.fdtd_e1(self._grid), self.layout.Ny)
+
+    def chi(self, j, out=None):
+        """chi(a+Delta, a+Delta+tau, t=j*Delta) for tau = 0, Delta, ..., (Nx-nx/2)*Delta"""
+        if out is None:
+            out = numpy.empty(self.layout.chi_length, dtype=numpy.complex128)
+        _check(_lib.fdtd_chi_row(self._grid, j, out.ctypes.data))
+        return out
+
+    def psi_square_integral(self, j):
+        return _lib.fdtd_psi_square_integral(self._grid, j)
+
+    def x(self):
+        """the x coordinate of each point in a row of psi"""
+        return (numpy.arange(self.layout.Ntotal) - self.layout.origin_index) * self.layout.Delta
+
+
+def load_g2(filename):
+    """read input_filename.g2.bin of save_g2=1 (see g2.h): returns the header
+    as a dict and g2 as a float32 array of shape (rows of t, ntau); the rows
+    written so far if the run is still going on"""
+    keys = ["nx", "Nx", "Ny", "Tstep", "init_cond", "ntau", "nrows", "steady_state_row"]
+    with open(filename, "rb") as f:
+        raw = f.read(64)
+    if raw[:6] != b"FDTDG2":
+        raise ValueError(filename + " is not a g2 file")
+    header = dict(zip(keys, numpy.frombuffer(raw, numpy.int32, 8, 8).tolist()))
+    header.update(zip(["Delta", "w0", "gamma"], numpy.frombuffer(raw, numpy.float64, 3, 40).tolist()))
+    g2 = numpy.fromfile(filename, numpy.float32, offset=64)
+    return header, g2[:g2.size - g2.size % header["ntau"]].reshape(-1, header["ntau"])